@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "tac.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n)+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(ARENA_CHUNK))
+#define ARENA_CHUNK_SIZE (64*1024-ARENA_HEADER)
+
+static ARENA_CHUNK *new_chunk(size_t size)
+{
+	ARENA_CHUNK *c=(ARENA_CHUNK *)calloc(1, ARENA_HEADER+size);
+	if(c==NULL)
+	{
+		error("out of memory\n");
+	}
+	c->size=size;
+	return c;
+}
+
+void *arena_alloc(ARENA *a, size_t size)
+{
+	char *p;
+	ARENA_CHUNK *c;
+
+	size=ARENA_ROUND(size);
+	if(size <= (size_t)(a->end-a->free))
+	{
+		p=a->free;
+		a->free+=size;
+		return p;
+	}
+
+	/* big requests get a chunk of their own behind the current one */
+	if(size > ARENA_CHUNK_SIZE/4 && a->chunk!=NULL)
+	{
+		c=new_chunk(size);
+		c->next=a->chunk->next;
+		a->chunk->next=c;
+		return (char *)c+ARENA_HEADER;
+	}
+
+	c=new_chunk(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE);
+	c->next=a->chunk;
+	a->chunk=c;
+	p=(char *)c+ARENA_HEADER;
+	a->free=p+size;
+	a->end=p+c->size;
+	return p;
+}
+
+char *arena_strdup(ARENA *a, const char *s)
+{
+	size_t n=strlen(s)+1;
+	char *p=(char *)arena_alloc(a, n);
+	memcpy(p, s, n);
+	return p;
+}
+
+void arena_release(ARENA *a)
+{
+	ARENA_CHUNK *c=a->chunk;
+
+	while(c!=NULL)
+	{
+		ARENA_CHUNK *next=c->next;
+		free(c);
+		c=next;
+	}
+	a->chunk=NULL;
+	a->free=NULL;
+	a->end=NULL;
+}
@@ -0,0 +1,39 @@
+/* prevent multiple inclusion */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Bump allocator. Nodes are carved one after another out of large
+	zeroed chunks and are never freed one by one; arena_release gives
+	back every chunk at once.
+*/
+typedef struct arena_chunk
+{
+	struct arena_chunk *next; /* older chunk */
+	size_t size; /* usable bytes after the header */
+} ARENA_CHUNK;
+
+typedef struct arena
+{
+	ARENA_CHUNK *chunk; /* newest chunk, head of the list */
+	char *free; /* next free byte in chunk */
+	char *end; /* end of chunk */
+} ARENA;
+
+#define ARENA_INIT { NULL, NULL, NULL }
+
+void *arena_alloc(ARENA *a, size_t size);
+char *arena_strdup(ARENA *a, const char *s);
+void arena_release(ARENA *a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARENA_H */
@@ -37,7 +37,7 @@ int main(int argc,   char *argv[])
 	char *input = argv[1];
 	if(input[strlen(input)-1]!='m') error("%s does not end with .m\n", input);
 
-	if(freopen(input, "r", stdin)==NULL) error("open %s failed\n", input);
+	lex_open(input);
 
 	char *output=strdup(input);
 
@@ -46,11 +46,14 @@ int main(int argc,   char *argv[])
 
 	output[strlen(output)-1]='s';
 	if((file_s=fopen(output,"w"))==NULL) error("open %s failed\n", output);
+	free(output);
 
 	tac_init();
 	yyparse();
+	lex_close();
 	tac_list();
 	tac_obj();
+	tac_release();
 
 	fclose(file_s);
 	fclose(file_x);
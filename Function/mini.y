@@ -175,8 +175,7 @@ variable_list : IDENTIFIER
 function : function_head '(' parameter_list ')' block
 {
 	$$ = do_func($1, $3, $5);
-	scope = 0;
-	sym_tab_local = NULL;
+	scope_pop();
 }
 | error
 {
@@ -188,14 +187,12 @@ function : function_head '(' parameter_list ')' block
 function_head : IDENTIFIER
 {
 	$$ = declare_func($1);
-	scope = 1;
-	sym_tab_local = NULL;
+	scope_push();
 }
 | type IDENTIFIER
 {
 	$$ = declare_func_with_type($2, $1);
-	scope = 1;
-	sym_tab_local = NULL;
+	scope_push();
 }//函数返回值类型
 ;
 
@@ -556,8 +553,7 @@ output_statement : OUTPUT IDENTIFIER
 return_statement : RETURN expression
 {
 	TAC *t=mk_tac(TAC_RETURN, $2->ret, NULL, NULL);
-	t->prev=$2->tac;
-	$$=t;
+	$$=join_tac($2->tac, t);
 }               
 ;
 
@@ -10,6 +10,67 @@
 int scope, next_tmp, next_label;
 SYM *sym_tab_global, *sym_tab_local;
 TAC *tac_first, *tac_last;
+ARENA ir_arena=ARENA_INIT;
+
+/*
+	While parsing, code is passed around as fragments named by their last
+	TAC. Inside a fragment prev and next are the real links, except that
+	the last TAC's next points back at the first one (NULL when the
+	fragment is a single TAC), so join_tac never walks a fragment.
+*/
+#define FRAG_HEAD(t) ((t)->next!=NULL ? (t)->next : (t))
+
+/*
+	A symbol table is the scope's list (sym_tab_global or sym_tab_local,
+	newest first, the order asm_static walks) plus a hash index over the
+	names, chained through SYM.chain. Names are interned, so they are
+	hashed and compared by address. Buckets come from ir_arena and
+	double when the table is as full as it is wide.
+*/
+typedef struct sym_table
+{
+	SYM **list;
+	SYM **bucket;
+	unsigned size; /* power of two */
+	unsigned count;
+} SYM_TABLE;
+
+#define SYM_TABLE_MIN 64
+
+static SYM_TABLE table_global={ &sym_tab_global, NULL, 0, 0 };
+static SYM_TABLE table_local={ &sym_tab_local, NULL, 0, 0 };
+
+/*
+	Integer and char constants are interned by value in open addressing
+	pools instead of the global table, so a repeated constant is one
+	probe with no name formatting or comparison.
+*/
+typedef struct const_pool
+{
+	SYM **slot;
+	unsigned size; /* power of two, at most half full */
+	unsigned count;
+} CONST_POOL;
+
+#define CONST_POOL_MIN 64
+#define CONST_NAME_MAX 13 /* "c-2147483648" */
+
+static CONST_POOL pool_int, pool_char;
+
+/*
+	Spellings from the lexer and temporary names are interned in an open
+	addressing pool, one copy of each in ir_arena.
+*/
+typedef struct str_pool
+{
+	char **slot;
+	unsigned size; /* power of two, at most half full */
+	unsigned count;
+} STR_POOL;
+
+#define STR_POOL_MIN 256
+
+static STR_POOL pool_str;
 
 #define LOOP_CONTEXT_MAX 128
 static LoopContextInfo loop_context_stack[LOOP_CONTEXT_MAX];
@@ -79,49 +140,186 @@ void tac_init()
 	scope=0;
 	sym_tab_global=NULL;
 	sym_tab_local=NULL;	
+	table_global.bucket=table_local.bucket=NULL;
+	table_global.size=table_local.size=0;
+	table_global.count=table_local.count=0;
+	pool_int.slot=pool_char.slot=NULL;
+	pool_int.size=pool_int.count=0;
+	pool_char.size=pool_char.count=0;
+	pool_str.slot=NULL;
+	pool_str.size=pool_str.count=0;
 	next_tmp=0;
 	next_label=1;
 }
 
 void tac_complete()
 {
-	TAC *cur=NULL; 		/* Current TAC */
-	TAC *prev=tac_last; 	/* Previous TAC */
+	if(tac_last==NULL)
+	{
+		tac_first=NULL;
+		return;
+	}
+
+	/* the program is one fragment, its next links are already in place */
+	tac_first=FRAG_HEAD(tac_last);
+	tac_last->next=NULL;
+}
+
+/* all IR of the compilation goes at once */
+void tac_release()
+{
+	arena_release(&ir_arena);
+	tac_init();
+	tac_first=NULL;
+	tac_last=NULL;
+}
+
+static unsigned hash_bytes(const char *s, int len)
+{
+	unsigned h=5381;
+
+	while(len-- > 0) h=h*33+(unsigned char)*s++;
+	return h;
+}
 
-	while(prev !=NULL)
+static unsigned hash_name(const char *name)
+{
+	unsigned long h=(unsigned long)name >> 3;
+
+	h*=2654435761u;
+	return (unsigned)(h ^ (h>>16));
+}
+
+static char **str_find(STR_POOL *pool, const char *s, int len)
+{
+	unsigned i=hash_bytes(s, len) & (pool->size-1);
+
+	while(pool->slot[i]!=NULL
+		&& (strncmp(pool->slot[i], s, len)!=0 || pool->slot[i][len]!='\0'))
+		i=(i+1) & (pool->size-1);
+	return &pool->slot[i];
+}
+
+static void str_grow(STR_POOL *pool)
+{
+	char **old=pool->slot;
+	unsigned old_size=pool->size, i;
+
+	pool->size=old_size ? old_size*2 : STR_POOL_MIN;
+	pool->slot=(char **)arena_alloc(&ir_arena, pool->size*sizeof(char *));
+	for(i=0; i<old_size; i++)
 	{
-		prev->next=cur;
-		cur=prev;
-		prev=prev->prev;
+		if(old[i]!=NULL) *str_find(pool, old[i], strlen(old[i]))=old[i];
 	}
+}
 
-	tac_first = cur;
+/* the one copy of s[0..len), which need not be NUL terminated */
+char *intern(const char *s, int len)
+{
+	char **slot;
+	char *copy;
+
+	if(pool_str.slot==NULL) str_grow(&pool_str);
+
+	slot=str_find(&pool_str, s, len);
+	if(*slot!=NULL) return *slot;
+
+	copy=(char *)arena_alloc(&ir_arena, len+1);
+	memcpy(copy, s, len);
+	copy[len]='\0';
+	*slot=copy;
+
+	if(++pool_str.count*2 > pool_str.size) str_grow(&pool_str);
+	return copy;
 }
 
-SYM *lookup_sym(SYM *symtab, char *name)
+static void table_grow(SYM_TABLE *table)
 {
-	SYM *t=symtab;
+	unsigned size=table->size ? table->size*2 : SYM_TABLE_MIN;
+	SYM *s;
+
+	table->bucket=(SYM **)arena_alloc(&ir_arena, size*sizeof(SYM *));
+	table->size=size;
+
+	/* rechain oldest first so each bucket keeps newest at its head */
+	SYM *rev=NULL, *next;
+	for(s=*table->list; s!=NULL; s=next)
+	{
+		next=s->next;
+		s->chain=rev;
+		rev=s;
+	}
+	for(s=rev; s!=NULL; s=next)
+	{
+		unsigned h=hash_name(s->name) & (size-1);
+		next=s->chain;
+		s->chain=table->bucket[h];
+		table->bucket[h]=s;
+	}
+}
+
+static void table_clear(SYM_TABLE *table)
+{
+	SYM *s;
+
+	if(table->bucket!=NULL)
+	{
+		for(s=*table->list; s!=NULL; s=s->next)
+			table->bucket[hash_name(s->name) & (table->size-1)]=NULL;
+	}
+	*table->list=NULL;
+	table->count=0;
+}
+
+SYM *lookup_sym(SYM_TABLE *table, char *name)
+{
+	SYM *t;
 
+	if(table->bucket==NULL) return NULL;
+
+	t=table->bucket[hash_name(name) & (table->size-1)];
 	while(t !=NULL)
 	{
-		if(strcmp(t->name, name)==0) break; 
-		else t=t->next;
+		if(t->name==name) break; 
+		else t=t->chain;
 	}
 	
 	return t; /* NULL if not found */
 }
 
-void insert_sym(SYM **symtab, SYM *sym)
+void insert_sym(SYM_TABLE *table, SYM *sym)
 {
-	sym->next=*symtab; /* Insert at head */
-	*symtab=sym;
+	unsigned h;
+
+	sym->next=*table->list; /* Insert at head */
+	*table->list=sym;
+
+	if(++table->count > table->size)
+	{
+		table_grow(table); /* chains the new symbol too */
+		return;
+	}
+	h=hash_name(sym->name) & (table->size-1);
+	sym->chain=table->bucket[h];
+	table->bucket[h]=sym;
+}
+
+/* enter and leave a function's local scope */
+void scope_push()
+{
+	table_clear(&table_local);
+	scope=1;
+}
+
+void scope_pop()
+{
+	table_clear(&table_local);
+	scope=0;
 }
 
 SYM *mk_sym(void)
 {
-	SYM *t;
-	t=(SYM *)malloc(sizeof(SYM));
-	return t;
+	return (SYM *)arena_alloc(&ir_arena, sizeof(SYM));
 }
 
 SYM *mk_var(char *name, Type *ty)
@@ -129,9 +327,9 @@ SYM *mk_var(char *name, Type *ty)
 	SYM *sym=NULL;
 
 	if(scope)  
-		sym=lookup_sym(sym_tab_local,name);
+		sym=lookup_sym(&table_local,name);
 	else
-		sym=lookup_sym(sym_tab_global,name);
+		sym=lookup_sym(&table_global,name);
 
 	/* var already declared */
 	if(sym!=NULL)
@@ -149,51 +347,85 @@ SYM *mk_var(char *name, Type *ty)
 	sym->ty = ty ? ty : type_int();
 
 	if(scope)  
-		insert_sym(&sym_tab_local,sym);
+		insert_sym(&table_local,sym);
 	else
-		insert_sym(&sym_tab_global,sym);
+		insert_sym(&table_global,sym);
 
 	return sym;
 }
 
 TAC *join_tac(TAC *c1, TAC *c2)
 {
-	TAC *t;
+	TAC *head1, *head2;
 
 	if(c1==NULL) return c2;
 	if(c2==NULL) return c1;
 
-	/* Run down c2, until we get to the beginning and then add c1 */
-	t=c2;
-	while(t->prev !=NULL) 
-		t=t->prev;
-
-	t->prev=c1;
+	head1=FRAG_HEAD(c1);
+	head2=FRAG_HEAD(c2);
+	c1->next=head2;
+	head2->prev=c1;
+	c2->next=head1;
 	return c2;
 }
 
+static SYM **pool_find(CONST_POOL *pool, int n)
+{
+	unsigned h=(unsigned)n*2654435761u;
+	unsigned i=(h ^ (h>>16)) & (pool->size-1);
+
+	while(pool->slot[i]!=NULL && pool->slot[i]->value!=n)
+		i=(i+1) & (pool->size-1);
+	return &pool->slot[i];
+}
+
+static void pool_grow(CONST_POOL *pool)
+{
+	SYM **old=pool->slot;
+	unsigned old_size=pool->size, i;
+
+	pool->size=old_size ? old_size*2 : CONST_POOL_MIN;
+	pool->slot=(SYM **)arena_alloc(&ir_arena, pool->size*sizeof(SYM *));
+	for(i=0; i<old_size; i++)
+	{
+		if(old[i]!=NULL) *pool_find(pool, old[i]->value)=old[i];
+	}
+}
+
+/* the pooled symbol for n, or a free slot to put it in */
+static SYM **pool_slot(CONST_POOL *pool, int n)
+{
+	if(pool->slot==NULL) pool_grow(pool);
+	return pool_find(pool, n);
+}
+
+static void pool_add(CONST_POOL *pool, SYM **slot, SYM *sym)
+{
+	*slot=sym;
+	if(++pool->count*2 > pool->size) pool_grow(pool);
+}
+
 SYM *mk_char_const(int c)
 {
-	SYM *sym = NULL;
-	char name[16];
-	sprintf(name, "c%d", c); /* key for char constants */
+	SYM **slot = pool_slot(&pool_char, c);
+	SYM *sym;
 
-	sym = lookup_sym(sym_tab_global, name);
-	if (sym != NULL) return sym;
+	if (*slot != NULL) return *slot;
 
 	sym = mk_sym();
 	sym->type = SYM_CHAR; /* keep as numeric literal category */
 	sym->value = c;
-	sym->name = strdup(name);
+	sym->name = (char *)arena_alloc(&ir_arena, CONST_NAME_MAX);
+	sprintf(sym->name, "c%d", c);
 	sym->ty = type_char();
-	insert_sym(&sym_tab_global, sym);
+	pool_add(&pool_char, slot, sym);
 
 	return sym;
 }
 
 TAC *mk_tac(int op, SYM *a, SYM *b, SYM *c)
 {
-	TAC *t=(TAC *)malloc(sizeof(TAC));
+	TAC *t=(TAC *)arena_alloc(&ir_arena, sizeof(TAC));
 
 	t->next=NULL; /* Set these for safety */
 	t->prev=NULL;
@@ -210,7 +442,7 @@ SYM *mk_label(char *name)
 	SYM *t=mk_sym();
 
 	t->type=SYM_LABEL;
-	t->name=strdup(name);
+	t->name=arena_strdup(&ir_arena, name);
 
 	return t;
 }  
@@ -231,31 +463,27 @@ TAC *do_func(SYM *func, TAC *args, TAC *code)
 	tbegin=mk_tac(TAC_BEGINFUNC, NULL, NULL, NULL);
 	tend=mk_tac(TAC_ENDFUNC,   NULL, NULL, NULL);
 
-	tbegin->prev=tlab;
+	tbegin=join_tac(tlab, tbegin);
 	code=join_tac(args, code);
-	tend->prev=join_tac(tbegin, code);
+	tend=join_tac(join_tac(tbegin, code), tend);
 
 	return tend;
 }
 
 SYM *mk_tmp(void)
 {
-	SYM *sym;
-	char *name;
+	char name[12];
+	int len;
 
-	name=malloc(12);
-	sprintf(name, "t%d", next_tmp++); /* Set up text */
-	return mk_var(name, type_int());
+	len=sprintf(name, "t%d", next_tmp++); /* Set up text */
+	return mk_var(intern(name, len), type_int());
 }
 
 SYM *mk_tmp_of_type(Type *t)
 {
-	SYM *sym;
-	char *name;
-	name = (char*)malloc(12);
-	sprintf(name, "t%d", next_tmp++);
-	sym = mk_var(name, t);
-	return sym;
+	char name[12];
+	int len = sprintf(name, "t%d", next_tmp++);
+	return mk_var(intern(name, len), t);
 }
 
 /* mk_tmp_with 已弃用：统一类型系统直接使用 mk_tmp_of_type */
@@ -281,7 +509,7 @@ TAC *declare_para_type(Type *ty, char *name)
 
 SYM *declare_func_with_type(char *name, Type *ret_type)
 {
-	SYM *sym = lookup_sym(sym_tab_global, name);
+	SYM *sym = lookup_sym(&table_global, name);
 	Type *actual_type = ret_type ? ret_type : type_int();
 
 	if(sym!=NULL)
@@ -309,7 +537,7 @@ SYM *declare_func_with_type(char *name, Type *ret_type)
 	{
 		sym=mk_sym();
 		sym->name=name;
-		insert_sym(&sym_tab_global,sym);
+		insert_sym(&table_global,sym);
 	}
 
 	sym->type=SYM_FUNC;
@@ -333,7 +561,7 @@ TAC *do_assign(SYM *var, EXP *exp)
 	if(var->type !=SYM_VAR) error("assignment to non-variable");
 
 	code=mk_tac(TAC_COPY, var, exp->ret, NULL);
-	code->prev=exp->tac;
+	code=join_tac(exp->tac, code);
 
 	return code;
 }
@@ -394,9 +622,9 @@ EXP *do_bin( int binop, EXP *exp1, EXP *exp2)
 	*/
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=join_tac(exp1->tac, exp2->tac);
+	temp=join_tac(join_tac(exp1->tac, exp2->tac), temp);
 	ret=mk_tac(binop, temp->a, exp1->ret, exp2->ret);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp1->ret=temp->a;
 	exp1->tac=ret;
@@ -410,9 +638,9 @@ EXP *do_cmp( int binop, EXP *exp1, EXP *exp2)
 	TAC *ret; /* TAC code for result */
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=join_tac(exp1->tac, exp2->tac);
+	temp=join_tac(join_tac(exp1->tac, exp2->tac), temp);
 	ret=mk_tac(binop, temp->a, exp1->ret, exp2->ret);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp1->ret=temp->a;
 	exp1->tac=ret;
@@ -426,9 +654,9 @@ EXP *do_un( int unop, EXP *exp)
 	TAC *ret; /* TAC code for result */
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=exp->tac;
+	temp=join_tac(exp->tac, temp);
 	ret=mk_tac(unop, temp->a, exp->ret, NULL);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp->ret=temp->a;
 	exp->tac=ret;
@@ -443,7 +671,7 @@ EXP *do_addr(SYM *var)
 	SYM *ret = mk_tmp_of_type(type_ptr(var->ty));
 	TAC *tvar = mk_tac(TAC_VAR, ret, NULL, NULL);
 	TAC *taddr = mk_tac(TAC_ADDR, ret, var, NULL);
-	taddr->prev = tvar;
+	taddr = join_tac(tvar, taddr);
 	return mk_exp(NULL, ret, taddr);
 }
 
@@ -456,9 +684,9 @@ EXP *do_deref(EXP *addr)
 	}
 	SYM *ret = mk_tmp_of_type(elem);
 	TAC *tvar = mk_tac(TAC_VAR, ret, NULL, NULL);
-	tvar->prev = addr->tac;
+	tvar = join_tac(addr->tac, tvar);
 	TAC *tld = mk_tac(TAC_LOAD, ret, addr->ret, NULL);
-	tld->prev = tvar;
+	tld = join_tac(tvar, tld);
 	addr->ret = ret;
 	addr->tac = tld;
 	return addr;
@@ -469,7 +697,7 @@ TAC *do_store(EXP *addr, EXP *rhs)
 {
 	TAC *code = join_tac(addr->tac, rhs->tac);
 	TAC *ts = mk_tac(TAC_STORE, addr->ret, rhs->ret, NULL);
-	ts->prev = code;
+	ts = join_tac(code, ts);
 	return ts;
 }
 
@@ -486,9 +714,9 @@ static EXP *do_ptr_add(EXP *ptr, EXP *off, Type *resultTyPtr)
 	SYM *ret = mk_tmp_of_type(resultTyPtr);
 	TAC *tvar = mk_tac(TAC_VAR, ret, NULL, NULL);
 	TAC *code = join_tac(ptr ? ptr->tac : NULL, off ? off->tac : NULL);
-	tvar->prev = code;
+	tvar = join_tac(code, tvar);
 	TAC *tadd = mk_tac(TAC_ADD, ret, ptr->ret, off->ret);
-	tadd->prev = tvar;
+	tadd = join_tac(tvar, tadd);
 	return mk_exp(NULL, ret, tadd);
 }
 
@@ -567,7 +795,7 @@ static AccessEval access_path_eval_internal(AccessPath *path)
 AccessPath *access_path_new(SYM *base)
 {
 	if (!base) return NULL;
-	AccessPath *path = (AccessPath *)malloc(sizeof(AccessPath));
+	AccessPath *path = (AccessPath *)arena_alloc(&ir_arena, sizeof(AccessPath));
 	path->base = base;
 	path->head = NULL;
 	path->tail = NULL;
@@ -588,7 +816,7 @@ static void access_path_append_step(AccessPath *path, AccessPathStep *step)
 
 AccessPath *access_path_append_field(AccessPath *path, char *field_name)
 {
-	AccessPathStep *step = (AccessPathStep *)malloc(sizeof(AccessPathStep));
+	AccessPathStep *step = (AccessPathStep *)arena_alloc(&ir_arena, sizeof(AccessPathStep));
 	step->kind = ACCESS_STEP_FIELD;
 	step->field_name = field_name;
 	step->index_exp = NULL;
@@ -599,7 +827,7 @@ AccessPath *access_path_append_field(AccessPath *path, char *field_name)
 
 AccessPath *access_path_append_index(AccessPath *path, EXP *index_exp)
 {
-	AccessPathStep *step = (AccessPathStep *)malloc(sizeof(AccessPathStep));
+	AccessPathStep *step = (AccessPathStep *)arena_alloc(&ir_arena, sizeof(AccessPathStep));
 	step->kind = ACCESS_STEP_INDEX;
 	step->field_name = NULL;
 	step->index_exp = index_exp;
@@ -736,15 +964,15 @@ TAC *do_call(char *name, EXP *arglist)
 	while(arglist !=NULL) /* Generate ARG instructions */
 	{
 		temp=mk_tac(TAC_ACTUAL, arglist->ret, NULL, NULL);
-		temp->prev=code;
+		temp=join_tac(code, temp);
 		code=temp;
 
 		alt=arglist->next;
 		arglist=alt;
 	};
 
-	temp=mk_tac(TAC_CALL, NULL, (SYM *)strdup(name), NULL);
-	temp->prev=code;
+	temp=mk_tac(TAC_CALL, NULL, (SYM *)name, NULL);
+	temp=join_tac(code, temp);
 	code=temp;
 
 	return code;
@@ -757,7 +985,7 @@ EXP *do_call_ret(char *name, EXP *arglist)
 	TAC *code; /* Resulting code */
 	TAC *temp; /* Temporary for building code */
 	Type *ret_type = type_int();
-	SYM *func_sym = lookup_sym(sym_tab_global, name);
+	SYM *func_sym = lookup_sym(&table_global, name);
 	if(func_sym && func_sym->type == SYM_FUNC && func_sym->ty)
 	{
 		ret_type = func_sym->ty;
@@ -770,15 +998,15 @@ EXP *do_call_ret(char *name, EXP *arglist)
 	while(arglist !=NULL) /* Generate ARG instructions */
 	{
 		temp=mk_tac(TAC_ACTUAL, arglist->ret, NULL, NULL);
-		temp->prev=code;
+		temp=join_tac(code, temp);
 		code=temp;
 
 		alt=arglist->next;
 		arglist=alt;
 	};
 
-	temp=mk_tac(TAC_CALL, ret, (SYM *)strdup(name), NULL);
-	temp->prev=code;
+	temp=mk_tac(TAC_CALL, ret, (SYM *)name, NULL);
+	temp=join_tac(code, temp);
 	code=temp;
 
 	return mk_exp(NULL, ret, code);
@@ -788,7 +1016,7 @@ char *mk_lstr(int i)
 {
 	char lstr[10]="L";
 	sprintf(lstr,"L%d",i);
-	return(strdup(lstr));	
+	return(arena_strdup(&ir_arena, lstr));	
 }
 
 TAC *do_if(EXP *exp, TAC *stmt)
@@ -796,9 +1024,9 @@ TAC *do_if(EXP *exp, TAC *stmt)
 	TAC *label=mk_tac(TAC_LABEL, mk_label(mk_lstr(next_label++)), NULL, NULL);
 	TAC *code=mk_tac(TAC_IFZ, label->a, exp->ret, NULL);
 
-	code->prev=exp->tac;
+	code=join_tac(exp->tac, code);
 	code=join_tac(code, stmt);
-	label->prev=code;
+	label=join_tac(code, label);
 
 	return label;
 }
@@ -810,12 +1038,12 @@ TAC *do_test(EXP *exp, TAC *stmt1, TAC *stmt2)
 	TAC *code1=mk_tac(TAC_IFZ, label1->a, exp->ret, NULL);
 	TAC *code2=mk_tac(TAC_GOTO, label2->a, NULL, NULL);
 
-	code1->prev=exp->tac; /* Join the code */
+	code1=join_tac(exp->tac, code1); /* Join the code */
 	code1=join_tac(code1, stmt1);
-	code2->prev=code1;
-	label1->prev=code2;
+	code2=join_tac(code1, code2);
+	label1=join_tac(code2, label1);
 	label1=join_tac(label1, stmt2);
-	label2->prev=label1;
+	label2=join_tac(label1, label2);
 	
 	return label2;
 }
@@ -833,24 +1061,23 @@ TAC *do_while(LoopContextInfo *ctx, EXP *exp, TAC *stmt)
 	}
 
 	TAC *branch = mk_tac(TAC_IFZ, ctx->break_label, cond->ret, NULL);
-	branch->prev = cond->tac;
-	join_tac(branch, stmt);
-	TAC *tail = (stmt != NULL) ? stmt : branch;
+	branch = join_tac(cond->tac, branch);
+	TAC *tail = join_tac(branch, stmt);
 
 	TAC *continue_label_tac = NULL;
 	TAC *tail_after_continue = tail;
 	if(ctx->continue_label && ctx->continue_label != ctx->start_label)
 	{
 		continue_label_tac = mk_tac(TAC_LABEL, ctx->continue_label, NULL, NULL);
-		continue_label_tac->prev = tail;
+		continue_label_tac = join_tac(tail, continue_label_tac);
 		tail_after_continue = continue_label_tac;
 	}
 
 	TAC *back = mk_tac(TAC_GOTO, ctx->start_label, NULL, NULL);
-	back->prev = tail_after_continue;
+	back = join_tac(tail_after_continue, back);
 
 	TAC *exit_label = mk_tac(TAC_LABEL, ctx->break_label, NULL, NULL);
-	exit_label->prev = back;
+	exit_label = join_tac(back, exit_label);
 
 	TAC *start_label = mk_tac(TAC_LABEL, ctx->start_label, NULL, NULL);
 	return join_tac(start_label, exit_label);
@@ -869,25 +1096,19 @@ TAC *do_for(LoopContextInfo *ctx, TAC *init, EXP *cond, TAC *post, TAC *body)
 	}
 
 	TAC *branch = mk_tac(TAC_IFZ, ctx->break_label, loop_cond->ret, NULL);
-	branch->prev = loop_cond->tac;
-	join_tac(branch, body);
-	TAC *tail = (body != NULL) ? body : branch;
+	branch = join_tac(loop_cond->tac, branch);
+	TAC *tail = join_tac(branch, body);
 
 	TAC *continue_label_tac = mk_tac(TAC_LABEL, ctx->continue_label, NULL, NULL);
-	continue_label_tac->prev = tail;
+	continue_label_tac = join_tac(tail, continue_label_tac);
 
-	TAC *post_tail = continue_label_tac;
-	if(post != NULL)
-	{
-		join_tac(continue_label_tac, post);
-		post_tail = post;
-	}
+	TAC *post_tail = join_tac(continue_label_tac, post);
 
 	TAC *back = mk_tac(TAC_GOTO, ctx->start_label, NULL, NULL);
-	back->prev = post_tail;
+	back = join_tac(post_tail, back);
 
 	TAC *exit_label = mk_tac(TAC_LABEL, ctx->break_label, NULL, NULL);
-	exit_label->prev = back;
+	exit_label = join_tac(back, exit_label);
 
 	TAC *start_label = mk_tac(TAC_LABEL, ctx->start_label, NULL, NULL);
 	TAC *loop_code = join_tac(start_label, exit_label);
@@ -908,13 +1129,13 @@ static TAC *append_sequence(TAC *tail, TAC *seq)
 static TAC *append_single(TAC *tail, TAC *instr)
 {
 	if (!instr) return tail;
-	if (tail) instr->prev = tail;
+	if (tail) instr = join_tac(tail, instr);
 	return instr;
 }
 
 SwitchCase *switch_case_new(SYM *value, TAC *code)
 {
-	SwitchCase *sc = (SwitchCase *)malloc(sizeof(SwitchCase));
+	SwitchCase *sc = (SwitchCase *)arena_alloc(&ir_arena, sizeof(SwitchCase));
 	if (!sc) {
 		error("out of memory");
 		return NULL;
@@ -1009,9 +1230,9 @@ SYM *get_var(char *name)
 {
 	SYM *sym=NULL; /* Pointer to looked up symbol */
 
-	if(scope) sym=lookup_sym(sym_tab_local,name);
+	if(scope) sym=lookup_sym(&table_local,name);
 
-	if(sym==NULL) sym=lookup_sym(sym_tab_global,name);
+	if(sym==NULL) sym=lookup_sym(&table_global,name);
 
 	if(sym==NULL)
 	{
@@ -1030,7 +1251,7 @@ SYM *get_var(char *name)
 
 EXP *mk_exp(EXP *next, SYM *ret, TAC *code)
 {
-	EXP *exp=(EXP *)malloc(sizeof(EXP));
+	EXP *exp=(EXP *)arena_alloc(&ir_arena, sizeof(EXP));
 
 	exp->next=next;
 	exp->ret=ret;
@@ -1043,7 +1264,7 @@ SYM *mk_text(char *text)
 {
 	SYM *sym=NULL; /* Pointer to looked up symbol */
 
-	sym=lookup_sym(sym_tab_global,text);
+	sym=lookup_sym(&table_global,text);
 
 	/* text already used */
 	if(sym!=NULL)
@@ -1057,29 +1278,27 @@ SYM *mk_text(char *text)
 	sym->name=text;
 	sym->label=next_label++;
 
-	insert_sym(&sym_tab_global,sym);
+	insert_sym(&table_global,sym);
 	return sym;
 }
 
 SYM *mk_int_const(int n)
 {
-	SYM *sym=NULL;
-
-	char name[10];
-	sprintf(name, "%d", n);
+	SYM **slot=pool_slot(&pool_int, n);
+	SYM *sym;
 
-	sym=lookup_sym(sym_tab_global, name);
-	if(sym!=NULL)
+	if(*slot!=NULL)
 	{
-		return sym;
+		return *slot;
 	}
 
 	sym=mk_sym();
 	sym->type=SYM_INT;
 	sym->value=n;
-	sym->name=strdup(name);
+	sym->name=(char *)arena_alloc(&ir_arena, CONST_NAME_MAX);
+	sprintf(sym->name, "%d", n);
 	sym->ty = type_int();
-	insert_sym(&sym_tab_global,sym);
+	pool_add(&pool_int, slot, sym);
 
 	return sym;
 }     
@@ -3,6 +3,7 @@
 #define TAC_H
 
 #include "type.h"
+#include "arena.h"
 #define SYM_UNDEF 0
 #define SYM_VAR 1
 #define SYM_FUNC 2
@@ -59,6 +60,7 @@ typedef struct sym
 	int label;
 	struct tac *address; /* SYM_FUNC */	
 	struct sym *next;
+	struct sym *chain; /* next in symbol table hash bucket */
 	void *etc;
 
 	/* 统一类型系统托管类型信息 */
@@ -120,10 +122,17 @@ extern FILE *file_x, *file_s;
 extern int yylineno, scope, next_tmp, next_label;
 extern SYM *sym_tab_global, *sym_tab_local;
 extern TAC *tac_first, *tac_last;
+extern ARENA ir_arena; /* TAC, SYM, EXP, their names and parse nodes */
 
 /* function */
 void tac_init();
 void tac_complete();
+void tac_release();
+char *intern(const char *s, int len);
+void lex_open(char *path);
+void lex_close();
+void scope_push();
+void scope_pop();
 TAC *join_tac(TAC *c1, TAC *c2);
 void out_str(FILE *f, const char *format, ...);
 void out_sym(FILE *f, SYM *s);
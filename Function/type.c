@@ -1,8 +1,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "type.h"
+#include "arena.h"
 
 extern void error(const char *format, ...);
+extern ARENA ir_arena;
 
 typedef struct StructRegistry {
     char *name;
@@ -28,7 +30,7 @@ Type *type_char(void) { return &TY_CHAR_SINGLETON; }
 
 Type *type_ptr(Type *base)
 {
-    Type *t = (Type*)malloc(sizeof(Type));
+    Type *t = (Type*)arena_alloc(&ir_arena, sizeof(Type));
     t->kind = TY_PTR;
     t->base = base;
     Type *int_type = type_int();
@@ -43,7 +45,7 @@ Type *type_ptr(Type *base)
 Type *type_array(Type *base, int len)
 {
     if(len <= 0) len = 1; /* 防御：至少 1 */
-    Type *t = (Type*)malloc(sizeof(Type));
+    Type *t = (Type*)arena_alloc(&ir_arena, sizeof(Type));
     t->kind = TY_ARRAY;
     t->base = base;          /* base 可以是元素或下一层数组 */
     t->array_len = len;
@@ -0,0 +1,175 @@
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include "analysis.h"
+
+namespace {
+
+/* each pipeline thread analyses the function it is working on */
+thread_local ProgramAnalysis g_analysis;
+thread_local bool g_index_valid = false;
+thread_local bool g_cfg_valid = false;
+std::atomic<int> g_index_builds(0);
+std::atomic<int> g_cfg_builds(0);
+std::atomic<int> g_hits(0);
+
+void build_index()
+{
+    g_analysis.sequence.clear();
+    g_analysis.label_map.clear();
+    g_analysis.func_id.clear();
+
+    int current_func = -1;
+    int next_func_id = 0;
+    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
+    {
+        g_analysis.sequence.push_back(cur);
+        g_analysis.func_id.push_back(current_func);
+
+        if(cur->op == TAC_BEGINFUNC)
+        {
+            current_func = next_func_id++;
+            g_analysis.func_id.back() = current_func;
+        }
+        else if(cur->op == TAC_ENDFUNC)
+        {
+            current_func = -1;
+        }
+
+        if(cur->op == TAC_LABEL && cur->a)
+        {
+            g_analysis.label_map[cur->a] = static_cast<int>(g_analysis.sequence.size() - 1);
+        }
+    }
+
+    g_index_valid = true;
+    g_index_builds++;
+}
+
+int label_target(SYM *label)
+{
+    if(label == nullptr) return -1;
+    auto it = g_analysis.label_map.find(label);
+    return (it == g_analysis.label_map.end()) ? -1 : it->second;
+}
+
+void build_cfg()
+{
+    const std::vector<TAC*> &sequence = g_analysis.sequence;
+    std::vector<std::vector<int>> &succ = g_analysis.succ;
+    std::vector<std::vector<int>> &pred = g_analysis.pred;
+
+    succ.assign(sequence.size(), std::vector<int>());
+    pred.assign(sequence.size(), std::vector<int>());
+
+    auto next_index = [&](size_t idx) -> int {
+        return (idx + 1 < sequence.size()) ? static_cast<int>(idx + 1) : -1;
+    };
+
+    for(size_t i = 0; i < sequence.size(); ++i)
+    {
+        TAC *t = sequence[i];
+        switch(t->op)
+        {
+            case TAC_GOTO:
+            {
+                int target = label_target(t->a);
+                if(target >= 0) succ[i].push_back(target);
+                break;
+            }
+            case TAC_IFZ:
+            {
+                int target = label_target(t->a);
+                if(target >= 0) succ[i].push_back(target);
+                int fall = next_index(i);
+                if(fall >= 0) succ[i].push_back(fall);
+                break;
+            }
+            case TAC_RETURN:
+            case TAC_ENDFUNC:
+                break;
+            default:
+            {
+                int fall = next_index(i);
+                if(fall >= 0) succ[i].push_back(fall);
+                break;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < sequence.size(); ++i)
+    {
+        for(int s : succ[i])
+        {
+            pred[s].push_back(static_cast<int>(i));
+        }
+    }
+
+    g_cfg_valid = true;
+    g_cfg_builds++;
+}
+
+#ifdef ANALYSIS_CHECK
+/* a pass edited the TAC list without invalidating */
+void check_index()
+{
+    size_t i = 0;
+    TAC *cur = tac_first;
+    for(; cur != nullptr && i < g_analysis.sequence.size(); cur = cur->next, ++i)
+    {
+        if(g_analysis.sequence[i] != cur) break;
+    }
+    if(cur != nullptr || i != g_analysis.sequence.size())
+    {
+        fprintf(stderr, "analysis: stale instruction index at %zu\n", i);
+        abort();
+    }
+}
+#endif
+
+} // namespace
+
+const ProgramAnalysis &analysis_index(void)
+{
+    if(g_index_valid)
+    {
+#ifdef ANALYSIS_CHECK
+        check_index();
+#endif
+        g_hits++;
+    }
+    else build_index();
+    return g_analysis;
+}
+
+const ProgramAnalysis &analysis_cfg(void)
+{
+    analysis_index();
+    if(!g_cfg_valid) build_cfg();
+    return g_analysis;
+}
+
+extern "C" void analysis_reset(void)
+{
+    g_analysis = ProgramAnalysis();
+    g_index_valid = false;
+    g_cfg_valid = false;
+    g_index_builds = 0;
+    g_cfg_builds = 0;
+    g_hits = 0;
+}
+
+extern "C" void analysis_invalidate(int what)
+{
+    if(what & ANALYSIS_INDEX) g_index_valid = false;
+    if(what & (ANALYSIS_INDEX | ANALYSIS_CFG)) g_cfg_valid = false;
+}
+
+extern "C" void analysis_stats(int *index_builds, int *cfg_builds, int *hits)
+{
+    if(index_builds) *index_builds = g_index_builds;
+    if(cfg_builds) *cfg_builds = g_cfg_builds;
+    if(hits) *hits = g_hits;
+}
@@ -0,0 +1,97 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "tac.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* what a pass changed, passed to analysis_invalidate */
+#define ANALYSIS_CFG 1      /* a jump changed kind or target */
+#define ANALYSIS_INDEX 2    /* instructions were inserted, removed or moved */
+#define ANALYSIS_ALL (ANALYSIS_CFG | ANALYSIS_INDEX)
+
+void analysis_reset(void);
+void analysis_invalidate(int what);
+void analysis_stats(int *index_builds, int *cfg_builds, int *hits);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+#include <unordered_map>
+
+/*
+    Program-wide analyses shared by the passes. The instruction index is
+    the TAC list in order with a label map and function ids; the CFG is
+    instruction-level successor and predecessor lists over that index.
+    Both are built on first use and kept until a pass invalidates them.
+    Operand rewrites that leave the instruction order and jumps alone do
+    not need to invalidate anything.
+*/
+struct ProgramAnalysis {
+    std::vector<TAC*> sequence;
+    std::unordered_map<SYM*, int> label_map;
+    std::vector<int> func_id;               /* -1 outside functions, ENDFUNC keeps its function's id */
+    std::vector<std::vector<int>> succ;     /* valid after analysis_cfg() */
+    std::vector<std::vector<int>> pred;
+};
+
+const ProgramAnalysis &analysis_index(void);
+const ProgramAnalysis &analysis_cfg(void);
+
+/*
+    Values keyed by variable, stored flat by SYM_INDEX, so lookups are an
+    index instead of a hash. Only SYM_VAR symbols have an index; within
+    one function the indexes are small and dense. clear() resets just
+    the entries set since the last clear, and keys() lists them in the
+    order they were first set, so one table can be reused across many
+    small scopes such as loop bodies.
+*/
+template<typename T>
+class SymMap {
+public:
+    bool contains(const SYM *sym) const
+    {
+        return sym->id >= 0 && SYM_INDEX(sym) < static_cast<int>(present_.size()) && present_[SYM_INDEX(sym)];
+    }
+
+    T &operator[](SYM *sym)
+    {
+        size_t index = SYM_INDEX(sym);
+        if(index >= present_.size())
+        {
+            present_.resize(index + 1 + index / 2, 0);
+            values_.resize(present_.size());
+        }
+        if(!present_[index])
+        {
+            present_[index] = 1;
+            values_[index] = T();
+            keys_.push_back(sym);
+        }
+        return values_[index];
+    }
+
+    const T *find(const SYM *sym) const
+    {
+        return contains(sym) ? &values_[SYM_INDEX(sym)] : nullptr;
+    }
+
+    const std::vector<SYM*> &keys() const { return keys_; }
+
+    void clear()
+    {
+        for(SYM *sym : keys_) present_[SYM_INDEX(sym)] = 0;
+        keys_.clear();
+    }
+
+private:
+    std::vector<char> present_;
+    std::vector<T> values_;
+    std::vector<SYM*> keys_;
+};
+#endif
+
+#endif /* ANALYSIS_H */
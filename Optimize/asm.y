@@ -4,17 +4,34 @@
 #include <string.h>
 #include "inst.h"
 
-#define LABNUM 100
-
 extern int yylineno;
 
-int pass, ip;
+int ip;
+unsigned char *obj; /* object code, written out in one go at the end */
+int obj_size;
+
+/*
+	Labels live in a chained hash table that doubles when it fills up.
+	A reference to a label not yet defined emits 0 and records the
+	offset, the definition patches every recorded offset.
+*/
+struct fixup
+{
+	int at;
+	struct fixup *next;
+};
 
 struct label
 {
-	int addr;
 	char *name;
-} label[LABNUM];
+	int addr;
+	int defined;
+	struct fixup *fixup;
+	struct label *next;
+};
+
+struct label **label;
+int label_size, label_count;
 
 int yylex();
 void yyerror(char* msg);
@@ -22,53 +39,157 @@ void byte1(int  n);
 void byte2(int  n);
 void byte4(int n);
 
-int number(char * name)
+unsigned hash(char *name)
+{
+	unsigned h=5381;
+
+	while(*name)
+		h=h*33 + (unsigned char)*name++;
+	return h;
+}
+
+void *alloc(size_t size)
+{
+	void *p=malloc(size);
+
+	if(p==NULL)
+	{
+		fprintf(stderr, "error: out of memory\n");
+		exit(0);
+	}
+	return p;
+}
+
+void label_grow(void)
+{
+	struct label **old=label, *l, *next;
+	int old_size=label_size, i;
+
+	label_size=old_size ? old_size * 2 : 256;
+	label=(struct label **)alloc(label_size * sizeof(struct label *));
+	memset(label, 0, label_size * sizeof(struct label *));
+
+	for(i=0; i<old_size; i++)
+	{
+		for(l=old[i]; l!=NULL; l=next)
+		{
+			next=l->next;
+			l->next=label[hash(l->name) & (label_size-1)];
+			label[hash(l->name) & (label_size-1)]=l;
+		}
+	}
+	free(old);
+}
+
+struct label *lookup(char * name)
 {
-	int index=0;
+	struct label *l;
+	unsigned h;
+
+	if(label_count >= label_size)
+		label_grow();
 
-	while(label[index].name != NULL)
+	h=hash(name) & (label_size-1);
+	for(l=label[h]; l!=NULL; l=l->next)
 	{
-		if(!strcmp(label[index].name, name)) 
-			return index;
-		index++;
+		if(!strcmp(l->name, name))
+		{
+			free(name);
+			return l;
+		}
 	}
 
-	if(index>=LABNUM)
+	l=(struct label *)alloc(sizeof(struct label));
+	l->name=name;
+	l->addr=0;
+	l->defined=0;
+	l->fixup=NULL;
+	l->next=label[h];
+	label[h]=l;
+	label_count++;
+	return l;
+}
+
+void patch(int at, int n)
+{
+	obj[at]=n;
+	obj[at+1]=n>>8;
+	obj[at+2]=n>>16;
+	obj[at+3]=n>>24;
+}
+
+void define(char *name)
+{
+	struct label *l=lookup(name);
+	struct fixup *f, *next;
+
+	if(l->defined)
 	{
-		fprintf(stderr, "error: too many label");
+		fprintf(stderr, "error: label %s already exist\n", l->name);
 		exit(0);
 	}
+	l->defined=1;
+	l->addr=ip;
 
-	label[index].name=name;
-	return index;
+	for(f=l->fixup; f!=NULL; f=next)
+	{
+		next=f->next;
+		patch(f->at, ip);
+		free(f);
+	}
+	l->fixup=NULL;
+}
+
+/* 4-byte operand holding the address of a label */
+void byte4_label(char *name)
+{
+	struct label *l=lookup(name);
+	struct fixup *f;
+
+	if(!l->defined)
+	{
+		f=(struct fixup *)alloc(sizeof(struct fixup));
+		f->at=ip;
+		f->next=l->fixup;
+		l->fixup=f;
+	}
+	byte4(l->addr);
+}
+
+void reserve(int n)
+{
+	if(ip+n <= obj_size)
+		return;
+
+	while(ip+n > obj_size)
+		obj_size=obj_size ? obj_size * 2 : 4096;
+	obj=(unsigned char *)realloc(obj, obj_size);
+	if(obj==NULL)
+	{
+		fprintf(stderr, "error: out of memory\n");
+		exit(0);
+	}
 }
 
 void byte1(int  n)
 {
-	if(pass==2)
-		putchar(n);
+	reserve(1);
+	obj[ip]=n;
 	ip++;
 }
 
 void byte2(int  n)
 {
-	if(pass==2)
-	{
-		putchar(n);
-		putchar(n>>8);
-	}
+	reserve(2);
+	obj[ip]=n;
+	obj[ip+1]=n>>8;
 	ip+=2;
 }	
 
 void byte4(int n)
 {
-	if(pass==2)
-	{
-		putchar(n);
-		putchar(n>>8);
-		putchar(n>>16);
-		putchar(n>>24);
-	}
+	reserve(4);
+	patch(ip, n);
 	ip+=4;
 }
 
@@ -128,7 +249,7 @@ add_stmt : ADD REG ',' INTEGER
 	byte2(I_ADD_0);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($4)].addr);
+	byte4_label($4);
 }
 | ADD REG ',' REG
 {
@@ -151,7 +272,7 @@ sub_stmt : SUB REG ',' INTEGER
 	byte2(I_SUB_0);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($4)].addr);
+	byte4_label($4);
 }
 | SUB REG ',' REG
 {
@@ -174,7 +295,7 @@ mul_stmt : MUL REG ',' INTEGER
 	byte2(I_MUL_0);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($4)].addr);
+	byte4_label($4);
 }
 | MUL REG ',' REG
 {
@@ -197,7 +318,7 @@ div_stmt : DIV REG ',' INTEGER
 	byte2(I_DIV_0);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($4)].addr);
+	byte4_label($4);
 }
 | DIV REG ',' REG
 {
@@ -219,18 +340,7 @@ tst_stmt : TST REG
 
 lab_stmt : LABEL ':'
 {
-	if(pass==1)
-	{
-		if(label[number($1)].addr==0)
-		{
-			label[number($1)].addr=ip;
-		}
-		else
-		{
-			fprintf(stderr, "error: label %s already exist\n", label[number($1)].name);
-			exit(0);
-		}
-	}
+	define($1);
 }
 ;
 
@@ -239,7 +349,7 @@ jmp_stmt : JMP LABEL
 	byte2(I_JMP_0);
 	byte1(0);
 	byte1(0);
-	byte4(label[number($2)].addr);
+	byte4_label($2);
 }
 | JMP REG
 {
@@ -255,7 +365,7 @@ jez_stmt : JEZ LABEL
 	byte2(I_JEZ_0);
 	byte1(0);
 	byte1(0);
-	byte4(label[number($2)].addr);
+	byte4_label($2);
 }
 | JEZ REG
 {
@@ -271,7 +381,7 @@ jlz_stmt : JLZ LABEL
 	byte2(I_JLZ_0);
 	byte1(0);
 	byte1(0);
-	byte4(label[number($2)].addr);
+	byte4_label($2);
 }
 | JLZ REG
 {
@@ -287,7 +397,7 @@ jgz_stmt : JGZ LABEL
 	byte2(I_JGZ_0);
 	byte1(0);
 	byte1(0);
-	byte4(label[number($2)].addr);
+	byte4_label($2);
 }
 | JGZ REG
 {
@@ -310,7 +420,7 @@ lod_stmt : LOD REG ',' INTEGER
 	byte2(I_LOD_0);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($4)].addr);
+	byte4_label($4);
 }
 | LOD REG ',' REG
 {
@@ -352,7 +462,7 @@ lod_stmt : LOD REG ',' INTEGER
 	byte2(I_LOD_3);
 	byte1($2);
 	byte1(0);
-	byte4(label[number($5)].addr);
+	byte4_label($5);
 }
 | LOD REG ',' '(' REG ')'
 {
@@ -417,7 +527,7 @@ sto_stmt : STO '(' REG ')' ',' INTEGER
 	byte2(I_STO_0);
 	byte1($3);
 	byte1(0);
-	byte4(label[number($6)].addr);
+	byte4_label($6);
 }
 | STO '(' REG ')' ',' REG
 {
@@ -549,19 +659,28 @@ int main(int argc,   char *argv[])
 		return 0;
 	}
 
-	int i=sizeof(label);
-	bzero(label, i);
-
-	/* First pass, set up labels */
-	pass=1;
-	ip=0;
 	yyparse();
 
-	/* Second pass, generate code */
-	pass=2;
-	ip=0;
-	rewind(stdin) ;
-	yyparse();
+	/* every label referenced must have been defined somewhere */
+	int i;
+	struct label *l;
+	for(i=0; i<label_size; i++)
+	{
+		for(l=label[i]; l!=NULL; l=l->next)
+		{
+			if(!l->defined)
+			{
+				fprintf(stderr, "error: label %s not defined\n", l->name);
+				exit(0);
+			}
+		}
+	}
+
+	if(fwrite(obj, 1, ip, stdout) != (size_t)ip || fflush(stdout) != 0)
+	{
+		fprintf(stderr, "error: write %s failed\n", output);
+		return 0;
+	}
 
 	return 0;
 }
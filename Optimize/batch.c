@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tac.h"
+#include "compile.h"
+#include "batch.h"
+
+typedef struct batch_file
+{
+	char *path;
+	int failed;
+	char *message; /* from error() when it failed */
+	double seconds;
+} BATCH_FILE;
+
+typedef struct batch
+{
+	BATCH_FILE *file;
+	int count;
+	int size;
+	int next; /* next file for a worker, under lock */
+	pthread_mutex_t lock;
+} BATCH;
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+static void batch_add(BATCH *b, char *path)
+{
+	if(b->count==b->size)
+	{
+		b->size=b->size ? b->size*2 : 64;
+		b->file=(BATCH_FILE *)realloc(b->file, b->size*sizeof(BATCH_FILE));
+		if(b->file==NULL) error("out of memory\n");
+	}
+	b->file[b->count].path=path;
+	b->file[b->count].failed=0;
+	b->file[b->count].message=NULL;
+	b->file[b->count].seconds=0;
+	b->count++;
+}
+
+static int by_name(const void *x, const void *y)
+{
+	return strcmp(*(char * const *)x, *(char * const *)y);
+}
+
+/* the .m files directly in dir, in name order */
+static void batch_add_dir(BATCH *b, const char *dir)
+{
+	DIR *d=opendir(dir);
+	struct dirent *e;
+	char **names=NULL;
+	int n=0, size=0, i;
+
+	if(d==NULL)
+	{
+		batch_add(b, strdup(dir)); /* fails, and says why, when compiled */
+		return;
+	}
+	while((e=readdir(d))!=NULL)
+	{
+		size_t len=strlen(e->d_name);
+		if(len<3 || strcmp(e->d_name+len-2, ".m")!=0) continue;
+		if(n==size)
+		{
+			size=size ? size*2 : 64;
+			names=(char **)realloc(names, size*sizeof(char *));
+			if(names==NULL) error("out of memory\n");
+		}
+		names[n]=(char *)malloc(strlen(dir)+len+2);
+		if(names[n]==NULL) error("out of memory\n");
+		sprintf(names[n++], "%s/%s", dir, e->d_name);
+	}
+	closedir(d);
+
+	qsort(names, n, sizeof(char *), by_name);
+	for(i=0; i<n; i++) batch_add(b, names[i]);
+	free(names);
+}
+
+static void *batch_worker(void *arg)
+{
+	BATCH *b=(BATCH *)arg;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&b->lock);
+		int i=b->next++;
+		pthread_mutex_unlock(&b->lock);
+		if(i>=b->count) break;
+
+		BATCH_FILE *f=&b->file[i];
+		double start=now();
+		f->failed=compile_file(f->path, 1, &f->message)!=0;
+		f->seconds=now()-start;
+	}
+	return NULL;
+}
+
+int batch_run(char **inputs, int count, int jobs)
+{
+	BATCH b={ NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+	pthread_t *threads;
+	struct stat st;
+	int i, failed=0;
+	double start, wall, busy=0;
+
+	for(i=0; i<count; i++)
+	{
+		if(stat(inputs[i], &st)==0 && S_ISDIR(st.st_mode)) batch_add_dir(&b, inputs[i]);
+		else batch_add(&b, strdup(inputs[i]));
+	}
+
+	if(jobs<=0) jobs=(int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(jobs>b.count) jobs=b.count;
+	if(jobs<=0) jobs=1;
+
+	start=now();
+	threads=(pthread_t *)malloc(jobs*sizeof(pthread_t));
+	if(threads==NULL) error("out of memory\n");
+	for(i=0; i<jobs; i++)
+	{
+		if(pthread_create(&threads[i], NULL, batch_worker, &b)!=0) error("cannot start batch thread\n");
+	}
+	for(i=0; i<jobs; i++) pthread_join(threads[i], NULL);
+	free(threads);
+	wall=now()-start;
+
+	for(i=0; i<b.count; i++)
+	{
+		BATCH_FILE *f=&b.file[i];
+		busy+=f->seconds;
+		if(!f->failed)
+		{
+			printf("ok    %8.3fs  %s\n", f->seconds, f->path);
+		}
+		else
+		{
+			size_t len=f->message!=NULL ? strlen(f->message) : 0;
+			if(len>0 && f->message[len-1]=='\n') f->message[len-1]='\0';
+			printf("FAIL  %8.3fs  %s: %s\n", f->seconds, f->path, len>0 ? f->message : "error");
+			failed++;
+		}
+		free(f->message);
+		free(f->path);
+	}
+	printf("%d files, %d failed, %.3fs on %d threads (%.3fs compiling), %.1f files/s\n",
+		b.count, failed, wall, jobs, busy, wall>0 ? b.count/wall : 0.0);
+	free(b.file);
+
+	return failed;
+}
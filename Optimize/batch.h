@@ -0,0 +1,22 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Compile many programs in one process. Each input is a .m file or a
+	directory, which stands for the .m files directly inside it. Files are
+	shared out over jobs threads (0 meaning one per core), each compiling
+	one file at a time with compile_file. Prints one line per file, in
+	input order, with its status and time, then a throughput summary.
+	Returns the number of files that failed.
+*/
+int batch_run(char **inputs, int count, int jobs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATCH_H */
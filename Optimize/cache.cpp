@@ -0,0 +1,381 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cache.h"
+
+namespace {
+
+const char kMagic[] = "mini-cache 2";
+
+std::string g_dir; /* empty while the cache is off */
+std::string g_binary;
+std::atomic<int> g_hits(0);
+std::atomic<int> g_misses(0);
+std::atomic<int> g_serial(0);
+
+uint64_t fnv1a(const void *data, size_t len, uint64_t h = 1469598103934665603ull)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    while(len-- > 0)
+    {
+        h ^= *p++;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+std::string hex(uint64_t h)
+{
+    char text[17];
+    snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(h));
+    return text;
+}
+
+/* the running compiler, so a rebuilt one never reuses what an older one made */
+std::string binary_hash()
+{
+    const char stamp[] = __DATE__ " " __TIME__;
+    uint64_t h = fnv1a(stamp, sizeof(stamp));
+    FILE *exe = fopen("/proc/self/exe", "rb");
+    if(exe != nullptr)
+    {
+        char buf[65536];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), exe)) > 0) h = fnv1a(buf, n, h);
+        fclose(exe);
+    }
+    return hex(h);
+}
+
+std::string entry_path(uint64_t hash)
+{
+    return g_dir + "/" + hex(hash);
+}
+
+} // namespace
+
+struct cache_key {
+    std::string text;
+    std::vector<SYM*> syms;                 /* every symbol but constants, in order of first use */
+    std::unordered_map<SYM*, int> number;
+    std::vector<char*> callees;             /* a call's b is the callee's name, not a symbol */
+    SYM *entry = nullptr;                   /* the function's own label */
+    uint64_t hash = 0;
+};
+
+namespace {
+
+/* constants by value, anything else by its number in the key */
+bool put_operand(std::string &out, const CACHE_KEY *key, SYM *sym)
+{
+    if(sym == nullptr)
+    {
+        out += " -";
+        return true;
+    }
+    if(sym->type == SYM_INT)
+    {
+        out += " i" + std::to_string(sym->value);
+        return true;
+    }
+    auto it = key->number.find(sym);
+    if(it == key->number.end()) return false;
+    out += " s" + std::to_string(it->second);
+    return true;
+}
+
+bool put_callee(std::string &out, const CACHE_KEY *key, SYM *name)
+{
+    for(size_t i = 0; i < key->callees.size(); ++i)
+    {
+        if(key->callees[i] == reinterpret_cast<char*>(name))
+        {
+            out += " c" + std::to_string(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Temps and labels are named from counts over the whole program, so an
+    edit to one function would rename them in every later one. They are
+    known by their number in the key instead, and their names are only
+    put back into the logs when an entry is loaded.
+*/
+bool renamed(const CACHE_KEY *key, const SYM *sym)
+{
+    return sym->kind == SYM_KIND_TEMP || (sym->type == SYM_LABEL && sym != key->entry);
+}
+
+bool word_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/* text with every whole word found in names swapped for what it maps to */
+std::string rename_words(const std::string &text, const std::unordered_map<std::string, std::string> &names)
+{
+    std::string out;
+    size_t i = 0;
+    while(i < text.size())
+    {
+        if(!word_char(text[i]))
+        {
+            out += text[i++];
+            continue;
+        }
+        size_t j = i;
+        while(j < text.size() && word_char(text[j])) ++j;
+        std::string word = text.substr(i, j - i);
+        auto it = names.find(word);
+        out += it != names.end() ? it->second : word;
+        i = j;
+    }
+    return out;
+}
+
+/* the names the renamed symbols had when the entry was stored, mapped to the ones they have now */
+bool read_names(FILE *in, const CACHE_KEY *key, std::unordered_map<std::string, std::string> &names)
+{
+    size_t count;
+    if(fscanf(in, " names %zu", &count) != 1 || fgetc(in) != '\n') return false;
+    for(size_t i = 0; i < count; ++i)
+    {
+        long n;
+        size_t len;
+        if(fscanf(in, "%ld %zu:", &n, &len) != 2 || n < 0 || n >= static_cast<long>(key->syms.size())) return false;
+        std::string old(len, '\0');
+        if(fread(&old[0], 1, len, in) != len || fgetc(in) != '\n') return false;
+        const SYM *sym = key->syms[n];
+        if(!renamed(key, sym) || sym->name == nullptr) return false;
+        if(old != sym->name) names[old] = sym->name;
+    }
+    return true;
+}
+
+bool get_operand(FILE *in, const CACHE_KEY *key, SYM **sym)
+{
+    char tag;
+    long n;
+    if(fscanf(in, " %c", &tag) != 1) return false;
+    if(tag == '-')
+    {
+        *sym = nullptr;
+        return true;
+    }
+    if(fscanf(in, "%ld", &n) != 1) return false;
+    if(tag == 'i')
+    {
+        *sym = mk_const(static_cast<int>(n));
+        return true;
+    }
+    if(tag == 'c')
+    {
+        if(n < 0 || n >= static_cast<long>(key->callees.size())) return false;
+        *sym = reinterpret_cast<SYM*>(key->callees[n]);
+        return true;
+    }
+    if(tag != 's' || n < 0 || n >= static_cast<long>(key->syms.size())) return false;
+    *sym = key->syms[n];
+    return true;
+}
+
+bool read_body(FILE *in, const CACHE_KEY *key, TAC **first, TAC **last)
+{
+    char magic[sizeof(kMagic)];
+    size_t len, count;
+    if(fread(magic, 1, sizeof(magic), in) != sizeof(magic) || std::string(magic, sizeof(magic) - 1) != kMagic) return false;
+    if(fscanf(in, " key %zu", &len) != 1 || fgetc(in) != '\n' || len != key->text.size()) return false;
+
+    std::string text(len, '\0');
+    if(fread(&text[0], 1, len, in) != len || text != key->text) return false;
+
+    if(fscanf(in, " tac %zu", &count) != 1) return false;
+    TAC *head = nullptr, *tail = nullptr;
+    for(size_t i = 0; i < count; ++i)
+    {
+        int op;
+        SYM *a, *b, *c;
+        if(fscanf(in, "%d", &op) != 1 || op < TAC_UNDEF || op > TAC_OUTPUT) return false;
+        if(!get_operand(in, key, &a) || !get_operand(in, key, &b) || !get_operand(in, key, &c)) return false;
+
+        TAC *t = mk_tac(op, a, b, c);
+        t->prev = tail;
+        if(tail) tail->next = t; else head = t;
+        tail = t;
+    }
+    if(fgetc(in) != '\n' || head == nullptr) return false;
+
+    *first = head;
+    *last = tail;
+    return true;
+}
+
+} // namespace
+
+extern "C" void cache_open(const char *dir)
+{
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST) error("cannot create cache directory %s\n", dir);
+    g_dir = dir;
+    g_binary = binary_hash();
+}
+
+extern "C" int cache_enabled(void)
+{
+    return !g_dir.empty();
+}
+
+extern "C" void cache_stats(int *hits, int *misses)
+{
+    *hits = g_hits;
+    *misses = g_misses;
+}
+
+extern "C" CACHE_KEY *cache_key(TAC *first, const char *config)
+{
+    CACHE_KEY *key = new CACHE_KEY;
+    std::string &out = key->text;
+    out += config;
+    out += "\n";
+    out += g_binary;
+    out += "\n";
+    if(first != nullptr && first->op == TAC_LABEL) key->entry = first->a;
+
+    for(TAC *cur = first; cur != nullptr; cur = cur->next)
+    {
+        SYM *operand[3] = { cur->a, cur->b, cur->c };
+        out += std::to_string(cur->op);
+        for(int k = 0; k < 3; ++k)
+        {
+            SYM *sym = operand[k];
+            if(cur->op == TAC_CALL && k == 1)
+            {
+                /* by name; the optimised code refers to the call by its place among the calls */
+                char *name = reinterpret_cast<char*>(sym);
+                key->callees.push_back(name);
+                out += " f" + std::to_string(strlen(name)) + ":" + name;
+                continue;
+            }
+            if(sym != nullptr && sym->type != SYM_INT && !key->number.count(sym))
+            {
+                key->number[sym] = static_cast<int>(key->syms.size());
+                key->syms.push_back(sym);
+            }
+            put_operand(out, key, sym);
+        }
+        out += "\n";
+    }
+
+    /* what the passes may look at in each symbol; names can hold anything, so sized */
+    for(SYM *sym : key->syms)
+    {
+        const char *name = sym->name != nullptr ? sym->name : "";
+        out += std::to_string(sym->type) + " " + std::to_string(sym->kind) + " " + std::to_string(sym->id) + " " +
+               std::to_string(sym->scope);
+        if(renamed(key, sym)) out += " -\n";
+        else out += " " + std::to_string(strlen(name)) + ":" + name + "\n";
+    }
+
+    key->hash = fnv1a(out.data(), out.size());
+    return key;
+}
+
+extern "C" int cache_load(CACHE_KEY *key, TAC **first, TAC **last, OPTLOG_CAPTURE **log, DEADCODE_REPORT **dead)
+{
+    FILE *in = fopen(entry_path(key->hash).c_str(), "rb");
+    OPTLOG_CAPTURE *l = nullptr;
+    DEADCODE_REPORT *d = nullptr;
+    TAC *f, *t;
+    std::unordered_map<std::string, std::string> names;
+
+    bool hit = in != nullptr && read_body(in, key, &f, &t) && read_names(in, key, names);
+    if(hit)
+    {
+        /* the logs name temps and labels as they were when stored */
+        std::string logs;
+        char buf[4096];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), in)) > 0) logs.append(buf, n);
+        if(!names.empty()) logs = rename_words(logs, names);
+
+        FILE *text = logs.empty() ? nullptr : fmemopen(&logs[0], logs.size(), "rb");
+        hit = text != nullptr && (l = optlog_read(text)) != nullptr && (d = deadcode_read(text)) != nullptr;
+        if(text != nullptr) fclose(text);
+    }
+    if(in != nullptr) fclose(in);
+
+    if(!hit)
+    {
+        /* a half read entry leaves only unlinked TACs behind, freed with the rest */
+        if(l != nullptr) optlog_free(l);
+        g_misses++;
+        return 0;
+    }
+    *first = f;
+    *last = t;
+    *log = l;
+    *dead = d;
+    g_hits++;
+    return 1;
+}
+
+extern "C" void cache_store(CACHE_KEY *key, TAC *first, const OPTLOG_CAPTURE *log, const DEADCODE_REPORT *dead)
+{
+    std::string body;
+    size_t count = 0;
+    for(TAC *cur = first; cur != nullptr; cur = cur->next, ++count)
+    {
+        body += std::to_string(cur->op);
+        /* a symbol made by a pass has nothing to be looked up by next time */
+        bool callee = cur->op == TAC_CALL;
+        if(!put_operand(body, key, cur->a) ||
+           !(callee ? put_callee(body, key, cur->b) : put_operand(body, key, cur->b)) ||
+           !put_operand(body, key, cur->c)) return;
+        body += "\n";
+    }
+
+    /* an old name that is also a kept one could not be told apart in the logs */
+    std::unordered_set<std::string> kept;
+    std::string names;
+    size_t renames = 0;
+    for(SYM *sym : key->syms)
+    {
+        if(sym->name != nullptr && !renamed(key, sym)) kept.insert(sym->name);
+    }
+    for(size_t n = 0; n < key->syms.size(); ++n)
+    {
+        const SYM *sym = key->syms[n];
+        if(!renamed(key, sym) || sym->name == nullptr) continue;
+        if(kept.count(sym->name)) return;
+        names += std::to_string(n) + " " + std::to_string(strlen(sym->name)) + ":" + sym->name + "\n";
+        ++renames;
+    }
+
+    std::string path = entry_path(key->hash);
+    std::string temp = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(g_serial++);
+    FILE *out = fopen(temp.c_str(), "wb");
+    if(out == nullptr) return;
+
+    fprintf(out, "%s\nkey %zu\n", kMagic, key->text.size());
+    fwrite(key->text.data(), 1, key->text.size(), out);
+    fprintf(out, "tac %zu\n%s", count, body.c_str());
+    fprintf(out, "names %zu\n%s", renames, names.c_str());
+    optlog_write(log, out);
+    deadcode_write(dead, out);
+
+    if(fclose(out) != 0 || rename(temp.c_str(), path.c_str()) != 0) unlink(temp.c_str());
+}
+
+extern "C" void cache_free(CACHE_KEY *key)
+{
+    delete key;
+}
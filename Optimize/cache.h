@@ -0,0 +1,49 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "tac.h"
+#include "optlog.h"
+#include "deadcode.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    On-disk cache of optimised functions, off until cache_open. An entry
+    is keyed by the function's TAC as the parser made it (each op, each
+    callee's name, and for each symbol its type, kind, number and name or
+    value), the pass configuration and the compiler binary, and holds the
+    optimised TAC with the pass log and dead code report that went with
+    it. Temps and labels other than the function's own are numbered over
+    the whole program, so their names stay out of the key and are put
+    back into the logs on load; editing one function does not make the
+    ones after it miss. No pass looks outside the function it is given, so a global
+    turning local changes the key and an edited callee cannot change this
+    function's code. Each entry is a file in the cache directory named by
+    a hash of the key; the key itself is stored too and compared on load,
+    so a hash collision is only a miss. Entries are written to a temporary
+    name and renamed into place, so concurrent compilers may share a
+    directory.
+*/
+void cache_open(const char *dir);
+int cache_enabled(void);
+void cache_stats(int *hits, int *misses);
+
+typedef struct cache_key CACHE_KEY;
+
+/* key for the function listed from first to NULL under config */
+CACHE_KEY *cache_key(TAC *first, const char *config);
+
+/* 1 with the cached result rebuilt out of the key's symbols, 0 on a miss */
+int cache_load(CACHE_KEY *key, TAC **first, TAC **last, OPTLOG_CAPTURE **log, DEADCODE_REPORT **dead);
+
+/* record the optimised list from first to NULL; log and dead stay the caller's */
+void cache_store(CACHE_KEY *key, TAC *first, const OPTLOG_CAPTURE *log, const DEADCODE_REPORT *dead);
+void cache_free(CACHE_KEY *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_H */
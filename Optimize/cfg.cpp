@@ -23,12 +23,22 @@ bool is_terminator(TAC *t)
     }
 }
 
-void append_edge(BASIC_BLOCK *from, BASIC_BLOCK *to)
+template<typename T>
+T *arena_new(ARENA *arena)
+{
+    return static_cast<T*>(arena_alloc(arena, sizeof(T)));
+}
+
+void append_edge(ARENA *arena, BASIC_BLOCK *from, BASIC_BLOCK *to)
 {
     if(from == nullptr || to == nullptr) return;
-    BB_LIST *succ_node = new BB_LIST{to, from->succ};
+    BB_LIST *succ_node = arena_new<BB_LIST>(arena);
+    succ_node->bb = to;
+    succ_node->next = from->succ;
     from->succ = succ_node;
-    BB_LIST *pred_node = new BB_LIST{from, to->pred};
+    BB_LIST *pred_node = arena_new<BB_LIST>(arena);
+    pred_node->bb = from;
+    pred_node->next = to->pred;
     to->pred = pred_node;
 }
 
@@ -38,7 +48,267 @@ BASIC_BLOCK *find_block_by_start(TAC *start, const std::unordered_map<TAC*, BASI
     return (it == map.end()) ? nullptr : it->second;
 }
 
-CFG_FUNCTION *build_cfg_for_func(TAC *begin)
+void push_block(ARENA *arena, BB_LIST **list, BASIC_BLOCK *bb)
+{
+    BB_LIST *node = arena_new<BB_LIST>(arena);
+    node->bb = bb;
+    node->next = *list;
+    *list = node;
+}
+
+void number_rpo(ARENA *arena, CFG_FUNCTION *cfg)
+{
+    std::vector<BASIC_BLOCK*> postorder;
+    cfg->rpo = nullptr;
+    cfg->rpo_count = 0;
+    if(cfg->blocks == nullptr) return;
+
+    std::vector<char> seen(cfg->block_count, 0);
+    std::vector<std::pair<BASIC_BLOCK*, BB_LIST*>> stack;
+    seen[cfg->blocks->id] = 1;
+    stack.emplace_back(cfg->blocks, cfg->blocks->succ);
+    while(!stack.empty())
+    {
+        BB_LIST *&edge = stack.back().second;
+        if(edge != nullptr)
+        {
+            BASIC_BLOCK *next = edge->bb;
+            edge = edge->next;
+            if(!seen[next->id])
+            {
+                seen[next->id] = 1;
+                stack.emplace_back(next, next->succ);
+            }
+            continue;
+        }
+        postorder.push_back(stack.back().first);
+        stack.pop_back();
+    }
+
+    cfg->rpo_count = static_cast<int>(postorder.size());
+    cfg->rpo = static_cast<BASIC_BLOCK**>(arena_alloc(arena, postorder.size() * sizeof(BASIC_BLOCK*)));
+    for(int i = 0; i < cfg->rpo_count; ++i)
+    {
+        cfg->rpo[i] = postorder[postorder.size() - 1 - i];
+        cfg->rpo[i]->rpo = i;
+    }
+}
+
+/* Cooper, Harvey and Kennedy's iteration over reverse postorder */
+void find_dominators(CFG_FUNCTION *cfg)
+{
+    if(cfg->rpo_count == 0) return;
+    BASIC_BLOCK *entry = cfg->rpo[0];
+    entry->idom = entry;
+
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(int i = 1; i < cfg->rpo_count; ++i)
+        {
+            BASIC_BLOCK *bb = cfg->rpo[i];
+            BASIC_BLOCK *idom = nullptr;
+            for(BB_LIST *p = bb->pred; p; p = p->next)
+            {
+                BASIC_BLOCK *other = p->bb;
+                if(other->rpo < 0 || other->idom == nullptr) continue;
+                if(idom == nullptr)
+                {
+                    idom = other;
+                    continue;
+                }
+                while(idom != other)
+                {
+                    while(idom->rpo > other->rpo) idom = idom->idom;
+                    while(other->rpo > idom->rpo) other = other->idom;
+                }
+            }
+            if(idom != bb->idom)
+            {
+                bb->idom = idom;
+                changed = true;
+            }
+        }
+    }
+    entry->idom = nullptr;
+}
+
+void number_dom_tree(ARENA *arena, CFG_FUNCTION *cfg)
+{
+    if(cfg->rpo_count == 0) return;
+
+    /* children in reverse postorder, pushed back to front */
+    for(int i = cfg->rpo_count - 1; i > 0; --i)
+    {
+        BASIC_BLOCK *bb = cfg->rpo[i];
+        push_block(arena, &bb->idom->dom_children, bb);
+    }
+
+    int pre = 0, post = 0;
+    std::vector<std::pair<BASIC_BLOCK*, BB_LIST*>> stack;
+    cfg->rpo[0]->dom_pre = pre++;
+    stack.emplace_back(cfg->rpo[0], cfg->rpo[0]->dom_children);
+    while(!stack.empty())
+    {
+        BB_LIST *&child = stack.back().second;
+        if(child != nullptr)
+        {
+            BASIC_BLOCK *next = child->bb;
+            child = child->next;
+            next->dom_pre = pre++;
+            stack.emplace_back(next, next->dom_children);
+            continue;
+        }
+        stack.back().first->dom_post = post++;
+        stack.pop_back();
+    }
+}
+
+/* the block list of a loop, in list order; membership marked in in_loop */
+BB_LIST *collect_body(ARENA *arena, BASIC_BLOCK *header, const std::vector<BASIC_BLOCK*> &latches,
+                      const std::vector<BASIC_BLOCK*> &block_list, std::vector<char> &in_loop, int &count)
+{
+    std::fill(in_loop.begin(), in_loop.end(), 0);
+    std::vector<BASIC_BLOCK*> work;
+    in_loop[header->id] = 1;
+    for(BASIC_BLOCK *latch : latches)
+    {
+        if(!in_loop[latch->id])
+        {
+            in_loop[latch->id] = 1;
+            work.push_back(latch);
+        }
+    }
+    while(!work.empty())
+    {
+        BASIC_BLOCK *bb = work.back();
+        work.pop_back();
+        for(BB_LIST *p = bb->pred; p; p = p->next)
+        {
+            if(p->bb->rpo < 0 || in_loop[p->bb->id]) continue;
+            in_loop[p->bb->id] = 1;
+            work.push_back(p->bb);
+        }
+    }
+
+    BB_LIST *blocks = nullptr;
+    count = 0;
+    for(auto it = block_list.rbegin(); it != block_list.rend(); ++it)
+    {
+        if(!in_loop[(*it)->id]) continue;
+        push_block(arena, &blocks, *it);
+        ++count;
+    }
+    return blocks;
+}
+
+/* the goto ending the only latch, if the loop is exactly the blocks from the header to that latch */
+TAC *find_backedge(CFG_LOOP *loop)
+{
+    if(loop->latches == nullptr || loop->latches->next != nullptr) return nullptr;
+    BASIC_BLOCK *latch = loop->latches->bb;
+    TAC *last = latch->last;
+    if(loop->header->label == nullptr || last == nullptr || last->op != TAC_GOTO || last->a != loop->header->label) return nullptr;
+    if(latch->id - loop->header->id + 1 != loop->block_count) return nullptr;
+    return last;
+}
+
+/* pushes the forest in preorder onto *head, leaving it in reverse preorder */
+void order_loops(CFG_LOOP *loop, CFG_LOOP **head)
+{
+    loop->next = *head;
+    *head = loop;
+    for(CFG_LOOP *child = loop->children; child; child = child->sibling) order_loops(child, head);
+}
+
+void find_loops(ARENA *arena, CFG_FUNCTION *cfg, const std::vector<BASIC_BLOCK*> &block_list)
+{
+    cfg->loops = nullptr;
+    cfg->loop_list = nullptr;
+    cfg->loop_count = 0;
+    number_dom_tree(arena, cfg);
+
+    /* back edges by header, headers in list order */
+    std::vector<std::vector<BASIC_BLOCK*>> latches(block_list.size());
+    for(int i = 0; i < cfg->rpo_count; ++i)
+    {
+        BASIC_BLOCK *bb = cfg->rpo[i];
+        for(BB_LIST *s = bb->succ; s; s = s->next)
+        {
+            if(cfg_dominates(s->bb, bb)) latches[s->bb->id].push_back(bb);
+        }
+    }
+
+    std::vector<CFG_LOOP*> loops;
+    std::vector<char> in_loop(block_list.size());
+    for(BASIC_BLOCK *header : block_list)
+    {
+        if(latches[header->id].empty()) continue;
+        CFG_LOOP *loop = arena_new<CFG_LOOP>(arena);
+        memset(loop, 0, sizeof(CFG_LOOP));
+        loop->header = header;
+        loop->blocks = collect_body(arena, header, latches[header->id], block_list, in_loop, loop->block_count);
+
+        std::sort(latches[header->id].begin(), latches[header->id].end(),
+                  [](const BASIC_BLOCK *a, const BASIC_BLOCK *b) { return a->id > b->id; });
+        for(BASIC_BLOCK *latch : latches[header->id]) push_block(arena, &loop->latches, latch);
+
+        int outside_preds = 0;
+        BASIC_BLOCK *outside = nullptr;
+        for(BB_LIST *p = header->pred; p; p = p->next)
+        {
+            if(in_loop[p->bb->id] || p->bb->rpo < 0) continue;
+            ++outside_preds;
+            outside = p->bb;
+        }
+        if(outside_preds == 1 && outside->succ->next == nullptr) loop->preheader = outside;
+
+        std::vector<char> is_exit(block_list.size(), 0);
+        for(BB_LIST *b = loop->blocks; b; b = b->next)
+        {
+            for(BB_LIST *s = b->bb->succ; s; s = s->next)
+            {
+                if(!in_loop[s->bb->id]) is_exit[s->bb->id] = 1;
+            }
+        }
+        for(auto it = block_list.rbegin(); it != block_list.rend(); ++it)
+        {
+            if(is_exit[(*it)->id]) push_block(arena, &loop->exits, *it);
+        }
+
+        loop->backedge = find_backedge(loop);
+        loops.push_back(loop);
+    }
+    cfg->loop_count = static_cast<int>(loops.size());
+
+    /*
+        Bigger loops first, so when a loop is reached the loop its header
+        already sits in is the smallest one around it.
+    */
+    std::vector<CFG_LOOP*> by_size(loops);
+    std::stable_sort(by_size.begin(), by_size.end(),
+                     [](const CFG_LOOP *a, const CFG_LOOP *b) { return a->block_count > b->block_count; });
+    for(CFG_LOOP *loop : by_size)
+    {
+        loop->parent = loop->header->loop;
+        loop->depth = loop->parent ? loop->parent->depth + 1 : 1;
+        for(BB_LIST *b = loop->blocks; b; b = b->next) b->bb->loop = loop;
+    }
+
+    /* children and roots in list order, by header */
+    for(auto it = loops.rbegin(); it != loops.rend(); ++it)
+    {
+        CFG_LOOP *loop = *it;
+        CFG_LOOP **siblings = loop->parent ? &loop->parent->children : &cfg->loops;
+        loop->sibling = *siblings;
+        *siblings = loop;
+    }
+
+    for(CFG_LOOP *root = cfg->loops; root; root = root->sibling) order_loops(root, &cfg->loop_list);
+}
+
+CFG_FUNCTION *build_cfg_for_func(ARENA *arena, TAC *begin)
 {
     if(begin == nullptr) return nullptr;
 
@@ -96,7 +366,7 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
             last = p;
         }
 
-        BASIC_BLOCK *bb = new BASIC_BLOCK;
+        BASIC_BLOCK *bb = arena_new<BASIC_BLOCK>(arena);
         bb->id = static_cast<int>(i);
         bb->label = (start && start->op == TAC_LABEL) ? start->a : nullptr;
         bb->first = start;
@@ -104,6 +374,12 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
         bb->succ = nullptr;
         bb->pred = nullptr;
         bb->next = nullptr;
+        bb->rpo = -1;
+        bb->idom = nullptr;
+        bb->dom_children = nullptr;
+        bb->dom_pre = -1;
+        bb->dom_post = -1;
+        bb->loop = nullptr;
 
         if(head == nullptr) head = bb; else tail->next = bb;
         tail = bb;
@@ -130,7 +406,7 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
                         target = find_block_by_start(it->second, block_by_start);
                     }
                 }
-                append_edge(bb, target);
+                append_edge(arena, bb, target);
                 break;
             }
             case TAC_IFZ:
@@ -144,10 +420,10 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
                         target = find_block_by_start(it->second, block_by_start);
                     }
                 }
-                append_edge(bb, target);
+                append_edge(arena, bb, target);
                 if(i + 1 < block_list.size())
                 {
-                    append_edge(bb, block_list[i + 1]);
+                    append_edge(arena, bb, block_list[i + 1]);
                 }
                 break;
             }
@@ -157,7 +433,7 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
             default:
                 if(i + 1 < block_list.size())
                 {
-                    append_edge(bb, block_list[i + 1]);
+                    append_edge(arena, bb, block_list[i + 1]);
                 }
                 break;
         }
@@ -169,24 +445,17 @@ CFG_FUNCTION *build_cfg_for_func(TAC *begin)
         base_name = begin->prev->a->name;
     }
 
-    CFG_FUNCTION *cfg = new CFG_FUNCTION;
-    cfg->name = strdup(base_name);
+    CFG_FUNCTION *cfg = arena_new<CFG_FUNCTION>(arena);
+    cfg->name = arena_strdup(arena, base_name);
     cfg->blocks = head;
     cfg->block_count = static_cast<int>(block_list.size());
     cfg->next = nullptr;
+    number_rpo(arena, cfg);
+    find_dominators(cfg);
+    find_loops(arena, cfg, block_list);
     return cfg;
 }
 
-void bb_list_free(BB_LIST *list)
-{
-    while(list)
-    {
-        BB_LIST *next = list->next;
-        delete list;
-        list = next;
-    }
-}
-
 } // namespace
 
 extern "C" CFG_ALL *cfg_build_all(void)
@@ -194,13 +463,14 @@ extern "C" CFG_ALL *cfg_build_all(void)
     CFG_ALL *all = new CFG_ALL;
     all->funcs = nullptr;
     all->func_count = 0;
+    all->arena = ARENA_INIT;
     CFG_FUNCTION *tail = nullptr;
 
     for(TAC *cur = tac_first; cur; cur = cur->next)
     {
         if(cur->op == TAC_BEGINFUNC)
         {
-            CFG_FUNCTION *func = build_cfg_for_func(cur);
+            CFG_FUNCTION *func = build_cfg_for_func(&all->arena, cur);
             if(func == nullptr) continue;
             if(all->funcs == nullptr)
             {
@@ -220,6 +490,22 @@ extern "C" CFG_ALL *cfg_build_all(void)
     return all;
 }
 
+extern "C" int cfg_dominates(const BASIC_BLOCK *a, const BASIC_BLOCK *b)
+{
+    if(a == b) return 1;
+    if(a->dom_pre < 0 || b->dom_pre < 0) return 0;
+    return a->dom_pre <= b->dom_pre && b->dom_post <= a->dom_post;
+}
+
+extern "C" int cfg_loop_contains(const CFG_LOOP *loop, const BASIC_BLOCK *b)
+{
+    for(const CFG_LOOP *l = b->loop; l; l = l->parent)
+    {
+        if(l == loop) return 1;
+    }
+    return 0;
+}
+
 static void print_block(FILE *f, BASIC_BLOCK *b)
 {
     out_str(f, "B%d", b->id);
@@ -229,6 +515,38 @@ static void print_block(FILE *f, BASIC_BLOCK *b)
     }
 }
 
+static void print_block_list(const char *what, BB_LIST *list)
+{
+    out_str(file_x, "; %s", what);
+    if(list == nullptr) out_str(file_x, " -");
+    for(; list; list = list->next)
+    {
+        out_str(file_x, " ");
+        print_block(file_x, list->bb);
+    }
+}
+
+static void print_loops(CFG_LOOP *loop)
+{
+    for(; loop; loop = loop->sibling)
+    {
+        out_str(file_x, "%*sloop ", loop->depth * 2 - 2, "");
+        print_block(file_x, loop->header);
+        out_str(file_x, ":");
+        for(BB_LIST *b = loop->blocks; b; b = b->next)
+        {
+            out_str(file_x, " ");
+            print_block(file_x, b->bb);
+        }
+        print_block_list("latches", loop->latches);
+        print_block_list("exits", loop->exits);
+        out_str(file_x, "; preheader ");
+        if(loop->preheader) print_block(file_x, loop->preheader); else out_str(file_x, "-");
+        out_str(file_x, "\n");
+        print_loops(loop->children);
+    }
+}
+
 extern "C" void cfg_print_all(CFG_ALL *all)
 {
     if(all == nullptr) return;
@@ -257,30 +575,21 @@ extern "C" void cfg_print_all(CFG_ALL *all)
                 print_block(file_x, succ->bb);
                 succ = succ->next;
             }
+            out_str(file_x, "\n    idom: ");
+            if(b->idom) print_block(file_x, b->idom); else out_str(file_x, "-");
             out_str(file_x, "\n\n");
         }
+        if(cf->loops)
+        {
+            print_loops(cf->loops);
+            out_str(file_x, "\n");
+        }
     }
 }
 
 extern "C" void cfg_free_all(CFG_ALL *all)
 {
     if(all == nullptr) return;
-    CFG_FUNCTION *func = all->funcs;
-    while(func)
-    {
-        CFG_FUNCTION *next_func = func->next;
-        BASIC_BLOCK *block = func->blocks;
-        while(block)
-        {
-            BASIC_BLOCK *next_block = block->next;
-            bb_list_free(block->succ);
-            bb_list_free(block->pred);
-            delete block;
-            block = next_block;
-        }
-        if(func->name) free(func->name);
-        delete func;
-        func = next_func;
-    }
+    arena_release(&all->arena);
     delete all;
 }
@@ -9,6 +9,7 @@ extern "C" {
 
 typedef struct basic_block BASIC_BLOCK;
 typedef struct bb_list BB_LIST;
+typedef struct cfg_loop CFG_LOOP;
 
 typedef struct basic_block{
     int id;                 /* block id within function */
@@ -18,6 +19,11 @@ typedef struct basic_block{
     BB_LIST *succ;          /* successors */
     BB_LIST *pred;          /* predecessors */
     struct basic_block *next; /* next block in function */
+    int rpo;                /* reverse postorder number from the entry, -1 if no path reaches the block */
+    struct basic_block *idom; /* immediate dominator, NULL for the entry and unreached blocks */
+    BB_LIST *dom_children;  /* blocks this one immediately dominates */
+    int dom_pre, dom_post;  /* preorder and postorder numbers in the dominator tree */
+    CFG_LOOP *loop;         /* innermost loop holding the block, NULL if none */
 } BASIC_BLOCK;
 
 typedef struct bb_list {
@@ -26,25 +32,59 @@ typedef struct bb_list {
 } BB_LIST;
 
 
+/*
+    A natural loop: the header and every block that reaches one of the
+    back edges into it without passing through the header, where a back
+    edge is one whose target dominates its source. Back edges into the
+    same header make one loop. Two loops are either disjoint or one lies
+    inside the other, which gives the nesting forest.
+*/
+typedef struct cfg_loop {
+    BASIC_BLOCK *header;
+    BB_LIST *blocks;        /* header and body, in list order */
+    int block_count;
+    BB_LIST *latches;       /* sources of the back edges */
+    BB_LIST *exits;         /* blocks outside the loop with a predecessor inside it */
+    BASIC_BLOCK *preheader; /* the only way in from outside, if the header is its only successor, else NULL */
+    TAC *backedge;          /* the goto closing the loop when the loop is just the code from the header's label to it, else NULL */
+    int depth;              /* 1 for an outermost loop */
+    struct cfg_loop *parent;
+    struct cfg_loop *children; /* in list order */
+    struct cfg_loop *sibling;
+    struct cfg_loop *next;  /* every loop of the function, each after the loops inside it and the loops below it in the list */
+} CFG_LOOP;
+
 typedef struct cfg_function {
     char *name;             /* function name */
     BASIC_BLOCK *blocks;    /* linked list of blocks */
     int block_count;        /* number of blocks */
     struct cfg_function *next; /* next function cfg */
+    BASIC_BLOCK **rpo;      /* reached blocks in reverse postorder, entry first */
+    int rpo_count;
+    CFG_LOOP *loops;        /* outermost loops, in list order */
+    CFG_LOOP *loop_list;    /* all loops, innermost first (see cfg_loop.next) */
+    int loop_count;
 } CFG_FUNCTION;//不做函数间的分析
 
 typedef struct cfg_all {
     CFG_FUNCTION *funcs;    /* list of function CFGs */
     int func_count;         /* number of functions */
+    ARENA arena;            /* functions, blocks and edges */
 } CFG_ALL;
 
-/* Build CFGs for all functions found in the global TAC list. */
+/* Build CFGs for all functions found in the global TAC list, with dominators and loops. */
 CFG_ALL *cfg_build_all(void);
 
-/* Print CFGs in a human-friendly text form to file_x (same as TAC list). */
+/* 1 if every path from the entry to b goes through a (a block dominates itself) */
+int cfg_dominates(const BASIC_BLOCK *a, const BASIC_BLOCK *b);
+
+/* 1 if the loop holds b */
+int cfg_loop_contains(const CFG_LOOP *loop, const BASIC_BLOCK *b);
+
+/* Print CFGs, dominators and loops in a human-friendly text form to file_x (same as TAC list). */
 void cfg_print_all(CFG_ALL *all);
 
-/* Free memory of CFGs. */
+/* Free memory of CFGs, one arena release. */
 void cfg_free_all(CFG_ALL *all);
 
 #ifdef __cplusplus
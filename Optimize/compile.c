@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include "tac.h"
+#include "mini.y.h"
+#include "obj.h"
+#include "cfg.h"
+#include "optlog.h"
+#include "analysis.h"
+#include "pipeline.h"
+#include "deadcode.h"
+#include "compile.h"
+
+__thread FILE *file_x, *file_s;
+
+/* set while mini_compile runs, so error() goes back there instead of exiting */
+static __thread jmp_buf *error_trap;
+static __thread char *error_text;
+static __thread void *open_scanner;
+
+void error(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	if(error_trap!=NULL)
+	{
+		if(vasprintf(&error_text, format, args)<0) error_text=NULL;
+		va_end(args);
+		longjmp(*error_trap, 1);
+	}
+	vfprintf(stderr, format, args);
+	va_end(args);
+	exit(1);
+}
+
+int error_catch(void (*body)(void *), void *arg, char **message)
+{
+	jmp_buf trap, *outer=error_trap;
+	int failed;
+
+	error_trap=&trap;
+	failed=setjmp(trap);
+	if(!failed) body(arg);
+	error_trap=outer;
+
+	*message=failed ? error_text : NULL;
+	error_text=NULL;
+	return failed ? -1 : 0;
+}
+
+void error_raise(char *message)
+{
+	if(error_trap!=NULL)
+	{
+		error_text=message;
+		longjmp(*error_trap, 1);
+	}
+	fputs(message!=NULL ? message : "error\n", stderr);
+	free(message);
+	exit(1);
+}
+
+static void tac_list()
+{
+	out_str(file_x, "\n# tac list\n\n");
+
+	TAC * cur;
+	for(cur = tac_first; cur !=NULL; cur=cur->next)
+	{
+		out_str(file_x, "%p\t", cur);
+		out_tac(file_x, cur);
+		out_str(file_x, "\n");
+	}
+}
+
+/* process wide, like optprof_enable and cache_open */
+static int streaming;
+static __thread int stream_jobs;
+
+void compile_stream(int on)
+{
+	streaming=on;
+}
+
+/* list the TACs and CFGs of what tac_first holds, when there is a .x */
+static void list_code()
+{
+	if(file_x==NULL) return;
+
+	tac_list();
+
+	/* Build and print CFGs */
+	CFG_ALL *cfg = cfg_build_all();
+	cfg_print_all(cfg);
+	cfg_free_all(cfg);
+}
+
+/* one top-level declaration or function, from the parser straight to file_s */
+static void stream_out(TAC *first, TAC *last)
+{
+	tac_first=first;
+	tac_last=last;
+	pipeline_run(stream_jobs);
+	list_code();
+	obj_code(tac_first, 1);
+	tac_first=tac_last=NULL;
+}
+
+void compile(void *scanner, int jobs)
+{
+	open_scanner=scanner;
+	tac_init();
+	optlog_reset();
+	analysis_reset();
+	if(streaming)
+	{
+		tac_streamer=stream_out;
+		stream_jobs=jobs;
+		obj_begin();
+	}
+
+	optprof_begin("parse", 0);
+	yyparse(scanner);
+	lex_close(scanner);
+	open_scanner=NULL;
+	tac_compact();
+	optprof_end(0);
+
+	if(streaming)
+	{
+		/* the logs cover every function, so they come after the code */
+		tac_streamer=NULL;
+		optlog_emit(file_s);
+		deadcode_emit_report(file_s);
+		obj_end();
+		tac_release();
+		return;
+	}
+
+	pipeline_run(jobs);
+	/* drop removed nodes and put inserted ones back in program order */
+	tac_compact();
+
+	optprof_begin("cfg", 0);
+	list_code();
+	optprof_end(0);
+	optprof_begin("codegen", 0);
+	tac_obj();
+	optprof_end(0);
+	tac_release();
+}
+
+/* what error() cut short still holds the scanner and the IR */
+static void compile_abort()
+{
+	if(open_scanner!=NULL) lex_close(open_scanner);
+	open_scanner=NULL;
+	tac_streamer=NULL;
+	tac_release();
+	analysis_reset();
+}
+
+/* run body(arg) with error() trapped; 0, or -1 with the message in *message */
+static int compile_trapped(void (*body)(void *), void *arg, char **message)
+{
+	int failed=error_catch(body, arg, message);
+	if(failed) compile_abort();
+	return failed;
+}
+
+typedef struct compile_job
+{
+	char *path;
+	const char *source;
+	size_t len;
+	int jobs;
+	int listing; /* mini_compile was asked for the .x text */
+} COMPILE_JOB;
+
+static void compile_file_body(void *arg)
+{
+	COMPILE_JOB *job=(COMPILE_JOB *)arg;
+	size_t n=strlen(job->path);
+	char output[n+1];
+
+	if(n==0 || job->path[n-1]!='m') error("%s does not end with .m\n", job->path);
+
+	open_scanner=lex_open(job->path);
+
+	strcpy(output, job->path);
+	output[n-1]='x';
+	if((file_x=fopen(output,"w"))==NULL) error("open %s failed\n", output);
+
+	output[n-1]='s';
+	if((file_s=fopen(output,"w"))==NULL) error("open %s failed\n", output);
+
+	compile(open_scanner, job->jobs);
+}
+
+int compile_file(char *path, int jobs, char **message)
+{
+	COMPILE_JOB job={ path, NULL, 0, jobs, 1 };
+	int status;
+
+	status=compile_trapped(compile_file_body, &job, message);
+
+	if(file_s!=NULL) fclose(file_s);
+	if(file_x!=NULL) fclose(file_x);
+	file_s=file_x=NULL;
+	return status;
+}
+
+static void compile_text_body(void *arg)
+{
+	COMPILE_JOB *job=(COMPILE_JOB *)arg;
+
+	if(file_s==NULL || (job->listing && file_x==NULL)) error("out of memory\n");
+	compile(lex_open_text(job->source, job->len), job->jobs);
+}
+
+int mini_compile(const char *source, size_t len, int jobs, char **out, char **listing)
+{
+	COMPILE_JOB job={ NULL, source, len, jobs, listing!=NULL };
+	char *text=NULL, *list=NULL, *message;
+	size_t text_len, list_len;
+
+	file_s=open_memstream(&text, &text_len);
+	file_x=listing!=NULL ? open_memstream(&list, &list_len) : NULL;
+
+	int status=compile_trapped(compile_text_body, &job, &message);
+
+	if(file_s!=NULL) fclose(file_s);
+	if(file_x!=NULL) fclose(file_x);
+	file_s=file_x=NULL;
+
+	if(status!=0)
+	{
+		free(text);
+		free(list);
+		text=message;
+		list=NULL;
+	}
+	*out=text;
+	if(listing!=NULL) *listing=list;
+	return status;
+}
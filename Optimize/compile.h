@@ -0,0 +1,52 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+	Everything a compilation keeps between calls (tac.c's symbol tables
+	and IR, the code generator's frame and registers, the scanner, file_s
+	and file_x) belongs to the thread doing it, so one process may compile
+	any number of programs, on as many threads at once as it likes.
+*/
+
+/* compile what scanner reads to file_s, with the TAC list and CFGs to file_x unless it is NULL */
+void compile(void *scanner, int jobs);
+
+/*
+	From now on optimise and emit each function as soon as the parser
+	has it, then free its TACs and local symbols, so memory follows the
+	biggest function instead of the whole program. The pass logs and the
+	static data still come out at the end. Next uses are only known
+	within a function, so globals are written back a little more often
+	than when the whole program is emitted at once.
+*/
+void compile_stream(int on);
+
+/*
+	Compile path, which must end in .m, to the .x and .s files beside it.
+	Returns 0, or -1 with the error message in *message (for the caller
+	to free) instead of exiting.
+*/
+int compile_file(char *path, int jobs, char **message);
+
+/*
+	Compile the program in source[0..len) without touching the file
+	system. On success returns 0 and sets *out to the assembly, a NUL
+	terminated string for the caller to free; listing, when not NULL,
+	gets what would have gone to the .x file the same way. On a compile
+	error returns -1 with the message in *out instead of exiting. jobs is
+	as for pipeline_run; callers that compile on several threads of their
+	own will usually want 1.
+*/
+int mini_compile(const char *source, size_t len, int jobs, char **out, char **listing);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COMPILE_H */
@@ -4,10 +4,11 @@
 #include <cstring>
 #include "constfold.h"
 #include "optlog.h"
+#include "analysis.h"
 
 namespace {
-std::vector<std::string> *g_current_log = nullptr;
-int g_current_delta = 0;
+thread_local std::vector<std::string> *g_current_log = nullptr;
+thread_local int g_current_delta = 0;
 
 bool sym_is_int(const SYM *s, int *value)
 {
@@ -239,6 +240,7 @@ void detach_tac(TAC *node)
     if(next) next->prev = prev; else tac_last = prev;
     node->prev = nullptr;
     node->next = nullptr;
+    analysis_invalidate(ANALYSIS_INDEX);
 }
 
 void try_fold_ifz(TAC *t)
@@ -251,6 +253,7 @@ void try_fold_ifz(TAC *t)
         // ifz 0 goto L -> goto L
         t->op = TAC_GOTO;
         t->b = NULL;
+        analysis_invalidate(ANALYSIS_CFG);
         g_current_delta++;
         if(g_current_log)
         {
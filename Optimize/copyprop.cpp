@@ -1,11 +1,12 @@
 #include <vector>
-#include <unordered_map>
 #include <string>
 #include <sstream>
 #include <algorithm>
 #include <cstdint>
 #include "copyprop.h"
 #include "optlog.h"
+#include "analysis.h"
+#include "dataflow.h"
 
 namespace {
 
@@ -17,12 +18,6 @@ struct InstructionInfo {
     TAC *tac = nullptr;
     SYM *def = nullptr;
     std::vector<UseSite> uses;
-    std::vector<int> succ;
-    std::vector<int> pred;
-    std::vector<int> kill;
-    std::vector<int> gen;
-    std::vector<uint8_t> in;
-    std::vector<uint8_t> out;
 };
 
 struct CopyInfo {
@@ -32,7 +27,7 @@ struct CopyInfo {
     SYM *src = nullptr;
 };
 
-std::vector<std::string> *g_current_log = nullptr;
+thread_local std::vector<std::string> *g_current_log = nullptr;
 
 void log_append(const std::string &line)
 {
@@ -135,15 +130,11 @@ std::string sym_name(SYM *sym)
 
 int run_iteration()
 {
-    std::vector<TAC*> sequence;
-    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
-    {
-        sequence.push_back(cur);
-    }
+    const ProgramAnalysis &cfg = analysis_cfg();
+    const std::vector<TAC*> &sequence = cfg.sequence;
     if(sequence.empty()) return 0;
 
     std::vector<InstructionInfo> infos(sequence.size());
-    std::unordered_map<SYM*, int> label_map;
 
     for(size_t i = 0; i < sequence.size(); ++i)
     {
@@ -151,72 +142,18 @@ int run_iteration()
         info.tac = sequence[i];
         info.def = tac_def(info.tac);//记录该指令顶定义的符号
         collect_uses(info.tac, info);//记录该指令使用了哪些符号
-        if(info.tac->op == TAC_LABEL && info.tac->a)
-        {
-            label_map[info.tac->a] = static_cast<int>(i);
-        }//记录label
     }
 
-    auto next_index = [&](size_t idx) -> int {
-        return (idx + 1 < sequence.size()) ? static_cast<int>(idx + 1) : -1;
-    };
-
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        TAC *t = infos[i].tac;
-        switch(t->op)
-        {
-            case TAC_GOTO:
-            {
-                int target = -1;
-                if(t->a)
-                {
-                    auto it = label_map.find(t->a);
-                    if(it != label_map.end()) target = it->second;
-                }
-                if(target >= 0) infos[i].succ.push_back(target);
-                break;
-            }
-            case TAC_IFZ:
-            {
-                int target = -1;
-                if(t->a)
-                {
-                    auto it = label_map.find(t->a);
-                    if(it != label_map.end()) target = it->second;
-                }
-                if(target >= 0) infos[i].succ.push_back(target);
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
-            }
-            case TAC_RETURN:
-            case TAC_ENDFUNC:
-                break;
-            default:
-            {
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
-            }
-        }
-    }//记录后继
-
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        for(int succ : infos[i].succ)
-        {
-            if(succ >= 0 && static_cast<size_t>(succ) < infos.size())
-            {
-                infos[succ].pred.push_back(static_cast<int>(i));
-            }
-        }
-    }//记录前驱
+    DataflowProblem problem;
+    problem.direction = DataflowDirection::Forward;
+    problem.meet = DataflowMeet::Intersection;
+    problem.gen.resize(infos.size());
+    problem.kill.resize(infos.size());
 
     std::vector<CopyInfo> copies;
     copies.reserve(infos.size());
-    std::unordered_map<SYM*, std::vector<int>> copies_by_dest;
-    std::unordered_map<SYM*, std::vector<int>> copies_by_src;
+    SymMap<std::vector<int>> copies_by_dest;
+    SymMap<std::vector<int>> copies_by_src;
 
     for(size_t i = 0; i < infos.size(); ++i)
     {
@@ -229,7 +166,7 @@ int run_iteration()
         if(dst == src) continue;
         int id = static_cast<int>(copies.size());
         copies.push_back(CopyInfo{id, t, dst, src});
-        infos[i].gen.push_back(id);
+        problem.gen[i].push_back(id);
         copies_by_dest[dst].push_back(id);
         if(is_tracked(src))
         {
@@ -239,94 +176,44 @@ int run_iteration()
 
     if(copies.empty()) return 0;
 
-    const size_t copy_count = copies.size();
-    for(InstructionInfo &info : infos)
+    problem.bits = copies.size();
+    for(size_t i = 0; i < infos.size(); ++i)
     {
-        info.in.assign(copy_count, 0);
-        info.out.assign(copy_count, 0);
+        InstructionInfo &info = infos[i];
         if(info.def && is_tracked(info.def))
         {
-            auto it_dest = copies_by_dest.find(info.def);
-            if(it_dest != copies_by_dest.end())
+            std::vector<int> &kill = problem.kill[i];
+            if(const std::vector<int> *by_dest = copies_by_dest.find(info.def))
             {
-                info.kill.insert(info.kill.end(), it_dest->second.begin(), it_dest->second.end());
+                kill.insert(kill.end(), by_dest->begin(), by_dest->end());
             }
-            auto it_src = copies_by_src.find(info.def);
-            if(it_src != copies_by_src.end())
+            if(const std::vector<int> *by_src = copies_by_src.find(info.def))
             {
-                info.kill.insert(info.kill.end(), it_src->second.begin(), it_src->second.end());
+                kill.insert(kill.end(), by_src->begin(), by_src->end());
             }
         }
-    }//初始化in/out/kill/gen集合
-
-    bool changed;
-    do
-    {
-        changed = false;
-        for(size_t i = 0; i < infos.size(); ++i)
-        {
-            InstructionInfo &info = infos[i];
-            std::vector<uint8_t> new_in(copy_count, 0);
-            if(!info.pred.empty())
-            {
-                new_in = infos[info.pred[0]].out;
-                for(size_t p = 1; p < info.pred.size(); ++p)
-                {
-                    const std::vector<uint8_t> &out_vec = infos[info.pred[p]].out;
-                    for(size_t bit = 0; bit < copy_count; ++bit)
-                    {
-                        new_in[bit] = static_cast<uint8_t>(new_in[bit] && out_vec[bit]);
-                    }
-                }
-            }//计算新的in集合
-
-            if(new_in != info.in)
-            {
-                info.in.swap(new_in);
-                changed = true;
-            }//更新in集合
+    }//初始化kill/gen集合
 
-            std::vector<uint8_t> new_out = info.in;
-            for(int kill_id : info.kill)
-            {
-                if(kill_id >= 0 && static_cast<size_t>(kill_id) < copy_count)
-                {
-                    new_out[kill_id] = 0;
-                }
-            }
-            for(int gen_id : info.gen)
-            {
-                if(gen_id >= 0 && static_cast<size_t>(gen_id) < copy_count)
-                {
-                    new_out[gen_id] = 1;
-                }
-            }
-            if(new_out != info.out)
-            {
-                info.out.swap(new_out);
-                changed = true;
-            }
-        }
-    } while(changed);
+    DataflowResult flow = dataflow_solve(problem, cfg.succ, cfg.pred);
 
     int replacements = 0;
     for(size_t i = 0; i < infos.size(); ++i)
     {
         InstructionInfo &info = infos[i];
-        const std::vector<uint8_t> &available = info.in;
+        const BitSet &available = flow.in[i];
         for(const UseSite &use : info.uses)
         {
             if(use.slot == nullptr) continue;
             SYM *current = *(use.slot);
             if(!is_tracked(current)) continue;
-            auto it = copies_by_dest.find(current);
-            if(it == copies_by_dest.end()) continue;
+            const std::vector<int> *by_dest = copies_by_dest.find(current);
+            if(by_dest == nullptr) continue;
 
             int chosen = -1;
-            for(int copy_id : it->second)
+            for(int copy_id : *by_dest)
             {
                 if(copy_id < 0 || static_cast<size_t>(copy_id) >= available.size()) continue;
-                if(!available[copy_id]) continue;
+                if(!available.test(copy_id)) continue;
                 if(chosen == -1) 
                 {
                     chosen = copy_id;
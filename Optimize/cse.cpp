@@ -5,6 +5,8 @@
 #include <algorithm>
 #include "cse.h"
 #include "optlog.h"
+#include "analysis.h"
+#include "dataflow.h"
 
 namespace {
 
@@ -57,8 +59,8 @@ struct ExprKeyHash {
     }
 };
 
-std::vector<std::string> *g_log = nullptr;
-int g_eliminated = 0;
+thread_local std::vector<std::string> *g_log = nullptr;
+thread_local int g_eliminated = 0;
 
 struct ExpressionDef {
     int expr_id = -1;
@@ -70,18 +72,8 @@ struct InstructionInfo {
     SYM *def = nullptr;
     int expr_id = -1;
     int expr_def_id = -1;
-    bool kill_all = false;
-    std::vector<int> succ;
-    std::vector<int> pred;
-    std::vector<int> kill_expr_ids;
-    std::vector<int> kill_def_ids;
-    std::vector<int> in_values;
-    std::vector<int> out_values;
 };
 
-constexpr int VALUE_UNAVAILABLE = -1;
-constexpr int VALUE_CONFLICT = -2; // expression seen on all preds but with conflicting definitions
-
 void log_append(const std::string &line)
 {
     if(g_log)
@@ -172,23 +164,6 @@ SYM *tac_def(TAC *t)
     }
 }
 
-int combine_values(int lhs, int rhs)
-{
-    if(lhs == VALUE_UNAVAILABLE || rhs == VALUE_UNAVAILABLE)
-    {
-        return VALUE_UNAVAILABLE;
-    }
-    if(lhs == VALUE_CONFLICT || rhs == VALUE_CONFLICT)
-    {
-        return VALUE_CONFLICT;
-    }
-    if(lhs == rhs)
-    {
-        return lhs;
-    }
-    return VALUE_CONFLICT;
-}
-
 } // namespace
 
 extern "C" void cse_reset(void)
@@ -202,11 +177,8 @@ extern "C" int cse_run(void)
     std::vector<std::string> run_log;
     g_log = &run_log;
     g_eliminated = 0;
-    std::vector<TAC*> sequence;
-    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
-    {
-        sequence.push_back(cur);
-    }
+    const ProgramAnalysis &cfg = analysis_cfg();
+    const std::vector<TAC*> &sequence = cfg.sequence;
 
     if(sequence.empty())
     {
@@ -216,11 +188,17 @@ extern "C" int cse_run(void)
     }
 
     std::vector<InstructionInfo> infos(sequence.size());
-    std::unordered_map<SYM*, int> label_map;
     std::unordered_map<ExprKey, int, ExprKeyHash> expr_index_map;
-    std::unordered_map<SYM*, std::vector<int>> exprs_by_symbol;
-    std::unordered_map<SYM*, std::vector<int>> defs_by_result;
+    SymMap<std::vector<int>> exprs_by_symbol;
+    SymMap<std::vector<int>> defs_by_result;
+    std::vector<std::vector<int>> defs_by_expr;
     std::vector<ExpressionDef> expr_defs;
+    DataflowProblem problem;
+    problem.direction = DataflowDirection::Forward;
+    problem.meet = DataflowMeet::Intersection;
+    problem.gen.resize(sequence.size());
+    problem.kill.resize(sequence.size());
+    problem.kill_all.resize(sequence.size(), 0);
 
     for(size_t i = 0; i < sequence.size(); ++i)
     {
@@ -228,12 +206,7 @@ extern "C" int cse_run(void)
         InstructionInfo &info = infos[i];
         info.tac = t;
         info.def = tac_def(t);
-        info.kill_all = is_global_side_effect(t) || (t && t->op == TAC_BEGINFUNC);
-
-        if(t->op == TAC_LABEL && t->a)
-        {
-            label_map[t->a] = static_cast<int>(i);
-        }
+        problem.kill_all[i] = is_global_side_effect(t) || (t && t->op == TAC_BEGINFUNC);
 
         if(is_expression_candidate(t))
         {
@@ -244,11 +217,13 @@ extern "C" int cse_run(void)
             {
                 expr_id = static_cast<int>(expr_index_map.size());
                 expr_index_map.emplace(key, expr_id);
-                if(key.lhs)
+                defs_by_expr.emplace_back();
+                /* only variables can be redefined, constants never kill */
+                if(is_tracked_symbol(key.lhs))
                 {
                     exprs_by_symbol[key.lhs].push_back(expr_id);
                 }
-                if(key.rhs)
+                if(is_tracked_symbol(key.rhs))
                 {
                     exprs_by_symbol[key.rhs].push_back(expr_id);
                 }
@@ -261,180 +236,72 @@ extern "C" int cse_run(void)
             info.expr_id = expr_id;
             info.expr_def_id = static_cast<int>(expr_defs.size());
             expr_defs.push_back(ExpressionDef{expr_id, t->a});
-            if(t->a)
-            {
-                defs_by_result[t->a].push_back(info.expr_def_id);
-            }
+            defs_by_expr[expr_id].push_back(info.expr_def_id);
+            defs_by_result[t->a].push_back(info.expr_def_id);
         }
     }
 
-    const int expr_count = static_cast<int>(expr_index_map.size());
-    if(expr_count == 0)
+    if(expr_defs.empty())
     {
         g_log = nullptr;
         optlog_record(OPT_PASS_CSE, nullptr, 0, 0);
         return 0;
     }
 
-    auto next_index = [&](size_t idx) -> int {
-        return (idx + 1 < sequence.size()) ? static_cast<int>(idx + 1) : -1;
-    };
-
+    /*
+        Bits are expression definitions: a definition is in the set while
+        its result still holds the value of its expression. Each definition
+        kills the other definitions of the same expression, so at most one
+        per expression survives the intersection meet.
+    */
+    problem.bits = expr_defs.size();
     for(size_t i = 0; i < infos.size(); ++i)
     {
-        TAC *t = infos[i].tac;
-        switch(t->op)
+        InstructionInfo &info = infos[i];
+        std::vector<int> &kill = problem.kill[i];
+        if(is_tracked_symbol(info.def))
         {
-            case TAC_GOTO:
+            if(const std::vector<int> *exprs = exprs_by_symbol.find(info.def))
             {
-                int target = -1;
-                if(t->a)
+                for(int expr_id : *exprs)
                 {
-                    auto it = label_map.find(t->a);
-                    if(it != label_map.end())
-                    {
-                        target = it->second;
-                    }
+                    kill.insert(kill.end(), defs_by_expr[expr_id].begin(), defs_by_expr[expr_id].end());
                 }
-                if(target >= 0) infos[i].succ.push_back(target);
-                break;
             }
-            case TAC_IFZ:
+            if(const std::vector<int> *defs = defs_by_result.find(info.def))
             {
-                int target = -1;
-                if(t->a)
-                {
-                    auto it = label_map.find(t->a);
-                    if(it != label_map.end())
-                    {
-                        target = it->second;
-                    }
-                }
-                if(target >= 0) infos[i].succ.push_back(target);
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
-            }
-            case TAC_RETURN:
-            case TAC_ENDFUNC:
-                break;
-            default:
-            {
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
+                kill.insert(kill.end(), defs->begin(), defs->end());
             }
         }
-    }
-
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        for(int succ : infos[i].succ)
+        if(info.expr_id >= 0)
         {
-            if(succ >= 0 && static_cast<size_t>(succ) < infos.size())
+            const std::vector<int> &siblings = defs_by_expr[info.expr_id];
+            kill.insert(kill.end(), siblings.begin(), siblings.end());
+            /* after t = t + 1, t no longer holds t + 1 */
+            if(info.tac->b != info.def && info.tac->c != info.def)
             {
-                infos[succ].pred.push_back(static_cast<int>(i));
+                problem.gen[i].push_back(info.expr_def_id);
             }
         }
     }
 
-    for(InstructionInfo &info : infos)
-    {
-        if(info.def)
-        {
-            auto it_expr = exprs_by_symbol.find(info.def);
-            if(it_expr != exprs_by_symbol.end())
-            {
-                info.kill_expr_ids = it_expr->second;
-            }
-            auto it_def = defs_by_result.find(info.def);
-            if(it_def != defs_by_result.end())
-            {
-                info.kill_def_ids = it_def->second;
-            }
-        }
-        info.in_values.assign(expr_count, VALUE_UNAVAILABLE);
-        info.out_values.assign(expr_count, VALUE_UNAVAILABLE);
-    }
+    DataflowResult flow = dataflow_solve(problem, cfg.succ, cfg.pred);
 
-    bool changed;
-    do
+    for(size_t i = 0; i < infos.size(); ++i)
     {
-        changed = false;
-        for(size_t i = 0; i < infos.size(); ++i)
-        {
-            InstructionInfo &info = infos[i];
-
-            std::vector<int> new_in(expr_count, VALUE_UNAVAILABLE);
-            if(!info.pred.empty())
-            {
-                new_in = infos[info.pred[0]].out_values;
-                for(size_t p = 1; p < info.pred.size(); ++p)
-                {
-                    const std::vector<int> &pred_out = infos[info.pred[p]].out_values;
-                    for(int expr_id = 0; expr_id < expr_count; ++expr_id)
-                    {
-                        new_in[expr_id] = combine_values(new_in[expr_id], pred_out[expr_id]);
-                    }
-                }
-            }
-
-            if(new_in != info.in_values)
-            {
-                info.in_values.swap(new_in);
-                changed = true;
-            }
-
-            std::vector<int> new_out = info.in_values;
-
-            if(info.kill_all)
-            {
-                std::fill(new_out.begin(), new_out.end(), VALUE_UNAVAILABLE);
-            }
-            else
-            {
-                for(int expr_id : info.kill_expr_ids)
-                {
-                    if(expr_id >= 0 && expr_id < expr_count)
-                    {
-                        new_out[expr_id] = VALUE_UNAVAILABLE;
-                    }
-                }
-                for(int def_id : info.kill_def_ids)
-                {
-                    if(def_id >= 0 && static_cast<size_t>(def_id) < expr_defs.size())
-                    {
-                        int expr_id = expr_defs[def_id].expr_id;
-                        if(expr_id >= 0 && expr_id < expr_count && new_out[expr_id] == def_id)
-                        {
-                            new_out[expr_id] = VALUE_UNAVAILABLE;
-                        }
-                    }
-                }
-            }
-
-            if(info.expr_id >= 0 && info.expr_id < expr_count)
-            {
-                new_out[info.expr_id] = info.expr_def_id;
-            }
+        InstructionInfo &info = infos[i];
+        if(info.expr_id < 0) continue;
 
-            if(new_out != info.out_values)
+        int reaching_def = -1;
+        for(int def_id : defs_by_expr[info.expr_id])
+        {
+            if(flow.in[i].test(def_id))
             {
-                info.out_values.swap(new_out);
-                changed = true;
+                reaching_def = def_id;
+                break;
             }
         }
-    }
-    while(changed);
-
-    for(InstructionInfo &info : infos)
-    {
-        if(info.expr_id < 0) continue;
-        if(info.expr_id >= expr_count) continue;
-
-        int reaching_def = info.in_values[info.expr_id];
         if(reaching_def < 0) continue;
-        if(static_cast<size_t>(reaching_def) >= expr_defs.size()) continue;
 
         SYM *replacement = expr_defs[reaching_def].result;
         if(replacement == nullptr) continue;
@@ -0,0 +1,111 @@
+#include <vector>
+#include <algorithm>
+#include "dataflow.h"
+
+void BitSet::clear()
+{
+    std::fill(words_.begin(), words_.end(), 0);
+}
+
+bool BitSet::union_with(const BitSet &other)
+{
+    uint64_t changed = 0;
+    for(size_t w = 0; w < words_.size(); ++w)
+    {
+        uint64_t merged = words_[w] | other.words_[w];
+        changed |= merged ^ words_[w];
+        words_[w] = merged;
+    }
+    return changed != 0;
+}
+
+bool BitSet::intersect_with(const BitSet &other)
+{
+    uint64_t changed = 0;
+    for(size_t w = 0; w < words_.size(); ++w)
+    {
+        uint64_t merged = words_[w] & other.words_[w];
+        changed |= merged ^ words_[w];
+        words_[w] = merged;
+    }
+    return changed != 0;
+}
+
+DataflowResult dataflow_solve(const DataflowProblem &problem,
+                              const std::vector<std::vector<int>> &succ,
+                              const std::vector<std::vector<int>> &pred)
+{
+    const size_t count = succ.size();
+    const bool forward = problem.direction == DataflowDirection::Forward;
+    const bool intersect = problem.meet == DataflowMeet::Intersection;
+
+    DataflowResult result;
+    result.in.assign(count, BitSet(problem.bits));
+    result.out.assign(count, BitSet(problem.bits));
+
+    /* meet over inputs, transfer into outputs; which is in and which out depends on direction */
+    std::vector<BitSet> &input = forward ? result.in : result.out;
+    std::vector<BitSet> &output = forward ? result.out : result.in;
+    const std::vector<std::vector<int>> &sources = forward ? pred : succ;
+    const std::vector<std::vector<int>> &targets = forward ? succ : pred;
+
+    /* FIFO worklist seeded in the given order, else program order (reverse for backward) */
+    std::vector<int> queue(count);
+    std::vector<char> queued(count, 1);
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(problem.order.size() == count) queue[i] = problem.order[i];
+        else queue[i] = forward ? static_cast<int>(i) : static_cast<int>(count - 1 - i);
+    }
+    size_t head = 0;
+    size_t pending = count;
+
+    BitSet next(problem.bits);
+    while(pending > 0)
+    {
+        int node = queue[head];
+        head = (head + 1) % count;
+        --pending;
+        queued[node] = 0;
+
+        const std::vector<int> &from = sources[node];
+        BitSet &in = input[node];
+        if(from.empty())
+        {
+            in.clear();
+        }
+        else
+        {
+            in = output[from[0]];
+            for(size_t k = 1; k < from.size(); ++k)
+            {
+                if(intersect) in.intersect_with(output[from[k]]);
+                else in.union_with(output[from[k]]);
+            }
+        }
+
+        next = in;
+        if(!problem.kill_all.empty() && problem.kill_all[node])
+        {
+            next.clear();
+        }
+        else
+        {
+            for(int bit : problem.kill[node]) next.reset(static_cast<size_t>(bit));
+        }
+        for(int bit : problem.gen[node]) next.set(static_cast<size_t>(bit));
+
+        if(next == output[node]) continue;
+        std::swap(output[node], next);
+
+        for(int target : targets[node])
+        {
+            if(queued[target]) continue;
+            queued[target] = 1;
+            queue[(head + pending) % count] = target;
+            ++pending;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,81 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/*
+    Dense bit sets and a worklist solver for gen/kill dataflow problems
+    over a CFG given as successor/predecessor lists, either the
+    instruction-level one from analysis.h or a block graph. Sets are stored a
+    64-bit word at a time, so meets and transfers cost one operation per
+    word instead of one hash lookup per element.
+*/
+
+class BitSet {
+public:
+    BitSet() : bits_(0) {}
+    explicit BitSet(size_t bits) : words_((bits + 63) / 64, 0), bits_(bits) {}
+
+    size_t size() const { return bits_; }
+    bool test(size_t i) const { return (words_[i >> 6] >> (i & 63)) & 1; }
+    void set(size_t i) { words_[i >> 6] |= uint64_t(1) << (i & 63); }
+    void reset(size_t i) { words_[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+    void clear();
+
+    /* return true when the set changed */
+    bool union_with(const BitSet &other);
+    bool intersect_with(const BitSet &other);
+
+    bool operator==(const BitSet &other) const { return words_ == other.words_; }
+    bool operator!=(const BitSet &other) const { return words_ != other.words_; }
+
+    template<typename F>
+    void for_each(F f) const
+    {
+        for(size_t w = 0; w < words_.size(); ++w)
+        {
+            uint64_t word = words_[w];
+            while(word)
+            {
+                f(w * 64 + static_cast<size_t>(__builtin_ctzll(word)));
+                word &= word - 1;
+            }
+        }
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    size_t bits_;
+};
+
+enum class DataflowDirection { Forward, Backward };
+enum class DataflowMeet { Union, Intersection };
+
+/*
+    out = gen + (in - kill) for a forward problem, in = gen + (out - kill)
+    backward. kill_all empties the set before gen is applied. A node with
+    no predecessors (successors, backward) starts from the empty set, as
+    does every node before the first visit.
+*/
+struct DataflowProblem {
+    DataflowDirection direction = DataflowDirection::Forward;
+    DataflowMeet meet = DataflowMeet::Union;
+    size_t bits = 0;
+    std::vector<std::vector<int>> gen;
+    std::vector<std::vector<int>> kill;
+    std::vector<char> kill_all;     /* optional, empty means none */
+    std::vector<int> order;         /* optional first-visit order, empty means program order */
+};
+
+struct DataflowResult {
+    std::vector<BitSet> in;
+    std::vector<BitSet> out;
+};
+
+DataflowResult dataflow_solve(const DataflowProblem &problem,
+                              const std::vector<std::vector<int>> &succ,
+                              const std::vector<std::vector<int>> &pred);
+
+#endif /* DATAFLOW_H */
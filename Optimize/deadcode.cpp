@@ -1,9 +1,12 @@
 #include <string>
 #include <vector>
-#include <unordered_set>
 #include <unordered_map>
 #include <sstream>
+#include <algorithm>
 #include "deadcode.h"
+#include "analysis.h"
+#include "dataflow.h"
+#include "cfg.h"
 
 namespace {
 
@@ -18,132 +21,12 @@ struct InstructionInfo {
     TAC *tac = nullptr;
     SYM *def = nullptr;
     std::vector<SYM*> uses;
-    std::vector<int> succ;
-    std::unordered_set<SYM*> live_in;
-    std::unordered_set<SYM*> live_out;
     bool removable = false;
     RemovalReason reason = RemovalReason::None;
 };
 
-struct ConstDefCandidate {
-    TAC *tac = nullptr;
-    int index = -1;
-    int value = 0;
-};
-
-std::vector<std::string> g_log;
-int g_removed_total = 0;
-
-using ConstEnv = std::unordered_map<SYM*, int>;
-
-bool is_tracked(SYM *sym);
-
-bool env_equal(const ConstEnv &a, const ConstEnv &b)
-{
-    if(a.size() != b.size()) return false;
-    for(const auto &entry : a)
-    {
-        auto it = b.find(entry.first);
-        if(it == b.end() || it->second != entry.second)
-        {
-            return false;
-        }
-    }
-    return true;
-}
-
-bool assign_env(ConstEnv &dst, const ConstEnv &src)
-{
-    if(env_equal(dst, src)) return false;
-    dst = src;
-    return true;
-}
-
-ConstEnv merge_envs(ConstEnv lhs, const ConstEnv &rhs)
-{
-    for(auto it = lhs.begin(); it != lhs.end(); )
-    {
-        auto jt = rhs.find(it->first);
-        if(jt == rhs.end() || jt->second != it->second)
-        {
-            it = lhs.erase(it);
-        }
-        else
-        {
-            ++it;
-        }
-    }
-    return lhs;
-}
-
-bool operand_constant(SYM *sym, const ConstEnv &env, int &value)
-{
-    if(sym == nullptr) return false;
-    if(sym->type == SYM_INT)
-    {
-        value = sym->value;
-        return true;
-    }
-    if(!is_tracked(sym)) return false;
-    auto it = env.find(sym);
-    if(it == env.end()) return false;
-    value = it->second;
-    return true;
-}
-
-bool evaluate_constant(TAC *t, const ConstEnv &env, int &value)
-{
-    if(t == nullptr) return false;
-    switch(t->op)
-    {
-        case TAC_COPY:
-            if(operand_constant(t->b, env, value)) return true;
-            return false;
-        case TAC_NEG:
-        {
-            int inner;
-            if(!operand_constant(t->b, env, inner)) return false;
-            value = -inner;
-            return true;
-        }
-        case TAC_ADD:
-        case TAC_SUB:
-        case TAC_MUL:
-        case TAC_DIV:
-        case TAC_EQ:
-        case TAC_NE:
-        case TAC_LT:
-        case TAC_LE:
-        case TAC_GT:
-        case TAC_GE:
-        {
-            int lhs, rhs;
-            if(!operand_constant(t->b, env, lhs)) return false;
-            if(!operand_constant(t->c, env, rhs)) return false;
-            switch(t->op)
-            {
-                case TAC_ADD: value = lhs + rhs; break;
-                case TAC_SUB: value = lhs - rhs; break;
-                case TAC_MUL: value = lhs * rhs; break;
-                case TAC_DIV:
-                    if(rhs == 0) return false;
-                    value = lhs / rhs;
-                    break;
-                case TAC_EQ: value = (lhs == rhs) ? 1 : 0; break;
-                case TAC_NE: value = (lhs != rhs) ? 1 : 0; break;
-                case TAC_LT: value = (lhs < rhs) ? 1 : 0; break;
-                case TAC_LE: value = (lhs <= rhs) ? 1 : 0; break;
-                case TAC_GT: value = (lhs > rhs) ? 1 : 0; break;
-                case TAC_GE: value = (lhs >= rhs) ? 1 : 0; break;
-                default:
-                    return false;
-            }
-            return true;
-        }
-        default:
-            return false;
-    }
-}
+thread_local std::vector<std::string> g_log;
+thread_local int g_removed_total = 0;
 
 void log_clear()
 {
@@ -307,46 +190,73 @@ std::string sym_repr(SYM *sym)
     return std::string("<temp>");
 }
 
-bool assign_set(std::unordered_set<SYM*> &dst, const std::unordered_set<SYM*> &src)
+/*
+    Basic blocks of every function from cfg.h, numbered across the
+    program, with their extent in the analysis sequence. rpo lists each
+    function's blocks in reverse postorder from its entry, followed by the
+    blocks no path reaches.
+*/
+struct BlockGraph {
+    std::vector<int> first;
+    std::vector<int> last;
+    std::vector<std::vector<int>> succ;
+    std::vector<std::vector<int>> pred;
+    std::vector<int> rpo;
+};
+
+BlockGraph build_block_graph(const std::vector<TAC*> &sequence)
 {
-    if(dst.size() == src.size())
+    BlockGraph graph;
+    CFG_ALL *all = cfg_build_all();
+
+    /* functions and their blocks come in list order, so one scan finds every extent */
+    size_t pos = 0;
+    std::vector<int> base;
+    for(CFG_FUNCTION *func = all->funcs; func; func = func->next)
+    {
+        base.push_back(static_cast<int>(graph.first.size()));
+        for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next)
+        {
+            while(pos < sequence.size() && sequence[pos] != bb->first) ++pos;
+            graph.first.push_back(static_cast<int>(pos));
+            while(pos < sequence.size() && sequence[pos] != bb->last) ++pos;
+            graph.last.push_back(static_cast<int>(pos));
+            ++pos;
+        }
+    }
+
+    graph.succ.resize(graph.first.size());
+    graph.pred.resize(graph.first.size());
+    std::vector<int> unreached;
+    size_t f = 0;
+    for(CFG_FUNCTION *func = all->funcs; func; func = func->next, ++f)
     {
-        bool identical = true;
-        for(SYM *sym : src)
+        for(int i = 0; i < func->rpo_count; ++i) graph.rpo.push_back(base[f] + func->rpo[i]->id);
+        for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next)
         {
-            if(dst.find(sym) == dst.end())
+            if(bb->rpo < 0) unreached.push_back(base[f] + bb->id);
+            int from = base[f] + bb->id;
+            for(BB_LIST *edge = bb->succ; edge; edge = edge->next)
             {
-                identical = false;
-                break;
+                int to = base[f] + edge->bb->id;
+                graph.succ[from].push_back(to);
+                graph.pred[to].push_back(from);
             }
         }
-        if(identical) return false;
     }
-    dst = src;
-    return true;
-}
-
-int label_index(SYM *label, const std::unordered_map<SYM*, int> &map)
-{
-    if(label == nullptr) return -1;
-    auto it = map.find(label);
-    return (it == map.end()) ? -1 : it->second;
+    cfg_free_all(all);
+    graph.rpo.insert(graph.rpo.end(), unreached.begin(), unreached.end());
+    return graph;
 }
 
 int run_iteration()
 {
-    std::vector<TAC*> sequence;
-    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
-    {
-        sequence.push_back(cur);
-    }
+    const ProgramAnalysis &cfg = analysis_cfg();
+    const std::vector<TAC*> &sequence = cfg.sequence;
     if(sequence.empty()) return 0;
 
     std::vector<InstructionInfo> infos(sequence.size());
-    std::unordered_map<SYM*, int> label_map;
-    std::unordered_map<SYM*, int> real_def_count;
     std::unordered_map<SYM*, int> label_refcount;
-    std::unordered_map<SYM*, ConstDefCandidate> const_copy_defs;
 
     for(size_t i = 0; i < sequence.size(); ++i)
     {
@@ -354,28 +264,6 @@ int run_iteration()
         info.tac = sequence[i];
         info.def = tac_def(info.tac);
         collect_uses(info.tac, info.uses);
-        if(info.tac->op == TAC_LABEL && info.tac->a)
-        {
-            label_map[info.tac->a] = static_cast<int>(i);
-        }
-
-        SYM *def = info.def;
-        if(def && is_tracked(def))
-        {
-            int op = info.tac->op;
-            if(op != TAC_VAR && op != TAC_FORMAL)
-            {
-                real_def_count[def] += 1;
-                if(op == TAC_COPY && info.tac->b && info.tac->b->type == SYM_INT)
-                {
-                    const_copy_defs[def] = ConstDefCandidate{info.tac, static_cast<int>(i), info.tac->b->value};
-                }
-                else
-                {
-                    const_copy_defs.erase(def);
-                }
-            }
-        }
 
         if(info.tac->op == TAC_GOTO || info.tac->op == TAC_IFZ)
         {
@@ -386,168 +274,9 @@ int run_iteration()
         }
     }
 
-    std::unordered_map<SYM*, ConstDefCandidate> unique_const_defs;
-    for(const auto &entry : const_copy_defs)
-    {
-        SYM *sym = entry.first;
-        auto it = real_def_count.find(sym);
-        if(it != real_def_count.end() && it->second == 1)
-        {
-            unique_const_defs[sym] = entry.second;
-        }
-    }
-
-    auto next_index = [&](size_t idx) -> int {
-        return (idx + 1 < sequence.size()) ? static_cast<int>(idx + 1) : -1;
-    };
-
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        TAC *t = infos[i].tac;
-        switch(t->op)
-        {
-            case TAC_GOTO:
-            {
-                int target = label_index(t->a, label_map);
-                if(target >= 0) infos[i].succ.push_back(target);
-                break;
-            }
-            case TAC_IFZ:
-            {
-                int target = label_index(t->a, label_map);
-                if(target >= 0) infos[i].succ.push_back(target);
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
-            }
-            case TAC_RETURN:
-            case TAC_ENDFUNC:
-                break;
-            default:
-            {
-                int fall = next_index(i);
-                if(fall >= 0) infos[i].succ.push_back(fall);
-                break;
-            }
-        }
-    }
-
-    std::vector<std::vector<int>> preds(infos.size());
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        for(int succ : infos[i].succ)
-        {
-            if(succ >= 0 && succ < static_cast<int>(infos.size()))
-            {
-                preds[succ].push_back(static_cast<int>(i));
-            }
-        }
-    }
-
-    std::vector<ConstEnv> const_in(infos.size());
-    std::vector<ConstEnv> const_out(infos.size());
-    bool const_changed;
-    do
-    {
-        const_changed = false;
-        for(size_t i = 0; i < infos.size(); ++i)
-        {
-            ConstEnv merged;
-            const auto &pred_list = preds[i];
-            if(!pred_list.empty())
-            {
-                merged = const_out[pred_list[0]];
-                for(size_t j = 1; j < pred_list.size(); ++j)
-                {
-                    merged = merge_envs(merged, const_out[pred_list[j]]);
-                }
-            }
-
-            if(assign_env(const_in[i], merged))
-            {
-                const_changed = true;
-            }
-
-            ConstEnv updated = const_in[i];
-            SYM *def = infos[i].def;
-            if(def && is_tracked(def))
-            {
-                int value;
-                if(evaluate_constant(infos[i].tac, const_in[i], value))
-                {
-                    updated[def] = value;
-                }
-                else
-                {
-                    updated.erase(def);
-                }
-            }
-
-            if(assign_env(const_out[i], updated))
-            {
-                const_changed = true;
-            }
-        }
-    } while(const_changed);
-
-    int removed_constant_ifz = 0;
-    bool changed_constant_ifz = false;
-    for(size_t i = 0; i < infos.size(); ++i)
-    {
-        TAC *t = infos[i].tac;
-        if(t->op != TAC_IFZ) continue;
-
-        int cond_value;
-        bool has_const = operand_constant(t->b, const_in[i], cond_value);
-        if(!has_const)
-        {
-            auto it = unique_const_defs.find(t->b);
-            if(it == unique_const_defs.end() || it->second.index >= static_cast<int>(i))
-            {
-                continue;
-            }
-            cond_value = it->second.value;
-            has_const = true;
-        }
-
-        if(!has_const)
-        {
-            continue;
-        }
-
-        if(cond_value == 0)
-        {
-            t->op = TAC_GOTO;
-            t->b = nullptr;
-            t->c = nullptr;
-            changed_constant_ifz = true;
-            std::ostringstream msg;
-            msg << "folded constant ifz -> " << sym_repr(t->a);
-            log_append(msg.str());
-        }
-        else
-        {
-            TAC *prev = t->prev;
-            TAC *next = t->next;
-            if(prev) prev->next = next; else tac_first = next;
-            if(next) next->prev = prev; else tac_last = prev;
-            t->prev = nullptr;
-            t->next = nullptr;
-
-            std::ostringstream msg;
-            msg << "removed constant ifz -> " << sym_repr(t->a)
-                << " (condition " << cond_value << ")";
-            log_append(msg.str());
-            ++removed_constant_ifz;
-            changed_constant_ifz = true;
-        }
-    }
-
-    if(changed_constant_ifz)
-    {
-        g_removed_total += removed_constant_ifz;
-        return (removed_constant_ifz > 0) ? removed_constant_ifz : 1;
-    }
+    /* branches on constants are left to sccp, so here code is unreachable only if no jump or fallthrough leads to it */
+    BlockGraph blocks = build_block_graph(sequence);
+    const size_t block_count = blocks.first.size();
 
     std::vector<char> reachable(infos.size(), 0);
     std::vector<int> worklist;
@@ -579,49 +308,78 @@ int run_iteration()
     {
         int idx = worklist.back();
         worklist.pop_back();
-        for(int succ : infos[idx].succ)
+        for(int succ : cfg.succ[idx])
         {
             enqueue(succ);
         }
     }
 
-    bool changed;
-    do
+    /* liveness: upward-exposed uses and definitions summarise each block, bits are SYM_INDEX */
+    std::vector<int> def_ids(infos.size(), -1);
+    std::vector<std::vector<int>> use_ids(infos.size());
+    int bits = 0;
+    for(size_t i = 0; i < infos.size(); ++i)
     {
-        changed = false;
-        for(int i = static_cast<int>(infos.size()) - 1; i >= 0; --i)
+        InstructionInfo &info = infos[i];
+        if(info.def && is_tracked(info.def))
         {
-            InstructionInfo &info = infos[i];
+            def_ids[i] = SYM_INDEX(info.def);
+            bits = std::max(bits, def_ids[i] + 1);
+        }
+        for(SYM *sym : info.uses)
+        {
+            use_ids[i].push_back(SYM_INDEX(sym));
+            bits = std::max(bits, use_ids[i].back() + 1);
+        }
+    }
 
-            std::unordered_set<SYM*> new_out;
-            for(int succ : info.succ)
-            {
-                const auto &succ_in = infos[succ].live_in;
-                new_out.insert(succ_in.begin(), succ_in.end());
-            }
-            if(assign_set(info.live_out, new_out))
+    DataflowProblem liveness;
+    liveness.direction = DataflowDirection::Backward;
+    liveness.meet = DataflowMeet::Union;
+    liveness.bits = bits;
+    liveness.gen.resize(block_count);
+    liveness.kill.resize(block_count);
+    liveness.order.assign(blocks.rpo.rbegin(), blocks.rpo.rend());
+    BitSet exposed(liveness.bits);
+    BitSet defined(liveness.bits);
+    for(size_t b = 0; b < block_count; ++b)
+    {
+        exposed.clear();
+        defined.clear();
+        for(int i = blocks.last[b]; i >= blocks.first[b]; --i)
+        {
+            if(def_ids[i] >= 0)
             {
-                changed = true;
+                exposed.reset(def_ids[i]);
+                defined.set(def_ids[i]);
             }
+            for(int id : use_ids[i]) exposed.set(id);
+        }
+        exposed.for_each([&](size_t id) { liveness.gen[b].push_back(static_cast<int>(id)); });
+        defined.for_each([&](size_t id) { liveness.kill[b].push_back(static_cast<int>(id)); });
+    }
+    DataflowResult live = dataflow_solve(liveness, blocks.succ, blocks.pred);
 
-            std::unordered_set<SYM*> new_in = info.live_out;
-            if(info.def)
+    /* instructions outside any function never hold a removable definition */
+    std::vector<char> live_after(infos.size(), 1);
+    BitSet live_now(liveness.bits);
+    for(size_t b = 0; b < block_count; ++b)
+    {
+        live_now = live.out[b];
+        for(int i = blocks.last[b]; i >= blocks.first[b]; --i)
+        {
+            if(def_ids[i] < 0)
             {
-                new_in.erase(info.def);
+                live_after[i] = 0;
             }
-            for(SYM *sym : info.uses)
+            else
             {
-                if(is_tracked(sym))
-                {
-                    new_in.insert(sym);
-                }
-            }
-            if(assign_set(info.live_in, new_in))
-            {
-                changed = true;
+                live_after[i] = live_now.test(def_ids[i]);
+                live_now.reset(def_ids[i]);
             }
+            for(int id : use_ids[i]) live_now.set(id);
         }
-    } while(changed);
+    }
 
     for(size_t i = 0; i < infos.size(); ++i)
     {
@@ -636,8 +394,9 @@ int run_iteration()
         info.reason = RemovalReason::Unreachable;
     }
 
-    for(InstructionInfo &info : infos)
+    for(size_t i = 0; i < infos.size(); ++i)
     {
+        InstructionInfo &info = infos[i];
         if(info.reason != RemovalReason::None) continue;
         if(!is_side_effect_free(info.tac->op)) continue;
         if(info.tac->op == TAC_VAR || info.tac->op == TAC_FORMAL)
@@ -645,7 +404,7 @@ int run_iteration()
             continue;
         }
         if(info.def == nullptr) continue;
-        if(info.live_out.find(info.def) != info.live_out.end()) continue;
+        if(live_after[i]) continue;
 
         info.removable = true;
         info.reason = RemovalReason::DeadDefinition;
@@ -727,6 +486,10 @@ int run_iteration()
         t->prev = nullptr;
         t->next = nullptr;
     }
+    if(removed_this_round > 0)
+    {
+        analysis_invalidate(ANALYSIS_INDEX);
+    }
 
     g_removed_total += removed_this_round;
     return removed_this_round;
@@ -741,6 +504,60 @@ extern "C" int deadcode_run(void)
     return g_removed_total;
 }
 
+struct deadcode_report {
+    std::vector<std::string> log;
+    int removed = 0;
+};
+
+extern "C" DEADCODE_REPORT *deadcode_take(void)
+{
+    DEADCODE_REPORT *report = new DEADCODE_REPORT;
+    report->log.swap(g_log);
+    report->removed = g_removed_total;
+    log_clear();
+    return report;
+}
+
+extern "C" void deadcode_merge(DEADCODE_REPORT **reports, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        g_log.insert(g_log.end(), reports[i]->log.begin(), reports[i]->log.end());
+        g_removed_total += reports[i]->removed;
+        delete reports[i];
+    }
+}
+
+extern "C" void deadcode_write(const DEADCODE_REPORT *report, FILE *out)
+{
+    fprintf(out, "deadcode %d %zu\n", report->removed, report->log.size());
+    for(const std::string &line : report->log) fprintf(out, "%s\n", line.c_str());
+}
+
+extern "C" DEADCODE_REPORT *deadcode_read(FILE *in)
+{
+    int removed;
+    size_t lines;
+    if(fscanf(in, "deadcode %d %zu", &removed, &lines) != 2 || fgetc(in) != '\n') return nullptr;
+
+    DEADCODE_REPORT *report = new DEADCODE_REPORT;
+    report->removed = removed;
+    report->log.resize(lines);
+    for(std::string &line : report->log)
+    {
+        for(int c = fgetc(in); c != '\n'; c = fgetc(in))
+        {
+            if(c == EOF)
+            {
+                delete report;
+                return nullptr;
+            }
+            line.push_back(static_cast<char>(c));
+        }
+    }
+    return report;
+}
+
 extern "C" void deadcode_emit_report(FILE *out)
 {
     if(out == nullptr) return;
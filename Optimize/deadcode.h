@@ -11,6 +11,15 @@ extern "C" {
 int deadcode_run(void);
 void deadcode_emit_report(FILE *out);
 
+/* the calling thread's report of its last run, moved out and merged back like optlog_take */
+typedef struct deadcode_report DEADCODE_REPORT;
+DEADCODE_REPORT *deadcode_take(void);
+void deadcode_merge(DEADCODE_REPORT **reports, int count);
+
+/* as text and back, like optlog_write and optlog_read */
+void deadcode_write(const DEADCODE_REPORT *report, FILE *out);
+DEADCODE_REPORT *deadcode_read(FILE *in);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,18 +6,21 @@
 #include <sstream>
 #include "licm.h"
 #include "optlog.h"
+#include "analysis.h"
+#include "dataflow.h"
+#include "cfg.h"
 
 namespace {
 
 struct LoopInfo {
     TAC *header = nullptr;
     TAC *backedge = nullptr;
-    int header_index = -1;
-    int back_index = -1;
+    TAC *landing = nullptr; /* hoisted code goes before this, NULL if the loop has no preheader */
+    std::unordered_set<SYM*> movable; /* variables whose definition in the loop may run before it */
 };
 
-std::vector<std::string> *g_log = nullptr;
-int g_hoisted = 0;
+thread_local std::vector<std::string> *g_log = nullptr;
+thread_local int g_hoisted = 0;
 
 bool is_tracked_symbol(SYM *sym)
 {
@@ -36,9 +39,7 @@ bool is_tracked_symbol(SYM *sym)
 
 bool is_temp_symbol(SYM *sym)
 {
-    if(sym == nullptr) return false;
-    if(sym->name == nullptr) return false;
-    return sym->name[0] == 't';
+    return sym != nullptr && sym->kind == SYM_KIND_TEMP;
 }
 
 bool is_candidate_op(int op)
@@ -156,11 +157,13 @@ void detach_tac(TAC *node)
     if(next) next->prev = prev; else tac_last = prev;
     node->prev = nullptr;
     node->next = nullptr;
+    analysis_invalidate(ANALYSIS_INDEX);
 }
 
 void insert_before(TAC *pos, TAC *node)
 {
     if(node == nullptr) return;
+    analysis_invalidate(ANALYSIS_INDEX);
     if(pos == nullptr)
     {
         node->prev = tac_last;
@@ -177,9 +180,25 @@ void insert_before(TAC *pos, TAC *node)
     if(prev) prev->next = node; else tac_first = node;
 }
 
-bool process_loop(TAC *header, TAC *backedge)
+/* per-loop symbol tables, cleared and reused for every loop of a run */
+struct LoopTables {
+    SymMap<int> def_count;
+    SymMap<TAC*> var_decl;
+    SymMap<char> invariant_defs;
+
+    void clear()
+    {
+        def_count.clear();
+        var_decl.clear();
+        invariant_defs.clear();
+    }
+};
+
+bool process_loop(const LoopInfo &loop, LoopTables &tables)
 {
-    if(header == nullptr || backedge == nullptr) return false;
+    TAC *header = loop.header;
+    TAC *backedge = loop.backedge;
+    if(header == nullptr || backedge == nullptr || loop.landing == nullptr) return false;
 
     std::vector<TAC*> body;
     body.reserve(64);
@@ -189,8 +208,9 @@ bool process_loop(TAC *header, TAC *backedge)
     }
     if(body.empty()) return false;
 
-    std::unordered_map<SYM*, int> def_count;
-    std::unordered_map<SYM*, TAC*> var_decl;
+    tables.clear();
+    SymMap<int> &def_count = tables.def_count;
+    SymMap<TAC*> &var_decl = tables.var_decl;
     for(TAC *cur : body)
     {
         if(cur->op == TAC_VAR && cur->a)
@@ -210,7 +230,7 @@ bool process_loop(TAC *header, TAC *backedge)
 
     std::unordered_set<TAC*> hoist_set;
     std::vector<TAC*> hoist_order;
-    std::unordered_set<SYM*> invariant_defs;
+    SymMap<char> &invariant_defs = tables.invariant_defs;
 
     bool changed;
     do
@@ -228,8 +248,9 @@ bool process_loop(TAC *header, TAC *backedge)
                 if(cur->op != TAC_COPY) continue;
                 if(def->type != SYM_VAR) continue;
             }
-            auto itc = def_count.find(def);
-            if(itc == def_count.end() || itc->second != 1) continue;
+            const int *defs = def_count.find(def);
+            if(defs == nullptr || *defs != 1) continue;
+            if(!loop.movable.count(def)) continue;
 
             if(cur->b == def || cur->c == def)
             {
@@ -242,21 +263,17 @@ bool process_loop(TAC *header, TAC *backedge)
             for(SYM *use : uses)
             {
                 if(!is_tracked_symbol(use)) continue;
-                auto dit = def_count.find(use);
-                if(dit != def_count.end())
+                if(def_count.contains(use) && !invariant_defs.contains(use))
                 {
-                    if(invariant_defs.find(use) == invariant_defs.end())
-                    {
-                        ok = false;
-                        break;
-                    }
+                    ok = false;
+                    break;
                 }
             }
             if(!ok) continue;
 
             hoist_set.insert(cur);
             hoist_order.push_back(cur);
-            invariant_defs.insert(def);
+            invariant_defs[def] = 1;
             changed = true;
         }
     } while(changed);
@@ -272,18 +289,14 @@ bool process_loop(TAC *header, TAC *backedge)
     for(TAC *node : hoist_order)
     {
         SYM *def = tac_def_symbol(node);
-        if(def)
+        if(def && var_decl.contains(def) && var_decl[def] != nullptr)
         {
-            auto declIt = var_decl.find(def);
-            if(declIt != var_decl.end())
-            {
-                TAC *decl = declIt->second;
-                detach_tac(decl);
-                insert_before(header, decl);
-                var_decl.erase(declIt);
-            }
+            TAC *decl = var_decl[def];
+            detach_tac(decl);
+            insert_before(loop.landing, decl);
+            var_decl[def] = nullptr;
         }
-        insert_before(header, node);
+        insert_before(loop.landing, node);
         ++g_hoisted;
         log_hoist(def, loop_label);
     }
@@ -291,98 +304,217 @@ bool process_loop(TAC *header, TAC *backedge)
     return true;
 }
 
-} // namespace
+template<typename F>
+void for_each_tac(BASIC_BLOCK *bb, F f)
+{
+    for(TAC *t = bb->first; t; t = t->next)
+    {
+        f(t);
+        if(t == bb->last) break;
+    }
+}
 
-extern "C" void licm_reset(void)
+/* the symbol t assigns a value to, declarations aside */
+SYM *assigned_symbol(TAC *t)
 {
-    g_log = nullptr;
-    g_hoisted = 0;
+    if(t->op == TAC_VAR || t->op == TAC_FORMAL) return nullptr;
+    SYM *def = tac_def_symbol(t);
+    return is_tracked_symbol(def) ? def : nullptr;
 }
 
-extern "C" int licm_run(void)
+/* what t reads; a call and leaving the function read every global too */
+void collect_reads(TAC *t, const std::vector<SYM*> &globals, std::vector<SYM*> &out)
 {
-    std::vector<std::string> run_log;
-    g_log = &run_log;
-    g_hoisted = 0;
+    collect_uses(t, out);
+    if(t->op == TAC_CALL || t->op == TAC_RETURN || t->op == TAC_ENDFUNC)
+    {
+        out.insert(out.end(), globals.begin(), globals.end());
+    }
+}
 
-    bool changed_any = false;
+/* variables live on entry to each block of func, by block id and SYM_INDEX */
+std::vector<BitSet> live_in(CFG_FUNCTION *func, const std::vector<SYM*> &globals)
+{
+    size_t bits = 0;
+    std::vector<SYM*> reads;
+    for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next)
+    {
+        for_each_tac(bb, [&](TAC *t) {
+            reads.clear();
+            collect_reads(t, globals, reads);
+            if(SYM *def = assigned_symbol(t)) reads.push_back(def);
+            for(SYM *sym : reads) bits = std::max(bits, static_cast<size_t>(SYM_INDEX(sym)) + 1);
+        });
+    }
 
-    while(true)
+    std::vector<std::vector<int>> succ(func->block_count), pred(func->block_count);
+    DataflowProblem liveness;
+    liveness.direction = DataflowDirection::Backward;
+    liveness.meet = DataflowMeet::Union;
+    liveness.bits = bits;
+    liveness.gen.resize(func->block_count);
+    liveness.kill.resize(func->block_count);
+    BitSet exposed(bits), defined(bits);
+    for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next)
     {
-        std::vector<TAC*> sequence;
-        std::vector<int> func_id;
-        std::unordered_map<SYM*, int> label_index;
-        sequence.reserve(256);
-        func_id.reserve(256);
-
-        int current_func = -1;
-        int next_func_id = 0;
-        for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
+        for(BB_LIST *edge = bb->succ; edge; edge = edge->next)
         {
-            sequence.push_back(cur);
-            func_id.push_back(current_func);
-
-            if(cur->op == TAC_BEGINFUNC)
+            succ[bb->id].push_back(edge->bb->id);
+            pred[edge->bb->id].push_back(bb->id);
+        }
+        exposed.clear();
+        defined.clear();
+        for(TAC *t = bb->last; t; t = t->prev)
+        {
+            if(SYM *def = assigned_symbol(t))
             {
-                current_func = next_func_id++;
-                func_id.back() = current_func;
+                exposed.reset(SYM_INDEX(def));
+                defined.set(SYM_INDEX(def));
             }
-            else if(cur->op == TAC_ENDFUNC)
+            reads.clear();
+            collect_reads(t, globals, reads);
+            for(SYM *sym : reads) exposed.set(SYM_INDEX(sym));
+            if(t == bb->first) break;
+        }
+        exposed.for_each([&](size_t i) { liveness.gen[bb->id].push_back(static_cast<int>(i)); });
+        defined.for_each([&](size_t i) { liveness.kill[bb->id].push_back(static_cast<int>(i)); });
+    }
+    return dataflow_solve(liveness, succ, pred).in;
+}
+
+/* an instruction's place, blocks dominating the ones they run before */
+struct Site {
+    BASIC_BLOCK *bb = nullptr;
+    int pos = 0;
+};
+
+bool site_dominates(const Site &a, const Site &b)
+{
+    if(a.bb == b.bb) return a.pos < b.pos;
+    return cfg_dominates(a.bb, b.bb) != 0;
+}
+
+/*
+    A variable defined once in the loop may have that definition moved
+    ahead of the loop only if nothing in the loop can read the value it
+    had before: the definition dominates every read in the loop, and the
+    variable is dead on entry to the header, which also covers reads
+    after a loop that ran no times.
+*/
+void find_movable(CFG_LOOP *loop, const BitSet &header_live, const std::vector<SYM*> &globals,
+                  std::unordered_set<SYM*> &movable)
+{
+    std::unordered_map<SYM*, int> defs;
+    std::unordered_map<SYM*, Site> def_site;
+    std::vector<std::pair<SYM*, Site>> reads;
+    std::vector<SYM*> read;
+    for(BB_LIST *entry = loop->blocks; entry; entry = entry->next)
+    {
+        Site site;
+        site.bb = entry->bb;
+        for_each_tac(entry->bb, [&](TAC *t) {
+            read.clear();
+            collect_reads(t, globals, read);
+            for(SYM *sym : read) reads.push_back(std::make_pair(sym, site));
+            if(SYM *def = assigned_symbol(t))
             {
-                // ENDFUNC belongs to current function; keep id before resetting.
-                current_func = -1;
+                defs[def] += 1;
+                def_site[def] = site;
             }
+            ++site.pos;
+        });
+    }
 
-            if(cur->op == TAC_LABEL && cur->a)
+    for(const auto &entry : defs)
+    {
+        SYM *var = entry.first;
+        if(entry.second != 1 || header_live.test(SYM_INDEX(var))) continue;
+        const Site &def = def_site[var];
+        bool dominated = true;
+        for(const auto &use : reads)
+        {
+            if(use.first == var && !site_dominates(def, use.second))
             {
-                label_index[cur->a] = static_cast<int>(sequence.size() - 1);
+                dominated = false;
+                break;
             }
         }
+        if(dominated) movable.insert(var);
+    }
+}
 
-        if(sequence.empty()) break;
-
-        std::vector<LoopInfo> loops;
-        loops.reserve(sequence.size());
-        std::unordered_set<unsigned long long> seen;
+/* loops that are just the code from a header label to the goto closing them, innermost first */
+std::vector<LoopInfo> find_loops(void)
+{
+    std::vector<LoopInfo> loops;
+    CFG_ALL *all = cfg_build_all();
+    for(CFG_FUNCTION *func = all->funcs; func; func = func->next)
+    {
+        if(func->loop_list == nullptr) continue;
 
-        for(size_t i = 0; i < sequence.size(); ++i)
+        std::vector<SYM*> globals;
+        std::unordered_set<SYM*> seen;
+        std::vector<SYM*> syms;
+        for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next)
         {
-            TAC *t = sequence[i];
-            if(t->op != TAC_GOTO) continue;
-            SYM *target_sym = t->a;
-            if(target_sym == nullptr) continue;
-            auto it = label_index.find(target_sym);
-            if(it == label_index.end()) continue;
-            int target_idx = it->second;
-            if(target_idx >= static_cast<int>(i)) continue;
-            if(func_id[i] < 0 || func_id[i] != func_id[target_idx]) continue;
-
-            TAC *header = sequence[target_idx];
-            if(header == nullptr || header->op != TAC_LABEL) continue;
-
-            unsigned long long key = (static_cast<unsigned long long>(target_idx) << 32) |
-                                     static_cast<unsigned long long>(i);
-            if(!seen.insert(key).second) continue;
+            for_each_tac(bb, [&](TAC *t) {
+                syms.clear();
+                collect_uses(t, syms);
+                if(SYM *def = assigned_symbol(t)) syms.push_back(def);
+                for(SYM *sym : syms)
+                {
+                    if(sym->kind == SYM_KIND_GLOBAL && seen.insert(sym).second) globals.push_back(sym);
+                }
+            });
+        }
+        std::vector<BitSet> live = live_in(func, globals);
 
+        for(CFG_LOOP *loop = func->loop_list; loop; loop = loop->next)
+        {
+            if(loop->backedge == nullptr) continue;
             LoopInfo info;
-            info.header = header;
-            info.backedge = sequence[i];
-            info.header_index = target_idx;
-            info.back_index = static_cast<int>(i);
+            info.header = loop->header->first;
+            info.backedge = loop->backedge;
+            if(loop->preheader != nullptr)
+            {
+                TAC *last = loop->preheader->last;
+                if(last->op == TAC_GOTO) info.landing = last;
+                else if(last->next == info.header) info.landing = info.header;
+            }
+            if(info.landing != nullptr) find_movable(loop, live[loop->header->id], globals, info.movable);
             loops.push_back(info);
         }
+    }
+    cfg_free_all(all);
+    return loops;
+}
 
-        if(loops.empty()) break;
+} // namespace
 
-        std::sort(loops.begin(), loops.end(), [](const LoopInfo &a, const LoopInfo &b) {
-            if(a.header_index != b.header_index) return a.header_index > b.header_index;
-            return a.back_index > b.back_index;
-        });
+extern "C" void licm_reset(void)
+{
+    g_log = nullptr;
+    g_hoisted = 0;
+}
+
+extern "C" int licm_run(void)
+{
+    std::vector<std::string> run_log;
+    g_log = &run_log;
+    g_hoisted = 0;
+
+    bool changed_any = false;
+    LoopTables tables;
+
+    while(true)
+    {
+        std::vector<LoopInfo> loops = find_loops();
+        if(loops.empty()) break;
 
         bool iteration_changed = false;
         for(const LoopInfo &loop : loops)
         {
-            if(process_loop(loop.header, loop.backedge))
+            if(process_loop(loop, tables))
             {
                 iteration_changed = true;
             }
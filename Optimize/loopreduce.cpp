@@ -6,7 +6,10 @@
 #include <limits>
 #include <sstream>
 #include "loopreduce.h"
+#include "sccp.h"
 #include "optlog.h"
+#include "analysis.h"
+#include "cfg.h"
 #include "tac.h"
 
 namespace {
@@ -14,8 +17,6 @@ namespace {
 struct LoopInfo {
     TAC *header = nullptr;
     TAC *backedge = nullptr;
-    int header_index = -1;
-    int back_index = -1;
 };
 
 struct AccReduction {
@@ -25,8 +26,9 @@ struct AccReduction {
     TAC *copy_node = nullptr;
 };
 
-std::vector<std::string> *g_log = nullptr;
-int g_collapses = 0;
+thread_local std::vector<std::string> *g_log = nullptr;
+thread_local int g_collapses = 0;
+thread_local const SccpLoopEntry *g_entry = nullptr;
 
 bool log_skip(const char *loop_label, const char *reason)
 {
@@ -57,9 +59,7 @@ bool is_tracked_symbol(const SYM *sym)
 
 bool is_temp_symbol(const SYM *sym)
 {
-    if(sym == nullptr) return false;
-    if(sym->name == nullptr) return false;
-    return sym->name[0] == 't';
+    return sym != nullptr && sym->kind == SYM_KIND_TEMP;
 }
 
 SYM *tac_def_symbol(TAC *t)
@@ -105,11 +105,13 @@ void detach_tac(TAC *node)
     if(next) next->prev = prev; else tac_last = prev;
     node->prev = nullptr;
     node->next = nullptr;
+    analysis_invalidate(ANALYSIS_INDEX);
 }
 
 void insert_before(TAC *pos, TAC *node)
 {
     if(node == nullptr) return;
+    analysis_invalidate(ANALYSIS_INDEX);
     if(pos == nullptr)
     {
         node->prev = tac_last;
@@ -126,25 +128,10 @@ void insert_before(TAC *pos, TAC *node)
     if(prev) prev->next = node; else tac_first = node;
 }
 
+/* the constant sym holds whenever the loop at header is entered, as sccp found it */
 bool get_constant_value_before(TAC *header, SYM *sym, int &value)
 {
-    if(sym == nullptr) return false;
-    for(TAC *cur = header->prev; cur != nullptr; cur = cur->prev)
-    {
-        if(cur->op == TAC_BEGINFUNC)
-        {
-            break;
-        }
-        SYM *def = tac_def_symbol(cur);
-        if(def != sym) continue;
-        if(cur->op == TAC_COPY && cur->b != nullptr && cur->b->type == SYM_INT)
-        {
-            value = cur->b->value;
-            return true;
-        }
-        return false;
-    }
-    return false;
+    return g_entry != nullptr && sym != nullptr && g_entry->find(header, sym, value);
 }
 
 struct ExprResult {
@@ -155,7 +142,7 @@ struct ExprResult {
 
 ExprResult eval_symbol(SYM *sym,
                        SYM *acc,
-                       const std::unordered_map<SYM*, TAC*> &def_map,
+                       const SymMap<TAC*> &def_map,
                        std::unordered_set<SYM*> &temps_used,
                        std::unordered_set<TAC*> &nodes_used,
                        TAC *header,
@@ -190,10 +177,9 @@ ExprResult eval_symbol(SYM *sym,
 
     ExprResult result{0, 0, false};
 
-    auto def_it = def_map.find(sym);
-    if(def_it != def_map.end())
+    if(TAC *const *def_it = def_map.find(sym))
     {
-        TAC *def = def_it->second;
+        TAC *def = *def_it;
         if(def == nullptr)
         {
             visiting.erase(sym);
@@ -329,7 +315,26 @@ bool compute_trip_count(int cmp_op, int init, int limit, int step, int &trip_cou
     return true;
 }
 
-bool process_loop(const LoopInfo &loop)
+/* per-loop symbol tables, cleared and reused for every loop of a run */
+struct LoopTables {
+    SymMap<TAC*> def_map;
+    SymMap<int> def_count;
+    SymMap<int> use_count;
+
+    void clear()
+    {
+        def_map.clear();
+        def_count.clear();
+        use_count.clear();
+    }
+};
+
+void count_use(SymMap<int> &use_count, SYM *sym)
+{
+    if(is_tracked_symbol(sym)) use_count[sym]++;
+}
+
+bool process_loop(const LoopInfo &loop, LoopTables &tables)
 {
     TAC *header = loop.header;
     TAC *backedge = loop.backedge;
@@ -367,14 +372,15 @@ bool process_loop(const LoopInfo &loop)
         }
     }
 
-    std::unordered_map<SYM*, TAC*> def_map;
-    std::unordered_map<SYM*, int> def_count;
-    std::unordered_map<SYM*, int> use_count;
+    tables.clear();
+    SymMap<TAC*> &def_map = tables.def_map;
+    SymMap<int> &def_count = tables.def_count;
+    SymMap<int> &use_count = tables.use_count;
 
     for(TAC *cur : body)
     {
         SYM *def = tac_def_symbol(cur);
-        if(def != nullptr)
+        if(is_tracked_symbol(def))
         {
             def_map[def] = cur;
             def_count[def] += 1;
@@ -392,23 +398,23 @@ bool process_loop(const LoopInfo &loop)
             case TAC_LE:
             case TAC_GT:
             case TAC_GE:
-                if(cur->b) use_count[cur->b]++;
-                if(cur->c) use_count[cur->c]++;
+                count_use(use_count, cur->b);
+                count_use(use_count, cur->c);
                 break;
             case TAC_NEG:
             case TAC_COPY:
-                if(cur->b) use_count[cur->b]++;
+                count_use(use_count, cur->b);
                 break;
             case TAC_IFZ:
-                if(cur->b) use_count[cur->b]++;
+                count_use(use_count, cur->b);
                 break;
             case TAC_RETURN:
             case TAC_OUTPUT:
             case TAC_ACTUAL:
-                if(cur->a) use_count[cur->a]++;
+                count_use(use_count, cur->a);
                 break;
             case TAC_CALL:
-                if(cur->b) use_count[cur->b]++;
+                count_use(use_count, cur->b);
                 break;
             default:
                 break;
@@ -636,7 +642,7 @@ bool process_loop(const LoopInfo &loop)
 
     std::vector<std::pair<SYM*, int>> constant_overwrites;
 
-    for(auto const& [sym, count] : def_count)
+    for(SYM *sym : def_count.keys())
     {
         if(sym == ivar) continue;
         if(!is_tracked_symbol(sym)) continue;
@@ -803,6 +809,26 @@ bool process_loop(const LoopInfo &loop)
     return true;
 }
 
+/* loops that are just the code from a header label to the goto closing them, innermost first */
+std::vector<LoopInfo> find_loops(void)
+{
+    std::vector<LoopInfo> loops;
+    CFG_ALL *all = cfg_build_all();
+    for(CFG_FUNCTION *func = all->funcs; func; func = func->next)
+    {
+        for(CFG_LOOP *loop = func->loop_list; loop; loop = loop->next)
+        {
+            if(loop->backedge == nullptr) continue;
+            LoopInfo info;
+            info.header = loop->header->first;
+            info.backedge = loop->backedge;
+            loops.push_back(info);
+        }
+    }
+    cfg_free_all(all);
+    return loops;
+}
+
 } // namespace
 
 extern "C" void loopreduce_reset(void)
@@ -816,85 +842,24 @@ extern "C" int loopreduce_run(void)
     std::vector<std::string> run_log;
     g_log = &run_log;
     g_collapses = 0;
+    LoopTables tables;
 
     while(true)
     {
-        std::vector<TAC*> sequence;
-        std::vector<int> func_id;
-        std::unordered_map<SYM*, int> label_index;
-        sequence.reserve(256);
-        func_id.reserve(256);
-
-        int current_func = -1;
-        int next_func_id = 0;
-        for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
-        {
-            sequence.push_back(cur);
-            func_id.push_back(current_func);
-
-            if(cur->op == TAC_BEGINFUNC)
-            {
-                current_func = next_func_id++;
-                func_id.back() = current_func;
-            }
-            else if(cur->op == TAC_ENDFUNC)
-            {
-                current_func = -1;
-            }
-
-            if(cur->op == TAC_LABEL && cur->a)
-            {
-                label_index[cur->a] = static_cast<int>(sequence.size() - 1);
-            }
-        }
-
-        if(sequence.empty()) break;
-
-        std::vector<LoopInfo> loops;
-        std::unordered_set<unsigned long long> seen;
-        loops.reserve(sequence.size());
-
-        for(size_t i = 0; i < sequence.size(); ++i)
-        {
-            TAC *t = sequence[i];
-            if(t->op != TAC_GOTO) continue;
-            SYM *target = t->a;
-            if(target == nullptr) continue;
-            auto it = label_index.find(target);
-            if(it == label_index.end()) continue;
-            int target_idx = it->second;
-            if(target_idx >= static_cast<int>(i)) continue;
-            if(func_id[i] < 0 || func_id[i] != func_id[target_idx]) continue;
-
-            TAC *header = sequence[target_idx];
-            if(header == nullptr || header->op != TAC_LABEL) continue;
-
-            unsigned long long key = (static_cast<unsigned long long>(target_idx) << 32) | static_cast<unsigned long long>(i);
-            if(!seen.insert(key).second) continue;
-
-            LoopInfo info;
-            info.header = header;
-            info.backedge = sequence[i];
-            info.header_index = target_idx;
-            info.back_index = static_cast<int>(i);
-            loops.push_back(info);
-        }
-
+        std::vector<LoopInfo> loops = find_loops();
         if(loops.empty()) break;
 
-        std::sort(loops.begin(), loops.end(), [](const LoopInfo &a, const LoopInfo &b) {
-            if(a.header_index != b.header_index) return a.header_index > b.header_index;
-            return a.back_index > b.back_index;
-        });
-
+        SccpLoopEntry entry = sccp_loop_entry();
+        g_entry = &entry;
         bool iteration_changed = false;
         for(const LoopInfo &loop : loops)
         {
-            if(process_loop(loop))
+            if(process_loop(loop, tables))
             {
                 iteration_changed = true;
             }
         }
+        g_entry = nullptr;
 
         if(!iteration_changed)
         {
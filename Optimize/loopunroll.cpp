@@ -6,7 +6,10 @@
 #include <limits>
 #include <sstream>
 #include "loopunroll.h"
+#include "sccp.h"
 #include "optlog.h"
+#include "analysis.h"
+#include "cfg.h"
 #include "tac.h"
 
 namespace {
@@ -14,12 +17,11 @@ namespace {
 struct LoopInfo {
     TAC *header = nullptr;
     TAC *backedge = nullptr;
-    int header_index = -1;
-    int back_index = -1;
 };
 
-std::vector<std::string> *g_log = nullptr;
-int g_unrolls = 0;
+thread_local std::vector<std::string> *g_log = nullptr;
+thread_local int g_unrolls = 0;
+thread_local const SccpLoopEntry *g_entry = nullptr;
 
 bool log_skip(const char *loop_label, const char *reason)
 {
@@ -75,25 +77,10 @@ SYM *tac_def_symbol(TAC *t)
     }
 }
 
+/* the constant sym holds whenever the loop at header is entered, as sccp found it */
 bool get_constant_value_before(TAC *header, SYM *sym, int &value)
 {
-    if(sym == nullptr) return false;
-    for(TAC *cur = header->prev; cur != nullptr; cur = cur->prev)
-    {
-        if(cur->op == TAC_BEGINFUNC)
-        {
-            break;
-        }
-        SYM *def = tac_def_symbol(cur);
-        if(def != sym) continue;
-        if(cur->op == TAC_COPY && cur->b != nullptr && cur->b->type == SYM_INT)
-        {
-            value = cur->b->value;
-            return true;
-        }
-        return false;
-    }
-    return false;
+    return g_entry != nullptr && sym != nullptr && g_entry->find(header, sym, value);
 }
 
 bool compute_trip_count(int cmp_op, int init, int limit, int step, int &trip_count)
@@ -165,6 +152,7 @@ TAC *clone_tac(TAC *orig)
 void insert_before(TAC *pos, TAC *node)
 {
     if(node == nullptr) return;
+    analysis_invalidate(ANALYSIS_INDEX);
     if(pos == nullptr)
     {
         node->prev = tac_last;
@@ -190,6 +178,7 @@ void remove_tac(TAC *node)
     if(next) next->prev = prev; else tac_last = prev;
     node->prev = nullptr;
     node->next = nullptr;
+    analysis_invalidate(ANALYSIS_INDEX);
 }
 
 bool process_loop(const LoopInfo &loop)
@@ -396,6 +385,7 @@ bool process_loop(const LoopInfo &loop)
     }
 
     // Perform Unrolling
+    analysis_invalidate(ANALYSIS_INDEX);
     if(g_log)
     {
         std::ostringstream oss;
@@ -451,6 +441,26 @@ bool process_loop(const LoopInfo &loop)
     return true;
 }
 
+/* loops that are just the code from a header label to the goto closing them, innermost first */
+std::vector<LoopInfo> find_loops(void)
+{
+    std::vector<LoopInfo> loops;
+    CFG_ALL *all = cfg_build_all();
+    for(CFG_FUNCTION *func = all->funcs; func; func = func->next)
+    {
+        for(CFG_LOOP *loop = func->loop_list; loop; loop = loop->next)
+        {
+            if(loop->backedge == nullptr) continue;
+            LoopInfo info;
+            info.header = loop->header->first;
+            info.backedge = loop->backedge;
+            loops.push_back(info);
+        }
+    }
+    cfg_free_all(all);
+    return loops;
+}
+
 } // namespace
 
 extern "C" void loopunroll_reset(void)
@@ -467,75 +477,11 @@ extern "C" int loopunroll_run(void)
 
     // We only do one pass of unrolling per call to avoid exploding code if we re-detect unrolled loops (though they shouldn't be loops anymore)
     
-    std::vector<TAC*> sequence;
-    std::vector<int> func_id;
-    std::unordered_map<SYM*, int> label_index;
-    
-    // Rebuild sequence info
-    int current_func = -1;
-    int next_func_id = 0;
-    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
+    std::vector<LoopInfo> loops = find_loops();
+    if(!loops.empty())
     {
-        sequence.push_back(cur);
-        func_id.push_back(current_func);
-
-        if(cur->op == TAC_BEGINFUNC)
-        {
-            current_func = next_func_id++;
-            func_id.back() = current_func;
-        }
-        else if(cur->op == TAC_ENDFUNC)
-        {
-            current_func = -1;
-        }
-
-        if(cur->op == TAC_LABEL && cur->a)
-        {
-            label_index[cur->a] = static_cast<int>(sequence.size() - 1);
-        }
-    }
-
-    if(!sequence.empty())
-    {
-        std::vector<LoopInfo> loops;
-        std::unordered_set<unsigned long long> seen;
-
-        for(size_t i = 0; i < sequence.size(); ++i)
-        {
-            TAC *t = sequence[i];
-            if(t->op != TAC_GOTO) continue;
-            SYM *target = t->a;
-            if(target == nullptr) continue;
-            auto it = label_index.find(target);
-            if(it == label_index.end()) continue;
-            int target_idx = it->second;
-            if(target_idx >= static_cast<int>(i)) continue;
-            if(func_id[i] < 0 || func_id[i] != func_id[target_idx]) continue;
-
-            TAC *header = sequence[target_idx];
-            if(header == nullptr || header->op != TAC_LABEL) continue;
-
-            unsigned long long key = (static_cast<unsigned long long>(target_idx) << 32) | static_cast<unsigned long long>(i);
-            if(!seen.insert(key).second) continue;
-
-            LoopInfo info;
-            info.header = header;
-            info.backedge = sequence[i];
-            info.header_index = target_idx;
-            info.back_index = static_cast<int>(i);
-            loops.push_back(info);
-        }
-
-        // Sort loops to process inner loops first?
-        // Actually, unrolling destroys the loop structure.
-        // If we unroll an inner loop, the outer loop just sees a longer body.
-        // If we unroll an outer loop, we duplicate the inner loop.
-        // It's better to unroll inner loops first.
-        std::sort(loops.begin(), loops.end(), [](const LoopInfo &a, const LoopInfo &b) {
-            if(a.header_index != b.header_index) return a.header_index > b.header_index;
-            return a.back_index > b.back_index;
-        });
-
+        SccpLoopEntry entry = sccp_loop_entry();
+        g_entry = &entry;
         for(const LoopInfo &loop : loops)
         {
             // Check if loop is still valid (nodes not removed)
@@ -543,6 +489,7 @@ extern "C" int loopunroll_run(void)
             
             process_loop(loop);
         }
+        g_entry = nullptr;
     }
 
     g_log = nullptr;
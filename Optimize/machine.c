@@ -1,20 +1,154 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "inst.h"
 
 #define REGMAX 16
-#define MEMMAX (256 * 256)
+#define MEMMAX (256 * 256) /* default memory size, -m or a larger program grows it; also the least room above the program */
 #define R_FLAG 0
 #define R_IP 1
 #define FLAG_EZ 0
 #define FLAG_LZ 1
 #define FLAG_GZ 2
 
+/*
+	Dispatch engine, chosen at build time:
+	DISPATCH_THREADED	computed goto, one indirect jump per handler (gcc/clang)
+	otherwise			a switch over the dense handler index
+*/
+#if defined(DISPATCH_THREADED) && !defined(__GNUC__)
+#undef DISPATCH_THREADED
+#endif
+
+/* handler index, opcode */
+#define KIND_LIST \
+	X(END, I_END) \
+	X(NOP, I_NOP) \
+	X(OTC, I_OTC) \
+	X(OTI, I_OTI) \
+	X(OTS, I_OTS) \
+	X(ITC, I_ITC) \
+	X(ITI, I_ITI) \
+	X(ADD_0, I_ADD_0) \
+	X(ADD_1, I_ADD_1) \
+	X(SUB_0, I_SUB_0) \
+	X(SUB_1, I_SUB_1) \
+	X(MUL_0, I_MUL_0) \
+	X(MUL_1, I_MUL_1) \
+	X(DIV_0, I_DIV_0) \
+	X(DIV_1, I_DIV_1) \
+	X(LOD_0, I_LOD_0) \
+	X(LOD_1, I_LOD_1) \
+	X(LOD_2, I_LOD_2) \
+	X(LOD_3, I_LOD_3) \
+	X(LDC_3, I_LDC_3) \
+	X(LOD_4, I_LOD_4) \
+	X(LDC_4, I_LDC_4) \
+	X(LOD_5, I_LOD_5) \
+	X(LDC_5, I_LDC_5) \
+	X(STO_0, I_STO_0) \
+	X(STC_0, I_STC_0) \
+	X(STO_1, I_STO_1) \
+	X(STC_1, I_STC_1) \
+	X(STO_2, I_STO_2) \
+	X(STC_2, I_STC_2) \
+	X(STO_3, I_STO_3) \
+	X(STC_3, I_STC_3) \
+	X(TST_0, I_TST_0) \
+	X(JMP_0, I_JMP_0) \
+	X(JMP_1, I_JMP_1) \
+	X(JEZ_0, I_JEZ_0) \
+	X(JEZ_1, I_JEZ_1) \
+	X(JLZ_0, I_JLZ_0) \
+	X(JLZ_1, I_JLZ_1) \
+	X(JGZ_0, I_JGZ_0) \
+	X(JGZ_1, I_JGZ_1)
+
+/*
+	Superinstructions, handler index and report name. The head slot of a
+	recognised sequence gets the fused handler, the following slots keep
+	their own decoding so jumps into the middle still work.
+*/
+#define FUSE_LIST \
+	F(TST_JEZ, "TST; JEZ") \
+	F(LOD_TST_JEZ, "LOD (R+n); TST; JEZ") \
+	F(STO_TST_JEZ, "STO (R+n); TST; JEZ") \
+	F(TST_LOD_JCC, "TST; LOD R,R1+n; Jcc R") \
+	F(LOD_ADD_STO, "LOD (R+n); ADD; STO (R+n)")
+
+enum kind
+{
+#define X(name, opcode) K_##name,
+	KIND_LIST
+#undef X
+	K_INVALID,
+#define F(name, text) K_##name,
+	FUSE_LIST
+#undef F
+	K_COUNT
+};
+
+#define K_FUSED_FIRST (K_INVALID + 1)
+
+/* predecoded instruction, one per 8-byte slot of mem[] */
+struct decoded
+{
+	int kind; /* handler index, may be a superinstruction */
+	int base; /* handler index of this slot alone */
+	int op; /* raw opcode, kept for error messages */
+	int rx, ry, constant;
+};
+
 int reg[REGMAX]; /* registers */
-unsigned char mem[MEMMAX]; /* memory */
+unsigned char *mem; /* memory, memmax bytes */
+struct decoded *code; /* predecoded loaded image, codemax slots */
+int memmax=MEMMAX, codemax;
+int loaded; /* bytes of mem[] that came from the object file */
 int op, rx, ry, constant; /* opcode, register1, register2, immediate constant */
 int cycle, mem_r, mem_w, mul_div;
+int fused[K_COUNT - K_FUSED_FIRST]; /* how often each superinstruction ran */
+#define FIRED(name) fused[K_##name - K_FUSED_FIRST]++
+int fusion_report, cache_report; /* -f, -t */
+
+/*
+	Translation cache. A block is the straight-line run of instructions
+	from an address up to the first jump, END or write to R1, translated
+	once into micro-ops with the counter totals precomputed. A
+	superinstruction becomes one micro-op for its whole sequence. Blocks
+	are keyed by start address, so a jump into the middle of a block
+	simply gets a block of its own.
+*/
+#define BLOCKMAX 64
+
+/* micro-op kinds beyond the handler indices */
+#define K_SETIP K_COUNT /* load R1 with addr */
+#define K_EXIT (K_COUNT + 1) /* fall through to addr + 8 */
+#define K_EXIT_IP (K_COUNT + 2) /* the last instruction wrote R1, continue there */
+#define UOP_COUNT (K_COUNT + 3)
+
+struct uop
+{
+	int kind, rx, ry, constant;
+	struct decoded *d; /* first slot, a superinstruction reads the rest from d[1] and d[2] */
+	int addr; /* address of the instruction, the last one of a superinstruction */
+	int insts, cycle, mem_r, mem_w, mul_div; /* block totals up to and including this uop */
+};
+
+struct block
+{
+	struct uop *uop, *last; /* last real instruction holds the block totals */
+	int exit[2]; /* last two exits taken and the blocks there */
+	struct block *link[2];
+};
+
+struct block **tcache; /* by start slot */
+unsigned char *covered; /* slot belongs to a translated block */
+int tc_off; /* -i given, or a store hit translated code */
+int tc_blocks, tc_runs, tc_insts; /* statistics */
 
 // get instruction from addr
 void instruction(int addr)
@@ -25,67 +159,710 @@ void instruction(int addr)
 	constant = *(int*)&(mem[addr+4]); // 32 bit
 }
 
-int main(int argc, char *argv[])
+int kind_of(int op)
+{
+	switch(op)
+	{
+#define X(name, opcode) case opcode: return K_##name;
+		KIND_LIST
+#undef X
+		default: return K_INVALID;
+	}
+}
+
+void decode(struct decoded *d, int addr)
+{
+	instruction(addr);
+	d->kind=d->base=kind_of(op);
+	d->op=op;
+	d->rx=rx;
+	d->ry=ry;
+	d->constant=constant;
+}
+
+#define TEST(r) \
+	do { \
+		t=reg[r]; \
+		if(t==0) reg[R_FLAG]=FLAG_EZ; \
+		else if(t<0) reg[R_FLAG]=FLAG_LZ; \
+		else if(t>0) reg[R_FLAG]=FLAG_GZ; \
+	} while(0)
+
+int is_cond_jump_reg(int kind)
+{
+	return kind == K_JEZ_1 || kind == K_JLZ_1 || kind == K_JGZ_1;
+}
+
+/* flag a conditional jump through a register waits for */
+int cond_flag(int kind)
+{
+	switch(kind)
+	{
+		case K_JEZ_1: return FLAG_EZ;
+		case K_JLZ_1: return FLAG_LZ;
+		default: return FLAG_GZ;
+	}
+}
+
+/* pick the superinstruction starting at slot i, if any */
+void fuse(int i)
+{
+	struct decoded *d=&code[i], *n1, *n2;
+
+	d->kind=d->base;
+	if( i + 2 >= codemax ) return;
+	n1=&code[i + 1];
+	n2=&code[i + 2];
+
+	switch(d->base)
+	{
+		case K_TST_0:
+		if( n1->base == K_JEZ_0 )
+			d->kind=K_TST_JEZ;
+		else if( n1->base == K_LOD_2 && n1->ry == R_IP && n1->rx != R_IP
+			&& is_cond_jump_reg(n2->base) && n2->rx == n1->rx )
+			d->kind=K_TST_LOD_JCC;
+		break;
+
+		case K_LOD_5:
+		if( d->rx == R_IP ) break;
+		if( n1->base == K_TST_0 && n1->rx == d->rx && n2->base == K_JEZ_0 )
+			d->kind=K_LOD_TST_JEZ;
+		else if( n1->base == K_ADD_1 && n1->rx != R_IP && n2->base == K_STO_3 )
+			d->kind=K_LOD_ADD_STO;
+		break;
+
+		case K_STO_3:
+		if( n1->base == K_TST_0 && n2->base == K_JEZ_0 )
+			d->kind=K_STO_TST_JEZ;
+		break;
+	}
+}
+
+/*
+	Only the loaded image is predecoded, an ip past it is decoded on the
+	fly, so stores to the stack and heap above it never touch code[].
+*/
+void predecode(void)
+{
+	int i;
+	for( i=0; i < codemax; i++ )
+		decode(&code[i], i * 8);
+	for( i=0; i < codemax; i++ )
+		fuse(i);
+}
+
+/* a store may overwrite code, decode the touched slots again */
+void code_touch(int addr, int len)
+{
+	int first=addr >> 3, last=(addr + len - 1) >> 3, i;
+
+	if( (unsigned)first >= (unsigned)codemax ) return;
+	if( last >= codemax ) last=codemax - 1;
+	for( i=first; i <= last; i++ )
+	{
+		decode(&code[i], i * 8);
+		if( covered[i] ) tc_off=1; /* self-modifying code, interpret from now on */
+	}
+
+	/* sequences that started up to two slots earlier may have changed too */
+	for( i=(first >= 2 ? first - 2 : 0); i <= last; i++ )
+		fuse(i);
+}
+
+void report(void)
+{
+	printf("\n");
+	printf("------------------------------\n");
+	printf("CLOCK CYCLES : %d\n", cycle);
+	printf("MUL DIV : %d\n", mul_div);
+	printf("MEM READ : %d\n", mem_r);
+	printf("MEM WRITE : %d\n", mem_w);
+	printf("------------------------------\n");
+}
+
+void report_fusion(void)
+{
+	static const char *name[]=
+	{
+#define F(name, text) text,
+		FUSE_LIST
+#undef F
+	};
+	int i;
+
+	printf("SUPERINSTRUCTIONS\n");
+	for( i=0; i < K_COUNT - K_FUSED_FIRST; i++ )
+		printf("%s : %d\n", name[i], fused[i]);
+	printf("------------------------------\n");
+}
+
+void report_cache(void)
 {
-	if(argc!=2) {
-		fprintf(stderr, "usage: %s filename\n", argv[0]);
-		exit(0);		
+	printf("TRANSLATION CACHE\n");
+	printf("BLOCKS : %d\n", tc_blocks);
+	printf("BLOCK RUNS : %d\n", tc_runs);
+	printf("INSTRUCTIONS IN BLOCKS : %d\n", tc_insts);
+	printf("INTERPRETED : %s\n", tc_off ? "yes" : "no");
+	printf("------------------------------\n");
+}
+
+void halt(void)
+{
+	report();
+	if(fusion_report) report_fusion();
+	if(cache_report) report_cache();
+	exit(0);
+}
+
+int writes_ip(struct decoded *d)
+{
+	switch(d->base)
+	{
+		case K_ADD_0: case K_ADD_1: case K_SUB_0: case K_SUB_1:
+		case K_MUL_0: case K_MUL_1: case K_DIV_0: case K_DIV_1:
+		case K_LOD_0: case K_LOD_1: case K_LOD_2: case K_LOD_3: case K_LDC_3:
+		case K_LOD_4: case K_LDC_4: case K_LOD_5: case K_LDC_5:
+		return d->rx == R_IP;
+		default:
+		return 0;
+	}
+}
+
+int ends_block(struct decoded *d)
+{
+	switch(d->base)
+	{
+		case K_END:
+		case K_JMP_0: case K_JMP_1:
+		case K_JEZ_0: case K_JEZ_1:
+		case K_JLZ_0: case K_JLZ_1:
+		case K_JGZ_0: case K_JGZ_1:
+		return 1;
+		default:
+		return writes_ip(d);
+	}
+}
+
+int uses_ip(struct decoded *d)
+{
+	return d->rx == R_IP || d->ry == R_IP;
+}
+
+/*
+	Slots the superinstruction at d takes as one micro-op, 1 to run it
+	unfused. A block only keeps R1 for single instructions, so sequences
+	that read it are left alone, except the R1-relative LOD of
+	TST_LOD_JCC which the micro-op works out from its address. STO_TST_JEZ
+	stays split: its store comes first and a store into the block must be
+	able to stop right after it, and the TST; JEZ behind it fuses anyway.
+*/
+int block_fusion(struct decoded *d)
+{
+	switch(d->kind)
+	{
+		case K_TST_JEZ:
+		return uses_ip(&d[0]) || uses_ip(&d[1]) ? 1 : 2;
+
+		case K_LOD_TST_JEZ:
+		case K_LOD_ADD_STO:
+		return uses_ip(&d[0]) || uses_ip(&d[1]) || uses_ip(&d[2]) ? 1 : 3;
+
+		case K_TST_LOD_JCC:
+		return uses_ip(&d[0]) ? 1 : 3;
+
+		default:
+		return 1;
+	}
+}
+
+/* translate the block starting at slot s, NULL if it cannot start there */
+struct block *translate(int s)
+{
+	struct uop buf[BLOCKMAX * 2 + 1], *u;
+	struct decoded *d, *tail=NULL;
+	struct block *b;
+	int n=0, i=0, c=0, r=0, w=0, m=0, len, k;
+
+	for( ; s < codemax && i < BLOCKMAX; s += len )
+	{
+		d=&code[s];
+		if( d->base == K_INVALID ) break;
+		len=block_fusion(d);
+		if( i + len > BLOCKMAX ) len=1;
+
+		for( k=0; k < len; k++ )
+		{
+			switch(d[k].base)
+			{
+				case K_MUL_0: case K_MUL_1: case K_DIV_0: case K_DIV_1:
+				c += 4; m++;
+				break;
+
+				case K_LOD_3: case K_LDC_3: case K_LOD_4: case K_LDC_4: case K_LOD_5: case K_LDC_5:
+				c += 9; r++;
+				break;
+
+				case K_STO_0: case K_STC_0: case K_STO_1: case K_STC_1:
+				case K_STO_2: case K_STC_2: case K_STO_3: case K_STC_3:
+				c += 9; w++;
+				break;
+			}
+			c++;
+			i++;
+		}
+
+		/* R1 is only kept up to date for instructions that use it */
+		if( len == 1 && uses_ip(d) )
+		{
+			u=&buf[n++];
+			u->kind=K_SETIP;
+			u->d=d;
+			u->addr=s * 8;
+		}
+
+		u=&buf[n++];
+		u->kind=len == 1 ? d->base : d->kind;
+		u->rx=d->rx;
+		u->ry=d->ry;
+		u->constant=d->constant;
+		u->d=d;
+		u->addr=(s + len - 1) * 8;
+		u->insts=i;
+		u->cycle=c;
+		u->mem_r=r;
+		u->mem_w=w;
+		u->mul_div=m;
+
+		tail=&d[len - 1];
+		if( ends_block(tail) ) break;
 	}
+	if( tail == NULL ) return NULL;
 
-	FILE * input=fopen( argv[1], "rb" );
-	if( input ==  NULL )
+	/* a block that does not end in a jump continues after its last instruction */
+	if( !ends_block(tail) || writes_ip(tail) )
 	{
-		fprintf(stderr, "error: open %s failed\n", argv[1] );
+		u=&buf[n++];
+		u->kind=writes_ip(tail) ? K_EXIT_IP : K_EXIT;
+		u->addr=buf[n - 2].addr;
+	}
+
+	b=(struct block *)malloc(sizeof(struct block));
+	if( b != NULL ) b->uop=(struct uop *)malloc(n * sizeof(struct uop));
+	if( b == NULL || b->uop == NULL )
+	{
+		fprintf(stderr, "error: out of memory\n");
 		exit(0);
 	}
+	memcpy(b->uop, buf, n * sizeof(struct uop));
+	b->last=&b->uop[n - 1];
+	while( b->last->kind >= K_SETIP ) b->last--;
+	b->exit[0]=b->exit[1]=-1;
+	b->link[0]=b->link[1]=NULL;
+	for( u=b->uop; u <= b->last; u++ )
+		for( k=u->addr >> 3; k >= 0 && &code[k] >= u->d; k-- )
+			covered[k]=1;
+
+	tc_blocks++;
+	return b;
+}
+
+struct block *tc_lookup(int ip)
+{
+	int s;
+
+	s=ip >> 3;
+	if( tc_off || (ip & 7) != 0 || (unsigned)s >= (unsigned)codemax ) return NULL;
+	if( tcache[s] == NULL ) tcache[s]=translate(s);
+	return tcache[s];
+}
+
+/* the block to run after b left for ip */
+struct block *tc_next(struct block *b, int ip)
+{
+	if( b->exit[0] == ip ) return b->link[0];
+	if( b->exit[1] == ip ) return b->link[1];
+	if( tc_off ) return NULL;
+	b->exit[1]=b->exit[0];
+	b->link[1]=b->link[0];
+	b->exit[0]=ip;
+	b->link[0]=tc_lookup(ip);
+	return b->link[0];
+}
 
-	int i, ch, t, t1, t2;
+/* run one block, return the address to continue at */
+int run_block(struct block *b)
+{
+	struct uop *u=b->uop, *last=b->last;
+	int t, a;
+
+	/* apply the whole block up front, a store into code gives back the rest */
+	cycle += last->cycle;
+	mem_r += last->mem_r;
+	mem_w += last->mem_w;
+	mul_div += last->mul_div;
+	tc_runs++;
+	tc_insts += last->insts;
+
+#define STORE_DONE(len) \
+	do { \
+		code_touch(a, len); \
+		if( tc_off ) \
+		{ \
+			cycle -= last->cycle - u->cycle; \
+			mem_r -= last->mem_r - u->mem_r; \
+			mem_w -= last->mem_w - u->mem_w; \
+			mul_div -= last->mul_div - u->mul_div; \
+			tc_insts -= last->insts - u->insts; \
+			return u->addr + 8; \
+		} \
+	} while(0)
+
+#ifdef DISPATCH_THREADED
+	static void *handler[UOP_COUNT]=
+	{
+#define X(name, opcode) [K_##name]=&&B_##name,
+		KIND_LIST
+#undef X
+		[K_TST_JEZ]=&&B_TST_JEZ,
+		[K_LOD_TST_JEZ]=&&B_LOD_TST_JEZ,
+		[K_TST_LOD_JCC]=&&B_TST_LOD_JCC,
+		[K_LOD_ADD_STO]=&&B_LOD_ADD_STO,
+		[K_SETIP]=&&B_SETIP,
+		[K_EXIT]=&&B_EXIT,
+		[K_EXIT_IP]=&&B_EXIT_IP,
+	};
+
+#define UCASE(name) B_##name:
+#define UNEXT do { u++; goto *handler[u->kind]; } while(0)
+	goto *handler[u->kind];
+#else
+#define UCASE(name) case K_##name:
+#define UNEXT break
+	for( ; ; u++ ) switch(u->kind)
+#endif
+	{
+		UCASE(SETIP)
+		reg[R_IP]=u->addr;
+		UNEXT;
+
+		UCASE(EXIT)
+		return u->addr + 8;
+
+		UCASE(EXIT_IP)
+		return reg[R_IP] + 8;
+
+		UCASE(END)
+		halt();
+
+		UCASE(NOP)
+		UNEXT;
+
+		UCASE(OTC)
+		printf( "%c", reg[15] );
+		UNEXT;
+
+		UCASE(OTI)
+		printf( "%d", reg[15] );
+		UNEXT;
+
+		UCASE(OTS)
+		printf( "%s", &mem[reg[15]] );
+		UNEXT;
+
+		UCASE(ITC)
+		reg[15] = ' ';
+		while(reg[15]==' ' || reg[15]=='\t' || reg[15]=='\r' || reg[15]=='\n')
+		{
+			if(scanf("%c", (char*)&reg[15]) != 1)
+			{
+				if(getchar() == EOF) break;
+			}
+
+		}
+		UNEXT;
+
+		UCASE(ITI)
+		reg[15] = 0;
+		while(scanf("%d", &reg[15]) != 1)
+		{
+			if(getchar() == EOF) break;
+		}
+		UNEXT;
+
+		UCASE(ADD_0) reg[u->rx]=reg[u->rx] + u->constant; UNEXT;
+		UCASE(ADD_1) reg[u->rx]=reg[u->rx] + reg[u->ry]; UNEXT;
+		UCASE(SUB_0) reg[u->rx]=reg[u->rx] - u->constant; UNEXT;
+		UCASE(SUB_1) reg[u->rx]=reg[u->rx] - reg[u->ry]; UNEXT;
+		UCASE(MUL_0) reg[u->rx]=reg[u->rx] * u->constant; UNEXT;
+		UCASE(MUL_1) reg[u->rx]=reg[u->rx] * reg[u->ry]; UNEXT;
+
+		UCASE(DIV_0)
+		if( u->constant == 0 )
+		{
+			fprintf(stderr, "error: divide by zero\n");
+			exit(0);
+		}
+		reg[u->rx]=reg[u->rx] / u->constant;
+		UNEXT;
+
+		UCASE(DIV_1)
+		if( reg[u->ry] == 0 )
+		{
+			fprintf(stderr, "error: divide by zero\n");
+			exit(0);
+		}
+		reg[u->rx]=reg[u->rx] / reg[u->ry];
+		UNEXT;
+
+		UCASE(LOD_0) reg[u->rx]=u->constant; UNEXT;
+		UCASE(LOD_1) reg[u->rx]=reg[u->ry]; UNEXT;
+		UCASE(LOD_2) reg[u->rx]=reg[u->ry] + u->constant; UNEXT;
+		UCASE(LOD_3) reg[u->rx] = *(int*)&(mem[u->constant]); UNEXT;
+		UCASE(LDC_3) reg[u->rx] = mem[u->constant]; UNEXT;
+		UCASE(LOD_4) reg[u->rx] = *(int*)&(mem[reg[u->ry]]); UNEXT;
+		UCASE(LDC_4) reg[u->rx] = mem[reg[u->ry]]; UNEXT;
+		UCASE(LOD_5) reg[u->rx] = *(int*)&(mem[reg[u->ry] + u->constant]); UNEXT;
+		UCASE(LDC_5) reg[u->rx] = mem[reg[u->ry] + u->constant]; UNEXT;
+
+		UCASE(STO_0) a=reg[u->rx]; *(int*)&(mem[a]) = u->constant; STORE_DONE(4); UNEXT;
+		UCASE(STC_0) a=reg[u->rx]; mem[a] = u->constant; STORE_DONE(1); UNEXT;
+		UCASE(STO_1) a=reg[u->rx]; *(int*)&(mem[a]) = reg[u->ry]; STORE_DONE(4); UNEXT;
+		UCASE(STC_1) a=reg[u->rx]; mem[a] = reg[u->ry]; STORE_DONE(1); UNEXT;
+		UCASE(STO_2) a=reg[u->rx]; *(int*)&(mem[a]) = reg[u->ry]+u->constant; STORE_DONE(4); UNEXT;
+		UCASE(STC_2) a=reg[u->rx]; mem[a] = reg[u->ry]+u->constant; STORE_DONE(1); UNEXT;
+		UCASE(STO_3) a=reg[u->rx] + u->constant; *(int*)&(mem[a]) = reg[u->ry]; STORE_DONE(4); UNEXT;
+		UCASE(STC_3) a=reg[u->rx] + u->constant; mem[a] = reg[u->ry]; STORE_DONE(1); UNEXT;
+
+		UCASE(TST_0)
+		TEST(u->rx);
+		UNEXT;
+
+		UCASE(JMP_0) return u->constant;
+		UCASE(JMP_1) return reg[u->rx];
+		UCASE(JEZ_0) return reg[R_FLAG]==FLAG_EZ ? u->constant : u->addr + 8;
+		UCASE(JEZ_1) return reg[R_FLAG]==FLAG_EZ ? reg[u->rx] : u->addr + 8;
+		UCASE(JLZ_0) return reg[R_FLAG]==FLAG_LZ ? u->constant : u->addr + 8;
+		UCASE(JLZ_1) return reg[R_FLAG]==FLAG_LZ ? reg[u->rx] : u->addr + 8;
+		UCASE(JGZ_0) return reg[R_FLAG]==FLAG_GZ ? u->constant : u->addr + 8;
+		UCASE(JGZ_1) return reg[R_FLAG]==FLAG_GZ ? reg[u->rx] : u->addr + 8;
+
+		/* superinstructions, the counters are already in the block totals */
+		UCASE(TST_JEZ)
+		FIRED(TST_JEZ);
+		TEST(u->rx);
+		return reg[R_FLAG]==FLAG_EZ ? u->d[1].constant : u->addr + 8;
+
+		UCASE(LOD_TST_JEZ)
+		FIRED(LOD_TST_JEZ);
+		reg[u->rx] = *(int*)&(mem[reg[u->ry] + u->constant]);
+		TEST(u->d[1].rx);
+		return reg[R_FLAG]==FLAG_EZ ? u->d[2].constant : u->addr + 8;
+
+		UCASE(TST_LOD_JCC)
+		FIRED(TST_LOD_JCC);
+		TEST(u->rx);
+		reg[u->d[1].rx]=u->addr - 8 + u->d[1].constant; /* R1 as the LOD saw it */
+		return reg[R_FLAG]==cond_flag(u->d[2].base) ? reg[u->d[2].rx] : u->addr + 8;
+
+		UCASE(LOD_ADD_STO)
+		FIRED(LOD_ADD_STO);
+		reg[u->rx] = *(int*)&(mem[reg[u->ry] + u->constant]);
+		reg[u->d[1].rx]=reg[u->d[1].rx] + reg[u->d[1].ry];
+		a=reg[u->d[2].rx] + u->d[2].constant;
+		*(int*)&(mem[a]) = reg[u->d[2].ry];
+		STORE_DONE(4);
+		UNEXT;
+	}
+#undef UCASE
+#undef UNEXT
+#undef STORE_DONE
+	return reg[R_IP];
+}
+
+/* zero-filled anonymous memory, released only at exit */
+void *zalloc(size_t size)
+{
+	void *p=mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if( p == MAP_FAILED )
+	{
+		fprintf(stderr, "error: out of memory\n");
+		exit(0);
+	}
+	return p;
+}
+
+/*
+	Map the object file copy-on-write over the start of a zeroed memory
+	image, the rest of memory stays untouched until the program uses it.
+	Pipes and other files that cannot be mapped are read in one go.
+*/
+void load(char *path)
+{
+	struct stat st;
+	ssize_t n;
+	size_t page=sysconf(_SC_PAGESIZE);
+	int fd;
+
+	fd=open(path, O_RDONLY);
+	if( fd < 0 || fstat(fd, &st) < 0 )
+	{
+		fprintf(stderr, "error: open %s failed\n", path );
+		exit(0);
+	}
+
+	/* the stack starts at the end of the static data and grows up, so always leave MEMMAX above the program */
+	if( S_ISREG(st.st_mode) && st.st_size > memmax - MEMMAX )
+	{
+		if( st.st_size > 0x7ffffff8 - MEMMAX )
+		{
+			fprintf(stderr, "error: %s too large\n", path);
+			exit(0);
+		}
+		memmax=(int)st.st_size + MEMMAX;
+	}
+	memmax=(memmax + 7) & ~7;
+
+	/* whole pages, with slack for decoding an unaligned ip at the very end */
+	mem=(unsigned char *)zalloc((memmax + 8 + page - 1) / page * page);
+
+	if( S_ISREG(st.st_mode) && st.st_size > 0
+		&& mmap(mem, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED )
+	{
+		loaded=(int)st.st_size;
+	}
+	else
+	{
+		while( loaded < memmax && (n=read(fd, mem + loaded, memmax - loaded)) > 0 )
+			loaded += n;
+		if( loaded == memmax && read(fd, &n, 1) > 0 )
+		{
+			fprintf(stderr, "error: %s does not fit in %d bytes, use -m\n", path, memmax);
+			exit(0);
+		}
+	}
+	close(fd);
+
+	/* the code high-water mark, one spare slot keeps an empty image mappable */
+	codemax=(loaded + 7) / 8;
+	code=(struct decoded *)zalloc((codemax + 1) * sizeof(struct decoded));
+	tcache=(struct block **)zalloc((codemax + 1) * sizeof(struct block *));
+	covered=(unsigned char *)zalloc(codemax + 1);
+}
+
+/* memory size for -m, bytes with an optional K or M suffix */
+int mem_size(char *arg)
+{
+	char *end;
+	long n=strtol(arg, &end, 0);
+
+	if( *end == 'K' || *end == 'k' ) n *= 1024, end++;
+	else if( *end == 'M' || *end == 'm' ) n *= 1024 * 1024, end++;
+	if( *end != 0 || n < MEMMAX || n > 0x7ffffff8 )
+	{
+		fprintf(stderr, "error: bad memory size %s, at least %d bytes\n", arg, MEMMAX);
+		exit(0);
+	}
+	return (int)n;
+}
+
+int main(int argc, char *argv[])
+{
+	char *path=NULL;
+	int i, t, a;
+	struct decoded *d, slow;
+	struct block *b;
+
+	for( i=1; i < argc; i++ )
+	{
+		if( !strcmp(argv[i], "-f") ) fusion_report=1;
+		else if( !strcmp(argv[i], "-t") ) cache_report=1;
+		else if( !strcmp(argv[i], "-i") ) tc_off=1;
+		else if( !strcmp(argv[i], "-m") && i + 1 < argc ) memmax=mem_size(argv[++i]);
+		else if( path == NULL ) path=argv[i];
+		else path=NULL, i=argc;
+	}
+	if(path==NULL) {
+		fprintf(stderr, "usage: %s [-f] [-t] [-i] [-m size] filename\n", argv[0]);
+		exit(0);
+	}
 
 	/* init reg */
-	for( i=0; i < REGMAX; i++ ) 
+	for( i=0; i < REGMAX; i++ )
 		reg[i]=0;
 
 	/* init mem */
-	for( i=0; (ch=fgetc(input)) != EOF; i++ ) 
-		mem[i]=(char)ch;
-	for( ; i < MEMMAX; i++ ) 
-		mem[i]=0;
+	load(path);
+	predecode();
+
+/* aligned ips in the image use the predecoded slot, anything else is decoded on the fly */
+#define FETCH() \
+	do { \
+		if( (reg[R_IP] & 7) == 0 && (unsigned)(reg[R_IP] >> 3) < (unsigned)codemax ) d=&code[reg[R_IP] >> 3]; \
+		else { decode(&slow, reg[R_IP]); d=&slow; } \
+	} while(0)
+
+#ifdef DISPATCH_THREADED
+	static void *handler[K_COUNT]=
+	{
+#define X(name, opcode) &&L_##name,
+		KIND_LIST
+#undef X
+		&&L_INVALID,
+#define F(name, text) &&L_##name,
+		FUSE_LIST
+#undef F
+	};
+
+#define CASE(name) L_##name:
+#define DISPATCH() do { cycle++; FETCH(); goto *handler[d->kind]; } while(0)
+#define NEXT do { reg[R_IP]=reg[R_IP]+8; DISPATCH(); } while(0)
+#else
+#define CASE(name) case K_##name:
+#define NEXT break
+#endif
+/* every taken jump goes back through the translation cache */
+#define JUMP goto block
+
+/* a store inside a superinstruction hit the slots still to run, finish one at a time */
+#define STORE_HITS(a, len, lo, hi) ((a) < (hi) && (a) + (len) > (lo))
 
 	/* run machine */
 	cycle = mem_r = mem_w = 0;
+block:
+	for( b=tc_lookup(reg[R_IP]); b != NULL && !tc_off; b=tc_next(b, reg[R_IP]) )
+		reg[R_IP]=run_block(b);
+#ifdef DISPATCH_THREADED
+	DISPATCH();
+#else
 	for(;;)
 	{
 		cycle++;
-		instruction(reg[R_IP]);
-		
-		switch(op)
+		FETCH();
+
+		switch(d->kind)
 		{
-			case I_END:
-			printf("\n");
-			printf("------------------------------\n");
-			printf("CLOCK CYCLES : %d\n", cycle);
-			printf("MUL DIV : %d\n", mul_div);
-			printf("MEM READ : %d\n", mem_r);
-			printf("MEM WRITE : %d\n", mem_w);
-			printf("------------------------------\n");
-			exit(0);
+#endif
+			CASE(END)
+			halt();
 
-			case I_NOP:
-			break;
+			CASE(NOP)
+			NEXT;
 
-			case I_OTC:
+			CASE(OTC)
 			printf( "%c", reg[15] ); /* Print out reg[15] in ASCII */
-			break;
+			NEXT;
 
-			case I_OTI:
+			CASE(OTI)
 			printf( "%d", reg[15] ); /* Print int in reg[15] */
-			break;
+			NEXT;
 
-			case I_OTS:
+			CASE(OTS)
 			printf( "%s", &mem[reg[15]] ); /* Print string pointed by reg[15] */
-			break;
+			NEXT;
 
-			case I_ITC:
+			CASE(ITC)
 			/* Input char to reg[15] */
 			reg[15] = ' ';
 			while(reg[15]==' ' || reg[15]=='\t' || reg[15]=='\r' || reg[15]=='\n')
@@ -96,217 +873,296 @@ int main(int argc, char *argv[])
 				}
 
 			}
-			break;
+			NEXT;
 
-			case I_ITI:
+			CASE(ITI)
 			/* Input int to reg[15] */
 			reg[15] = 0;
 			while(scanf("%d", &reg[15]) != 1)
 			{
 				if(getchar() == EOF) break;
 			}
-			break;
+			NEXT;
 
-			case I_ADD_0:
-			reg[rx]=reg[rx] + constant;
-			break;
+			CASE(ADD_0)
+			reg[d->rx]=reg[d->rx] + d->constant;
+			NEXT;
 
-			case I_ADD_1:
-			reg[rx]=reg[rx] + reg[ry];
-			break;
+			CASE(ADD_1)
+			reg[d->rx]=reg[d->rx] + reg[d->ry];
+			NEXT;
 
-			case I_SUB_0:
-			reg[rx]=reg[rx] - constant;
-			break;
+			CASE(SUB_0)
+			reg[d->rx]=reg[d->rx] - d->constant;
+			NEXT;
 
-			case I_SUB_1:
-			reg[rx]=reg[rx] - reg[ry];
-			break;
+			CASE(SUB_1)
+			reg[d->rx]=reg[d->rx] - reg[d->ry];
+			NEXT;
 
-			case I_MUL_0:
+			CASE(MUL_0)
 			cycle += 4;
 			mul_div++;
-			reg[rx]=reg[rx] * constant;
-			break;
+			reg[d->rx]=reg[d->rx] * d->constant;
+			NEXT;
 
-			case I_MUL_1:
+			CASE(MUL_1)
 			cycle += 4;
 			mul_div++;
-			reg[rx]=reg[rx] * reg[ry];
-			break;
+			reg[d->rx]=reg[d->rx] * reg[d->ry];
+			NEXT;
 
-			case I_DIV_0:
+			CASE(DIV_0)
 			cycle += 4;
 			mul_div++;
-			if( constant == 0 ) 
+			if( d->constant == 0 )
 			{
 				fprintf(stderr, "error: divide by zero\n");
 				exit(0);
-			} 
-			else 
+			}
+			else
 			{
-				reg[rx]=reg[rx] / constant;
-			}			
-			break;
+				reg[d->rx]=reg[d->rx] / d->constant;
+			}
+			NEXT;
 
-			case I_DIV_1:
+			CASE(DIV_1)
 			cycle += 4;
 			mul_div++;
-			if( reg[ry] == 0 ) 
+			if( reg[d->ry] == 0 )
 			{
 				fprintf(stderr, "error: divide by zero\n");
 				exit(0);
-			} 
-			else 
+			}
+			else
 			{
-				reg[rx]=reg[rx] / reg[ry];
-			}			
-			break;
+				reg[d->rx]=reg[d->rx] / reg[d->ry];
+			}
+			NEXT;
 
-			case I_LOD_0:
-			reg[rx]=constant;
-			break;
+			CASE(LOD_0)
+			reg[d->rx]=d->constant;
+			NEXT;
 
-			case I_LOD_1:
-			reg[rx]=reg[ry];
-			break;
+			CASE(LOD_1)
+			reg[d->rx]=reg[d->ry];
+			NEXT;
 
-			case I_LOD_2:
-			reg[rx]=reg[ry] + constant;
-			break;
+			CASE(LOD_2)
+			reg[d->rx]=reg[d->ry] + d->constant;
+			NEXT;
 
-			case I_LOD_3:
+			CASE(LOD_3)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = *(int*)&(mem[constant]);
-			break;
+			reg[d->rx] = *(int*)&(mem[d->constant]);
+			NEXT;
 
-			case I_LDC_3:
+			CASE(LDC_3)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = mem[constant];
-			break;
+			reg[d->rx] = mem[d->constant];
+			NEXT;
 
-			case I_LOD_4:
+			CASE(LOD_4)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = *(int*)&(mem[reg[ry]]);
-			break;
+			reg[d->rx] = *(int*)&(mem[reg[d->ry]]);
+			NEXT;
 
-			case I_LDC_4:
+			CASE(LDC_4)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = mem[reg[ry]];
-			break;
+			reg[d->rx] = mem[reg[d->ry]];
+			NEXT;
 
-			case I_LOD_5:
+			CASE(LOD_5)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = *(int*)&(mem[reg[ry] + constant]);
-			break;
+			reg[d->rx] = *(int*)&(mem[reg[d->ry] + d->constant]);
+			NEXT;
 
-			case I_LDC_5:
+			CASE(LDC_5)
 			cycle += 9;
 			mem_r++;
-			reg[rx] = mem[reg[ry] + constant];
-			break;
+			reg[d->rx] = mem[reg[d->ry] + d->constant];
+			NEXT;
 
-			case I_STO_0:
+			CASE(STO_0)
 			cycle += 9;
 			mem_w++;
-			*(int*)&(mem[reg[rx]]) = constant;
-			break;
+			a = reg[d->rx];
+			*(int*)&(mem[a]) = d->constant;
+			code_touch(a, 4);
+			NEXT;
 
-			case I_STC_0:
+			CASE(STC_0)
 			cycle += 9;
 			mem_w++;
-			mem[reg[rx]] = constant;
-			break;
+			a = reg[d->rx];
+			mem[a] = d->constant;
+			code_touch(a, 1);
+			NEXT;
 
-			case I_STO_1:
+			CASE(STO_1)
 			cycle += 9;
 			mem_w++;
-			*(int*)&(mem[reg[rx]]) = reg[ry];
-			break;
+			a = reg[d->rx];
+			*(int*)&(mem[a]) = reg[d->ry];
+			code_touch(a, 4);
+			NEXT;
 
-			case I_STC_1:
+			CASE(STC_1)
 			cycle += 9;
 			mem_w++;
-			mem[reg[rx]] = reg[ry];
-			break;
+			a = reg[d->rx];
+			mem[a] = reg[d->ry];
+			code_touch(a, 1);
+			NEXT;
 
-			case I_STO_2:
+			CASE(STO_2)
 			cycle += 9;
 			mem_w++;
-			*(int*)&(mem[reg[rx]]) = reg[ry]+constant;
-			break;
+			a = reg[d->rx];
+			*(int*)&(mem[a]) = reg[d->ry]+d->constant;
+			code_touch(a, 4);
+			NEXT;
 
-			case I_STC_2:
+			CASE(STC_2)
 			cycle += 9;
 			mem_w++;
-			mem[reg[rx]] = reg[ry]+constant;
-			break;
+			a = reg[d->rx];
+			mem[a] = reg[d->ry]+d->constant;
+			code_touch(a, 1);
+			NEXT;
 
-			case I_STO_3:
+			CASE(STO_3)
 			cycle += 9;
 			mem_w++;
-			*(int*)&(mem[reg[rx] + constant]) = reg[ry];
-			break;
+			a = reg[d->rx] + d->constant;
+			*(int*)&(mem[a]) = reg[d->ry];
+			code_touch(a, 4);
+			NEXT;
 
-			case I_STC_3:
+			CASE(STC_3)
 			cycle += 9;
 			mem_w++;
-			mem[reg[rx] + constant] = reg[ry];
-			break;
-
-			case I_TST_0:
-			t=reg[rx];
-			if(t==0) reg[R_FLAG]=FLAG_EZ;
-			else if(t<0) reg[R_FLAG]=FLAG_LZ;
-			else if(t>0) reg[R_FLAG]=FLAG_GZ;
-			break;
-
-			case I_JMP_0:
-			reg[R_IP]=constant;
-			continue;
-
-			case I_JMP_1:
-			reg[R_IP]=reg[rx];
-			continue;
-
-			case I_JEZ_0:
-			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=constant; continue; }
-			else break;
-			
-			case I_JEZ_1:
-			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=reg[rx]; continue; }
-			else break;
-
-			case I_JLZ_0:
-			if(reg[R_FLAG]==FLAG_LZ) { reg[R_IP]=constant; continue; }
-			else break;
-
-			case I_JLZ_1:
-			if(reg[R_FLAG]==FLAG_LZ) { reg[R_IP]=reg[rx]; continue; }
-			else break;
-
-			case I_JGZ_0:
-			if(reg[R_FLAG]==FLAG_GZ) { reg[R_IP]=constant; continue; }
-			else break;
-
-			case I_JGZ_1:
-			if(reg[R_FLAG]==FLAG_GZ) { reg[R_IP]=reg[rx]; continue; }
-			else break;
-
-			default:
-			fprintf(stderr, "error: invalid opcode %02x\n", op);
+			a = reg[d->rx] + d->constant;
+			mem[a] = reg[d->ry];
+			code_touch(a, 1);
+			NEXT;
+
+			CASE(TST_0)
+			TEST(d->rx);
+			NEXT;
+
+			CASE(JMP_0)
+			reg[R_IP]=d->constant;
+			JUMP;
+
+			CASE(JMP_1)
+			reg[R_IP]=reg[d->rx];
+			JUMP;
+
+			CASE(JEZ_0)
+			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=d->constant; JUMP; }
+			else NEXT;
+
+			CASE(JEZ_1)
+			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=reg[d->rx]; JUMP; }
+			else NEXT;
+
+			CASE(JLZ_0)
+			if(reg[R_FLAG]==FLAG_LZ) { reg[R_IP]=d->constant; JUMP; }
+			else NEXT;
+
+			CASE(JLZ_1)
+			if(reg[R_FLAG]==FLAG_LZ) { reg[R_IP]=reg[d->rx]; JUMP; }
+			else NEXT;
+
+			CASE(JGZ_0)
+			if(reg[R_FLAG]==FLAG_GZ) { reg[R_IP]=d->constant; JUMP; }
+			else NEXT;
+
+			CASE(JGZ_1)
+			if(reg[R_FLAG]==FLAG_GZ) { reg[R_IP]=reg[d->rx]; JUMP; }
+			else NEXT;
+
+			CASE(INVALID)
+			fprintf(stderr, "error: invalid opcode %02x\n", d->op);
 			exit(0);
+
+			/* superinstructions, each step keeps R_IP and the counters as if run one by one */
+			CASE(TST_JEZ)
+			TEST(d->rx);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			FIRED(TST_JEZ);
+			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=d[1].constant; JUMP; }
+			else NEXT;
+
+			CASE(LOD_TST_JEZ)
+			cycle += 9;
+			mem_r++;
+			reg[d->rx] = *(int*)&(mem[reg[d->ry] + d->constant]);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			TEST(d[1].rx);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			FIRED(LOD_TST_JEZ);
+			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=d[2].constant; JUMP; }
+			else NEXT;
+
+			CASE(STO_TST_JEZ)
+			cycle += 9;
+			mem_w++;
+			a = reg[d->rx] + d->constant;
+			*(int*)&(mem[a]) = reg[d->ry];
+			code_touch(a, 4);
+			if(STORE_HITS(a, 4, reg[R_IP] + 8, reg[R_IP] + 24)) NEXT;
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			TEST(d[1].rx);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			FIRED(STO_TST_JEZ);
+			if(reg[R_FLAG]==FLAG_EZ) { reg[R_IP]=d[2].constant; JUMP; }
+			else NEXT;
+
+			CASE(TST_LOD_JCC)
+			TEST(d->rx);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			reg[d[1].rx]=reg[R_IP] + d[1].constant;
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			FIRED(TST_LOD_JCC);
+			if(reg[R_FLAG]==cond_flag(d[2].base)) { reg[R_IP]=reg[d[2].rx]; JUMP; }
+			else NEXT;
+
+			CASE(LOD_ADD_STO)
+			cycle += 9;
+			mem_r++;
+			reg[d->rx] = *(int*)&(mem[reg[d->ry] + d->constant]);
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			reg[d[1].rx]=reg[d[1].rx] + reg[d[1].ry];
+			cycle++;
+			reg[R_IP]=reg[R_IP]+8;
+			cycle += 9;
+			mem_w++;
+			a = reg[d[2].rx] + d[2].constant;
+			*(int*)&(mem[a]) = reg[d[2].ry];
+			FIRED(LOD_ADD_STO);
+			code_touch(a, 4);
+			NEXT;
+#ifndef DISPATCH_THREADED
 		}
-		
+
 		reg[R_IP]=reg[R_IP]+8; /* next instruction */
 	}
-	
+#endif
+
 	return 0;
 }
-
-
@@ -1,97 +1,74 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "tac.h"
-#include "mini.y.h"
-#include "obj.h"
-#include "cfg.h"
-#include "constfold.h"
-#include "copyprop.h"
-#include "cse.h"
-#include "licm.h"
-#include "loopreduce.h"
-#include "loopunroll.h"
 #include "optlog.h"
-#include "deadcode.h"
+#include "analysis.h"
+#include "compile.h"
+#include "batch.h"
+#include "cache.h"
+#include "pipeline.h"
 
-FILE *file_x, *file_s;
-
-void error(const char *format, ...)
+static void cache_report()
 {
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-	exit(0);
-}
+	int hits, misses;
 
-void tac_list()
-{
-	out_str(file_x, "\n# tac list\n\n");
-	
-	TAC * cur;
-	for(cur = tac_first; cur !=NULL; cur=cur->next)
-	{
-		out_str(file_x, "%p\t", cur);
-		out_tac(file_x, cur);
-		out_str(file_x, "\n");
-	}
+	if(!cache_enabled()) return;
+	cache_stats(&hits, &misses);
+	fprintf(stderr, "function cache: %d hits, %d misses\n", hits, misses);
 }
 
 int main(int argc,   char *argv[])
 {
-	if(argc != 2) error("usage: %s filename\n", argv[0]);
-	
-	char *input = argv[1];
-	if(input[strlen(input)-1]!='m') error("%s does not end with .m\n", input);
-
-	if(freopen(input, "r", stdin)==NULL) error("open %s failed\n", input);
-
-	char *output=strdup(input);
-
-	output[strlen(output)-1]='x';
-	if((file_x=fopen(output,"w"))==NULL) error("open %s failed\n", output);
-
-	output[strlen(output)-1]='s';
-	if((file_s=fopen(output,"w"))==NULL) error("open %s failed\n", output);
+	char **inputs = (char **)malloc(argc * sizeof(char *));
+	int count = 0;
+	int time_json = 0;
+	int jobs = 0;
+	struct stat st;
 
-	tac_init();
-	yyparse();
-	optlog_reset();
-	constfold_reset();
-	copyprop_reset();
-	cse_reset();
-	licm_reset();
-	loopreduce_reset();
-	loopunroll_reset();
-	/* iterate local optimizations to a fixpoint (guarded to avoid infinite loops) */
-	for(int iter = 0; iter < 32; ++iter)
+	for(int i = 1; i < argc; i++)
 	{
-		int folds = 0, copies = 0, eliminated = 0, hoisted = 0, collapsed = 0, unrolled = 0, dead = 0;
-		folds = constfold_run();
-		copies = copyprop_run();
-		eliminated = cse_run();
-		hoisted = licm_run();
-		collapsed = loopreduce_run();
-		//unrolled = loopunroll_run();
-		dead = deadcode_run();
-		if(folds == 0 && copies == 0 && eliminated == 0 && hoisted == 0 && collapsed == 0 && unrolled == 0 && dead == 0)
+		if(!strcmp(argv[i], "--time-passes")) optprof_enable();
+		else if(!strcmp(argv[i], "--time-passes=json")) optprof_enable(), time_json = 1;
+		else if(!strncmp(argv[i], "-j", 2) && argv[i][2]) jobs = atoi(argv[i] + 2);
+		else if(!strncmp(argv[i], "--cache=", 8) && argv[i][8]) cache_open(argv[i] + 8);
+		else if(!strcmp(argv[i], "--stream")) compile_stream(1);
+		else if(!strcmp(argv[i], "-O0") || !strcmp(argv[i], "-O1") || !strcmp(argv[i], "-O2")) pipeline_passes(argv[i] + 1);
+		else if(!strncmp(argv[i], "--passes=", 9))
 		{
-			break;
+			if(pipeline_passes(argv[i] + 9) != 0) error("unknown pass in %s\n", argv[i]);
 		}
+		else if(argv[i][0] != '-') inputs[count++] = argv[i];
+		else count = 0, i = argc;
 	}
-	deadcode_run();
-	tac_list();
-	
-	/* Build and print CFGs */
-	CFG_ALL *cfg = cfg_build_all();
-	cfg_print_all(cfg);
-	tac_obj();
-	cfg_free_all(cfg);
+	if(count == 0) error("usage: %s [--time-passes[=json]] [-jN] [--cache=DIR] [--stream] [-O0|-O1|-O2|--passes=LIST] filename|directory...\n", argv[0]);
 
-	fclose(file_s);
-	fclose(file_x);
+	/* several programs: -jN is how many compile at once, each on one thread */
+	if(count > 1 || (stat(inputs[0], &st) == 0 && S_ISDIR(st.st_mode)))
+	{
+		int failed = batch_run(inputs, count, jobs);
+		free(inputs);
+		cache_report();
+		return failed ? 1 : 0;
+	}
+
+	char *message;
+	if(compile_file(inputs[0], jobs, &message) != 0)
+	{
+		fputs(message, stderr);
+		exit(1);
+	}
+	free(inputs);
+
+	if(optprof_enabled() && !time_json)
+	{
+		int index_builds, cfg_builds, hits;
+		analysis_stats(&index_builds, &cfg_builds, &hits);
+		fprintf(stderr, "analysis cache: %d index builds, %d cfg builds, %d reuses\n", index_builds, cfg_builds, hits);
+	}
+	optprof_emit(stderr, time_json);
+	cache_report();
 
 	return 0;
 }
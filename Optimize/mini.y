@@ -4,11 +4,12 @@
 #include <string.h>
 #include "tac.h"
 
-int yylex();
-void yyerror(char* msg);
-
 %}
 
+%define api.pure full
+%parse-param {void *scanner}
+%lex-param {void *scanner}
+
 %union
 {
 	char character;
@@ -30,6 +31,13 @@ void yyerror(char* msg);
 %type <exp> argument_list expression_list expression call_expression
 %type <sym> function_head
 
+%code
+{
+int yylex(YYSTYPE *lval, void *scanner);
+int yyget_lineno(void *scanner);
+void yyerror(void *scanner, char *msg);
+}
+
 %%
 
 program : function_declaration_list
@@ -40,9 +48,12 @@ program : function_declaration_list
 ;
 
 function_declaration_list : function_declaration
+{
+	$$=tac_stream($1);
+}
 | function_declaration_list function_declaration
 {
-	$$=join_tac($1, $2);
+	$$=join_tac($1, tac_stream($2));
 }
 ;
 
@@ -69,8 +80,7 @@ variable_list : IDENTIFIER
 function : function_head '(' parameter_list ')' block
 {
 	$$=do_func($1, $3, $5);
-	scope=0; /* Leave local scope. */
-	sym_tab_local=NULL; /* Clear local symbol table. */
+	scope_pop(); /* Leave local scope, clear local symbol table. */
 }
 | error
 {
@@ -82,8 +92,7 @@ function : function_head '(' parameter_list ')' block
 function_head : IDENTIFIER
 {
 	$$=declare_func($1);
-	scope=1; /* Enter local scope. */
-	sym_tab_local=NULL; /* Init local symbol table. */
+	scope_push(); /* Enter local scope, init local symbol table. */
 }
 ;
 
@@ -246,8 +255,7 @@ output_statement : OUTPUT IDENTIFIER
 return_statement : RETURN expression
 {
 	TAC *t=mk_tac(TAC_RETURN, $2->ret, NULL, NULL);
-	t->prev=$2->tac;
-	$$=t;
+	$$=join_tac($2->tac, t);
 }               
 ;
 
@@ -281,8 +289,7 @@ call_expression : IDENTIFIER '(' argument_list ')'
 
 %%
 
-void yyerror(char* msg) 
+void yyerror(void *scanner, char* msg) 
 {
-	fprintf(stderr, "%s: line %d\n", msg, yylineno);
-	exit(0);
+	error("%s: line %d\n", msg, yyget_lineno(scanner));
 }
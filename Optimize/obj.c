@@ -13,11 +13,11 @@
 #include "deadcode.h"
 
 /* global var */
-int tos; /* top of static */
-int tof; /* top of frame */
-int oof; /* offset of formal */
-int oon; /* offset of next frame */
-struct rdesc rdesc[R_NUM];
+__thread int tos; /* top of static */
+__thread int tof; /* top of frame */
+__thread int oof; /* offset of formal */
+__thread int oon; /* offset of next frame */
+__thread struct rdesc rdesc[R_NUM];
 
 typedef struct sym_reg_info
 {
@@ -29,8 +29,9 @@ typedef struct sym_reg_info
 	struct sym_reg_info *next;
 } SymRegInfo;
 
-static SymRegInfo *sym_info_list = NULL;
-static int current_instr_index = -1;
+static __thread SymRegInfo *sym_info_list = NULL;
+static __thread int current_instr_index = -1;
+static __thread int globals_live; /* code after this piece may read globals, see obj_code */
 
 static SymRegInfo *syminfo_get(SYM *sym, int create)
 {
@@ -114,13 +115,15 @@ static void syminfo_cleanup(void)
 	sym_info_list = NULL;
 }
 
+/* uses are numbered in code order, so a read through a loop back edge shows up as an earlier index */
 static int syminfo_has_future_use(SYM *sym, int index)
 {
+	if(globals_live && sym->kind == SYM_KIND_GLOBAL) return 1;
 	SymRegInfo *info = syminfo_get(sym, 0);
 	if(info == NULL) return 0;
-	for(int i = info->use_cursor; i < info->use_count; ++i)
+	for(int i = 0; i < info->use_count; ++i)
 	{
-		if(info->uses[i] > index)
+		if(info->uses[i] != index)
 		{
 			return 1;
 		}
@@ -251,7 +254,8 @@ void asm_load(int r, SYM *s)
 	// rdesc_fill(r, s, UNMODIFIED);
 }
 
-int reg_alloc(SYM *s, int need_value)
+/* a register for s, never taking keep, which holds the other operand of the instruction being emitted */
+int reg_alloc(SYM *s, int need_value, int keep)
 {
 	if(s == NULL) return R_UNDEF;
 
@@ -280,6 +284,10 @@ int reg_alloc(SYM *s, int need_value)
 		for(int r = R_GEN; r < R_NUM; r++)
 		{
 			SYM *held = rdesc[r].var;
+			if(r == keep)
+			{
+				continue;
+			}
 			if(held == NULL)
 			{
 				best_reg = r;
@@ -299,7 +307,7 @@ int reg_alloc(SYM *s, int need_value)
 		}
 		if(best_reg == -1)
 		{
-			best_reg = R_GEN;
+			best_reg = (keep == R_GEN) ? R_GEN + 1 : R_GEN;
 		}
 		target = best_reg;
 		asm_write_back(target);
@@ -314,10 +322,18 @@ int reg_alloc(SYM *s, int need_value)
 	return target;
 }
 
+/* ITI, OTI and OTS go through R15, which also holds variables; save whatever is there unless it is keep */
+void asm_free_io(int keep)
+{
+	if(keep == 15) return;
+	asm_write_back(15);
+	rdesc_clear(15);
+}
+
 void asm_bin(const char *op, SYM *a, SYM *b, SYM *c)
 {
-	int reg_b = reg_alloc(b, 1);
-	int reg_c = reg_alloc(c, 1);
+	int reg_b = reg_alloc(b, 1, R_UNDEF);
+	int reg_c = reg_alloc(c, 1, reg_b);
 	if(b && b != a && syminfo_has_future_use(b, current_instr_index))
 	{
 		asm_write_back(reg_b);
@@ -330,8 +346,8 @@ void asm_bin(const char *op, SYM *a, SYM *b, SYM *c)
 
 void asm_cmp(int op, SYM *a, SYM *b, SYM *c)
 {
-	int reg_b = reg_alloc(b, 1);
-	int reg_c = reg_alloc(c, 1);
+	int reg_b = reg_alloc(b, 1, R_UNDEF);
+	int reg_c = reg_alloc(c, 1, reg_b);
 	if(b && b != a && syminfo_has_future_use(b, current_instr_index))
 	{
 		asm_write_back(reg_b);
@@ -420,7 +436,7 @@ void asm_cond(char *op, SYM *a,  char *l)
 		}
 		if(r == R_UNDEF)
 		{
-			r = reg_alloc(a, 1);
+			r = reg_alloc(a, 1, R_UNDEF);
 		}
 		out_str(file_s, "	TST R%u\n", r);
 		syminfo_consume_use(a, current_instr_index);
@@ -443,7 +459,7 @@ void asm_call(SYM *a, SYM *b)
 	out_str(file_s, "	JMP %s\n", (char *)b);			/* jump to new func */
 	if(a != NULL)
 	{
-		r = reg_alloc(a, 0);
+		r = reg_alloc(a, 0, R_UNDEF);
 		out_str(file_s, "	LOD R%u,R%u\n", r, R_TP);	
 		rdesc[r].mod = MODIFIED;
 	}
@@ -455,7 +471,7 @@ void asm_return(SYM *a)
 	int ret_reg = R_UNDEF;
 	if(a!=NULL)	 /* return value */
 	{
-		ret_reg = reg_alloc(a, 1);
+		ret_reg = reg_alloc(a, 1, R_UNDEF);
 		out_str(file_s, "\tLOD R%u,R%u\n", R_TP, ret_reg);
 		syminfo_consume_use(a, current_instr_index);
 	}
@@ -581,7 +597,7 @@ void asm_code(TAC *c)
 		return;
 
 		case TAC_COPY:
-		r = reg_alloc(c->b, 1);
+		r = reg_alloc(c->b, 1, R_UNDEF);
 		if(c->b && c->b != c->a && syminfo_has_future_use(c->b, current_instr_index))
 		{
 			asm_write_back(r);
@@ -591,7 +607,8 @@ void asm_code(TAC *c)
 		return;
 
 		case TAC_INPUT:
-		r=reg_alloc(c->a, 0);
+		r=reg_alloc(c->a, 0, R_UNDEF);
+		asm_free_io(r);
 		out_str(file_s, "	ITI\n");
 		out_str(file_s, "	LOD R%u,R15\n", r);
 		rdesc[r].mod = MODIFIED;
@@ -600,13 +617,15 @@ void asm_code(TAC *c)
 		case TAC_OUTPUT:
 		if(c->a->type == SYM_TEXT)
 		{
-			r=reg_alloc(c->a, 1);
+			r=reg_alloc(c->a, 1, R_UNDEF);
+			asm_free_io(r);
 			out_str(file_s, "\tLOD R15,R%u\n", r);
 			out_str(file_s, "\tOTS\n");
 		}
 		else
 		{
-			r=reg_alloc(c->a, 1);
+			r=reg_alloc(c->a, 1, R_UNDEF);
+			asm_free_io(r);
 			out_str(file_s, "\tLOD R15,R%u\n", r);
 			out_str(file_s, "\tOTI\n");
 		}
@@ -628,7 +647,7 @@ void asm_code(TAC *c)
 		return;
 
 		case TAC_ACTUAL:
-		r=reg_alloc(c->a, 1);
+		r=reg_alloc(c->a, 1, R_UNDEF);
 		out_str(file_s, "	STO (R2+%d),R%u\n", tof+oon, r);
 		oon += 4;
 		syminfo_consume_use(c->a, current_instr_index);
@@ -683,29 +702,39 @@ void asm_code(TAC *c)
 	}
 }
 
-void tac_obj()
+/* frame, registers and the head, before any code */
+void obj_begin()
 {
+	tos=0; /* statics start afresh for each compilation */
 	tof=LOCAL_OFF; /* TOS allows space for link info */
 	oof=FORMAL_OFF;
 	oon=0;
 
 	for(int r=0; r < R_NUM; r++) rdesc[r].var=NULL;
-	
+
+	asm_head();
+}
+
+/*
+	Code for the list from first, which is the whole program or, when
+	more is set, one piece of it with more to come. Next uses are only
+	known within the list, so with more to come a global is taken to be
+	used again later and is always written back.
+*/
+void obj_code(TAC *first, int more)
+{
 	int instr_index = 0;
-	for(TAC *scan = tac_first; scan != NULL; scan = scan->next)
+	for(TAC *scan = first; scan != NULL; scan = scan->next)
 	{
 		scan->etc = (void *)(intptr_t)instr_index;
 		regalloc_record_uses(scan, instr_index);
 		instr_index++;
 	}
 	syminfo_reset_cursors();
-
-	asm_head();
-	optlog_emit(file_s);
-	deadcode_emit_report(file_s);
+	globals_live = more;
 
 	TAC * cur;
-	for(cur=tac_first; cur!=NULL; cur=cur->next)
+	for(cur=first; cur!=NULL; cur=cur->next)
 	{
 		current_instr_index = (int)(intptr_t)cur->etc;
 		cur->etc = NULL;
@@ -715,8 +744,21 @@ void tac_obj()
 		asm_code(cur);
 	}
 	current_instr_index = -1;
+	syminfo_cleanup();
+}
+
+/* the tail and the static data, after all code */
+void obj_end()
+{
 	asm_tail();
 	asm_static();
-	syminfo_cleanup();
-} 
+}
 
+void tac_obj()
+{
+	obj_begin();
+	optlog_emit(file_s);
+	deadcode_emit_report(file_s);
+	obj_code(tac_first, 0);
+	obj_end();
+}
@@ -23,10 +23,15 @@ struct rdesc /* register descriptor */
 	int mod;
 };
 
-extern int tos; /* top of static */
-extern int tof; /* top of frame */
-extern int oof; /* offset of formal */
-extern int oon; /* offset of next frame */
+extern __thread int tos; /* top of static */
+extern __thread int tof; /* top of frame */
+extern __thread int oof; /* offset of formal */
+extern __thread int oon; /* offset of next frame */
 
 void tac_obj();
 
+/* tac_obj in steps, so code can go out a piece at a time */
+void obj_begin();
+void obj_code(struct tac *first, int more);
+void obj_end();
+
@@ -11,11 +11,11 @@
 #include "deadcode.h"
 
 /* global var */
-int tos; /* top of static */
-int tof; /* top of frame */
-int oof; /* offset of formal */
-int oon; /* offset of next frame */
-struct rdesc rdesc[R_NUM];
+__thread int tos; /* top of static */
+__thread int tof; /* top of frame */
+__thread int oof; /* offset of formal */
+__thread int oon; /* offset of next frame */
+__thread struct rdesc rdesc[R_NUM];
 
 void rdesc_clear(int r)    
 {
@@ -492,27 +492,45 @@ void asm_code(TAC *c)
 	}
 }
 
-void tac_obj()
+/* frame, registers and the head, before any code */
+void obj_begin()
 {
+	tos=0; /* statics start afresh for each compilation */
 	tof=LOCAL_OFF; /* TOS allows space for link info */
 	oof=FORMAL_OFF;
 	oon=0;
 
 	for(int r=0; r < R_NUM; r++) rdesc[r].var=NULL;
-	
+
 	asm_head();
-	optlog_emit(file_s);
-	deadcode_emit_report(file_s);
+}
 
+/* code for the list from first; this allocator keeps nothing across TACs, so more does not matter */
+void obj_code(TAC *first, int more)
+{
+	(void)more;
 	TAC * cur;
-	for(cur=tac_first; cur!=NULL; cur=cur->next)
+	for(cur=first; cur!=NULL; cur=cur->next)
 	{
 		out_str(file_s, "\n	# ");
 		out_tac(file_s, cur);
 		out_str(file_s, "\n");
 		asm_code(cur);
 	}
+}
+
+/* the tail and the static data, after all code */
+void obj_end()
+{
 	asm_tail();
 	asm_static();
-} 
+}
 
+void tac_obj()
+{
+	obj_begin();
+	optlog_emit(file_s);
+	deadcode_emit_report(file_s);
+	obj_code(tac_first, 0);
+	obj_end();
+}
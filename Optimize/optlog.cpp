@@ -1,6 +1,13 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <chrono>
+#include <new>
+#include <map>
+#include <algorithm>
+#include <climits>
 #include "optlog.h"
 #include "tac.h"
 
@@ -12,8 +19,41 @@ struct Entry {
     std::vector<std::string> lines;
 };
 
-std::vector<Entry> g_entries;
-int g_pass_counts[OPT_PASS_COUNT];
+thread_local std::vector<Entry> g_entries;
+thread_local int g_pass_counts[OPT_PASS_COUNT];
+
+struct Sample {
+    const char *pass;
+    int iteration; /* 0 outside the fixpoint loop */
+    int changes;
+    int tac_before;
+    int tac_after;
+    double ms;
+    size_t peak; /* bytes above this thread's heap level at begin */
+};
+
+bool g_prof_enabled;
+thread_local std::vector<Sample> g_samples;
+thread_local std::chrono::steady_clock::time_point g_prof_start;
+thread_local ptrdiff_t g_prof_base;
+
+/*
+    Bytes allocated less bytes freed by operator new/delete on this
+    thread while profiling is on, and the highest it has been since
+    optprof_begin. Blocks freed on another thread than the one that made
+    them (a pipeline worker's TAC logs, freed by the caller) move each
+    thread's count the other way, so the level can go negative; only
+    the rise above the level at begin means anything.
+*/
+thread_local ptrdiff_t g_heap_live;
+thread_local ptrdiff_t g_heap_peak;
+
+int tac_count(void)
+{
+    int n = 0;
+    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next) ++n;
+    return n;
+}
 
 const char *pass_name(OPT_PASS pass)
 {
@@ -25,6 +65,7 @@ const char *pass_name(OPT_PASS pass)
         case OPT_PASS_LICM:      return "loop-invariant code motion";
         case OPT_PASS_LOOPREDUCE:return "loop reduction";
         case OPT_PASS_LOOPUNROLL:return "loop unrolling";
+        case OPT_PASS_SCCP:      return "sparse conditional constant propagation";
         default: return "optimization";
     }
 }
@@ -39,6 +80,7 @@ const char *metric_name(OPT_PASS pass)
         case OPT_PASS_LICM:      return "hoists";
         case OPT_PASS_LOOPREDUCE:return "collapses";
         case OPT_PASS_LOOPUNROLL:return "unrolls";
+        case OPT_PASS_SCCP:      return "rewrites";
         default: return "changes";
     }
 }
@@ -127,3 +169,315 @@ extern "C" void optlog_emit(FILE *out)
 
     optlog_reset();
 }
+
+struct optlog_capture {
+    std::vector<Entry> entries;
+    std::vector<Sample> samples;
+};
+
+extern "C" OPTLOG_CAPTURE *optlog_take(void)
+{
+    OPTLOG_CAPTURE *capture = new OPTLOG_CAPTURE;
+    capture->entries.swap(g_entries);
+    capture->samples.swap(g_samples);
+    optlog_reset();
+    return capture;
+}
+
+extern "C" void optlog_merge(OPTLOG_CAPTURE **captures, int count)
+{
+    std::map<std::pair<int, int>, size_t> entry_at;
+    for(size_t i = 0; i < g_entries.size(); ++i)
+    {
+        entry_at[std::make_pair(static_cast<int>(g_entries[i].pass), g_entries[i].per_pass_index)] = i;
+    }
+
+    std::vector<Sample> samples;
+    for(int c = 0; c < count; ++c)
+    {
+        OPTLOG_CAPTURE *capture = captures[c];
+        for(Entry &entry : capture->entries)
+        {
+            auto key = std::make_pair(static_cast<int>(entry.pass), entry.per_pass_index);
+            auto it = entry_at.find(key);
+            if(it == entry_at.end())
+            {
+                entry_at[key] = g_entries.size();
+                g_pass_counts[entry.pass] = std::max(g_pass_counts[entry.pass], entry.per_pass_index);
+                g_entries.push_back(std::move(entry));
+                continue;
+            }
+            Entry &merged = g_entries[it->second];
+            merged.delta += entry.delta;
+            merged.lines.insert(merged.lines.end(), entry.lines.begin(), entry.lines.end());
+        }
+
+        for(const Sample &sample : capture->samples)
+        {
+            size_t i = 0;
+            while(i < samples.size() && (samples[i].iteration != sample.iteration ||
+                  std::strcmp(samples[i].pass, sample.pass) != 0)) ++i;
+            if(i == samples.size())
+            {
+                samples.push_back(sample);
+                continue;
+            }
+            samples[i].ms += sample.ms;
+            samples[i].changes += sample.changes;
+            samples[i].tac_before += sample.tac_before;
+            samples[i].tac_after += sample.tac_after;
+            samples[i].peak = std::max(samples[i].peak, sample.peak);
+        }
+        delete capture;
+    }
+
+    /* back into iteration order, samples from after the fixpoint (iteration 0) last */
+    std::stable_sort(g_entries.begin(), g_entries.end(), [](const Entry &a, const Entry &b) {
+        return a.per_pass_index < b.per_pass_index;
+    });
+    std::stable_sort(samples.begin(), samples.end(), [](const Sample &a, const Sample &b) {
+        return (a.iteration > 0 ? a.iteration : INT_MAX) < (b.iteration > 0 ? b.iteration : INT_MAX);
+    });
+    g_samples.insert(g_samples.end(), samples.begin(), samples.end());
+}
+
+extern "C" void optlog_write(const OPTLOG_CAPTURE *capture, FILE *out)
+{
+    fprintf(out, "optlog %zu\n", capture->entries.size());
+    for(const Entry &entry : capture->entries)
+    {
+        fprintf(out, "%d %d %d %zu\n", static_cast<int>(entry.pass), entry.per_pass_index, entry.delta, entry.lines.size());
+        for(const std::string &line : entry.lines) fprintf(out, "%s\n", line.c_str());
+    }
+}
+
+namespace {
+/* one line without its newline; log lines may start with blanks, so not fscanf */
+bool read_line(FILE *in, std::string &line)
+{
+    line.clear();
+    for(int c = fgetc(in); c != '\n'; c = fgetc(in))
+    {
+        if(c == EOF) return false;
+        line.push_back(static_cast<char>(c));
+    }
+    return true;
+}
+} // namespace
+
+extern "C" OPTLOG_CAPTURE *optlog_read(FILE *in)
+{
+    size_t count;
+    if(fscanf(in, "optlog %zu", &count) != 1 || fgetc(in) != '\n') return nullptr;
+
+    OPTLOG_CAPTURE *capture = new OPTLOG_CAPTURE;
+    for(size_t i = 0; i < count; ++i)
+    {
+        Entry entry;
+        int pass;
+        size_t lines;
+        if(fscanf(in, "%d %d %d %zu", &pass, &entry.per_pass_index, &entry.delta, &lines) != 4 ||
+           fgetc(in) != '\n' || pass < 0 || pass >= OPT_PASS_COUNT)
+        {
+            delete capture;
+            return nullptr;
+        }
+        entry.pass = static_cast<OPT_PASS>(pass);
+        entry.lines.resize(lines);
+        for(std::string &line : entry.lines)
+        {
+            if(!read_line(in, line))
+            {
+                delete capture;
+                return nullptr;
+            }
+        }
+        capture->entries.push_back(std::move(entry));
+    }
+    return capture;
+}
+
+extern "C" void optlog_free(OPTLOG_CAPTURE *capture)
+{
+    delete capture;
+}
+
+/* header in front of every block holding its size, or 0 if it was made with profiling off */
+namespace {
+const size_t kHeapHeader = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+void *heap_alloc(size_t size)
+{
+    void *p = std::malloc(size + kHeapHeader);
+    if(p == nullptr) throw std::bad_alloc();
+    *static_cast<size_t *>(p) = g_prof_enabled ? size : 0;
+    if(g_prof_enabled)
+    {
+        g_heap_live += static_cast<ptrdiff_t>(size);
+        if(g_heap_live > g_heap_peak) g_heap_peak = g_heap_live;
+    }
+    return static_cast<char *>(p) + kHeapHeader;
+}
+
+void heap_free(void *p)
+{
+    if(p == nullptr) return;
+    char *block = static_cast<char *>(p) - kHeapHeader;
+    g_heap_live -= static_cast<ptrdiff_t>(*reinterpret_cast<size_t *>(block));
+    std::free(block);
+}
+}
+
+void *operator new(size_t size) { return heap_alloc(size); }
+void *operator new[](size_t size) { return heap_alloc(size); }
+void operator delete(void *p) noexcept { heap_free(p); }
+void operator delete[](void *p) noexcept { heap_free(p); }
+void operator delete(void *p, size_t) noexcept { heap_free(p); }
+void operator delete[](void *p, size_t) noexcept { heap_free(p); }
+/* std::stable_sort's buffer comes from these, they must match the ones above */
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    try { return heap_alloc(size); } catch(...) { return nullptr; }
+}
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    try { return heap_alloc(size); } catch(...) { return nullptr; }
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept { heap_free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { heap_free(p); }
+
+extern "C" void optprof_enable(void)
+{
+    g_prof_enabled = true;
+}
+
+extern "C" int optprof_enabled(void)
+{
+    return g_prof_enabled;
+}
+
+extern "C" void optprof_begin(const char *pass, int iteration)
+{
+    if(!g_prof_enabled) return;
+
+    Sample sample;
+    sample.pass = pass;
+    sample.iteration = iteration;
+    sample.changes = 0;
+    sample.tac_before = tac_count();
+    sample.tac_after = 0;
+    sample.ms = 0;
+    sample.peak = 0;
+    g_samples.push_back(sample);
+
+    /* measured after the push so the sample vector itself does not count */
+    g_prof_base = g_heap_live;
+    g_heap_peak = g_heap_live;
+    g_prof_start = std::chrono::steady_clock::now();
+}
+
+extern "C" void optprof_end(int changes)
+{
+    if(!g_prof_enabled || g_samples.empty()) return;
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - g_prof_start;
+    Sample &sample = g_samples.back();
+    sample.ms = elapsed.count();
+    sample.peak = static_cast<size_t>(g_heap_peak - g_prof_base);
+    sample.changes = changes;
+    sample.tac_after = tac_count();
+}
+
+namespace {
+struct PassTotal {
+    const char *pass;
+    int calls;
+    int changes;
+    int tac_delta;
+    double ms;
+    size_t peak;
+};
+
+std::vector<PassTotal> pass_totals(void)
+{
+    std::vector<PassTotal> totals;
+    for(const Sample &sample : g_samples)
+    {
+        size_t i = 0;
+        while(i < totals.size() && std::strcmp(totals[i].pass, sample.pass) != 0) ++i;
+        if(i == totals.size())
+        {
+            PassTotal total = {sample.pass, 0, 0, 0, 0, 0};
+            totals.push_back(total);
+        }
+        totals[i].calls++;
+        totals[i].changes += sample.changes;
+        totals[i].tac_delta += sample.tac_after - sample.tac_before;
+        totals[i].ms += sample.ms;
+        if(sample.peak > totals[i].peak) totals[i].peak = sample.peak;
+    }
+    return totals;
+}
+
+void emit_text(FILE *out)
+{
+    double total_ms = 0;
+    for(const Sample &sample : g_samples) total_ms += sample.ms;
+
+    fprintf(out, "===== pass execution timing =====\n");
+    fprintf(out, "%-6s %-12s %10s %8s %8s %8s %10s\n", "iter", "pass", "ms", "changes", "before", "after", "peak");
+    for(const Sample &sample : g_samples)
+    {
+        if(sample.iteration > 0)
+            fprintf(out, "%-6d ", sample.iteration);
+        else
+            fprintf(out, "%-6s ", "-");
+        fprintf(out, "%-12s %10.3f %8d %8d %8d %10zu\n", sample.pass, sample.ms, sample.changes,
+            sample.tac_before, sample.tac_after, sample.peak);
+    }
+
+    fprintf(out, "\n%-12s %6s %10s %6s %8s %8s %10s\n", "pass", "calls", "ms", "%", "changes", "tac", "peak");
+    for(const PassTotal &total : pass_totals())
+    {
+        fprintf(out, "%-12s %6d %10.3f %6.1f %8d %+8d %10zu\n", total.pass, total.calls, total.ms,
+            total_ms > 0 ? 100.0 * total.ms / total_ms : 0.0, total.changes, total.tac_delta, total.peak);
+    }
+    fprintf(out, "%-12s %6zu %10.3f\n", "total", g_samples.size(), total_ms);
+    fprintf(out, "\npeak: bytes of C++ heap a pass allocated on its own thread above the level at its start;\n"
+        "with -jN, passes running on other threads at the same time are not included\n");
+}
+
+void emit_json(FILE *out)
+{
+    fprintf(out, "{\n  \"samples\": [");
+    for(size_t i = 0; i < g_samples.size(); ++i)
+    {
+        const Sample &sample = g_samples[i];
+        fprintf(out, "%s\n    {\"pass\": \"%s\", \"iteration\": %d, \"ms\": %.3f, \"changes\": %d, "
+            "\"tac_before\": %d, \"tac_after\": %d, \"peak_bytes\": %zu}",
+            i ? "," : "", sample.pass, sample.iteration, sample.ms, sample.changes,
+            sample.tac_before, sample.tac_after, sample.peak);
+    }
+    fprintf(out, "\n  ],\n  \"passes\": [");
+    std::vector<PassTotal> totals = pass_totals();
+    for(size_t i = 0; i < totals.size(); ++i)
+    {
+        const PassTotal &total = totals[i];
+        fprintf(out, "%s\n    {\"pass\": \"%s\", \"calls\": %d, \"ms\": %.3f, \"changes\": %d, "
+            "\"tac_delta\": %d, \"peak_bytes\": %zu}",
+            i ? "," : "", total.pass, total.calls, total.ms, total.changes, total.tac_delta, total.peak);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+}
+
+extern "C" void optprof_emit(FILE *out, int json)
+{
+    if(out == nullptr || !g_prof_enabled) return;
+
+    if(json)
+        emit_json(out);
+    else
+        emit_text(out);
+    g_samples.clear();
+}
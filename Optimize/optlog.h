@@ -14,6 +14,7 @@ typedef enum {
     OPT_PASS_LICM = 3,
     OPT_PASS_LOOPREDUCE = 4,
     OPT_PASS_LOOPUNROLL = 5,
+    OPT_PASS_SCCP = 6,
     OPT_PASS_COUNT
 } OPT_PASS;
 
@@ -21,6 +22,36 @@ void optlog_reset(void);
 void optlog_record(OPT_PASS pass, const char * const *lines, int line_count, int delta);
 void optlog_emit(FILE *out);
 
+/*
+    Records and profile samples are kept per thread. optlog_take moves
+    the calling thread's out as a handle; optlog_merge folds handles into
+    the calling thread's log in the order given and frees them. The k-th
+    record of a pass in every handle becomes the pass's k-th record, and
+    samples of the same pass and iteration are summed.
+*/
+typedef struct optlog_capture OPTLOG_CAPTURE;
+OPTLOG_CAPTURE *optlog_take(void);
+void optlog_merge(OPTLOG_CAPTURE **captures, int count);
+
+/* a handle's records as text and back, for the function cache; read gives NULL on bad input */
+void optlog_write(const OPTLOG_CAPTURE *capture, FILE *out);
+OPTLOG_CAPTURE *optlog_read(FILE *in);
+void optlog_free(OPTLOG_CAPTURE *capture);
+
+/*
+    Compile-time profile. Each optprof_begin/optprof_end pair records one
+    pass invocation: wall time, TAC count before and after, and the peak
+    of C++ heap allocation above the level at begin. Allocation is
+    counted per thread, so under -jN a pass's peak leaves out the passes
+    running beside it on other threads. Recording, allocation counting
+    included, is off until optprof_enable is called.
+*/
+void optprof_enable(void);
+int optprof_enabled(void);
+void optprof_begin(const char *pass, int iteration);
+void optprof_end(int changes);
+void optprof_emit(FILE *out, int json);
+
 #ifdef __cplusplus
 }
 #endif
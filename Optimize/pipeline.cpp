@@ -0,0 +1,331 @@
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "pipeline.h"
+#include "analysis.h"
+#include "constfold.h"
+#include "sccp.h"
+#include "copyprop.h"
+#include "cse.h"
+#include "licm.h"
+#include "loopreduce.h"
+#include "loopunroll.h"
+#include "deadcode.h"
+#include "optlog.h"
+#include "cache.h"
+
+namespace {
+
+/* a function, or a run of code between functions that no pass touches */
+struct Piece {
+    TAC *first = nullptr;
+    TAC *last = nullptr;
+    bool function = false;
+    int size = 0;
+    OPTLOG_CAPTURE *log = nullptr;
+    DEADCODE_REPORT *dead = nullptr;
+};
+
+bool starts_function(TAC *t)
+{
+    return t->op == TAC_LABEL && t->next != nullptr && t->next->op == TAC_BEGINFUNC;
+}
+
+/* cut the list into pieces, each one a list of its own */
+std::vector<Piece> split_program(void)
+{
+    std::vector<Piece> pieces;
+    TAC *cur = tac_first;
+    while(cur != nullptr)
+    {
+        Piece piece;
+        piece.first = cur;
+        piece.function = starts_function(cur);
+        for(;;)
+        {
+            piece.size++;
+            TAC *next = cur->next;
+            if(next == nullptr) break;
+            if(piece.function ? cur->op == TAC_ENDFUNC : starts_function(next)) break;
+            cur = next;
+        }
+        piece.last = cur;
+        cur = cur->next;
+        piece.first->prev = nullptr;
+        piece.last->next = nullptr;
+        pieces.push_back(piece);
+    }
+    return pieces;
+}
+
+void join_program(const std::vector<Piece> &pieces)
+{
+    tac_first = nullptr;
+    tac_last = nullptr;
+    for(const Piece &piece : pieces)
+    {
+        piece.first->prev = tac_last;
+        if(tac_last) tac_last->next = piece.first; else tac_first = piece.first;
+        tac_last = piece.last;
+    }
+}
+
+struct Pass {
+    const char *name;
+    int (*run)(void);
+    bool rewrites;  /* changes the operands of instructions or adds new ones */
+    bool local;     /* folds each instruction on its own, so only a pass that rewrites gives it more to do */
+    bool loops;     /* works on loops alone */
+};
+
+const Pass kPasses[] = {
+    { "constfold", constfold_run, false, true, false },
+    { "copyprop", copyprop_run, true, false, false },
+    { "sccp", sccp_run, true, false, false },
+    { "cse", cse_run, false, false, false },
+    { "licm", licm_run, false, false, true },
+    { "loopreduce", loopreduce_run, true, false, true },
+    { "loopunroll", loopunroll_run, true, false, true },
+    { "deadcode", deadcode_run, false, false, false },
+};
+
+const char kO1[] = "constfold,copyprop,sccp,deadcode";
+const char kO2[] = "constfold,copyprop,sccp,cse,licm,loopreduce,deadcode";
+
+struct Pipeline {
+    std::vector<const Pass*> passes;    /* NULL for a name that is not a pass */
+    std::string config;                 /* how functions are optimised, as far as a cached result depends on it */
+};
+
+const Pass *find_pass(const std::string &name)
+{
+    for(const Pass &pass : kPasses)
+    {
+        if(name == pass.name) return &pass;
+    }
+    return nullptr;
+}
+
+Pipeline make_pipeline(const char *list)
+{
+    Pipeline pipeline;
+    std::string names(list);
+    for(size_t start = 0; start < names.size(); )
+    {
+        size_t end = names.find(',', start);
+        if(end == std::string::npos) end = names.size();
+        pipeline.passes.push_back(find_pass(names.substr(start, end - start)));
+        start = end + 1;
+    }
+    pipeline.config = std::string("worklist of at most 32 rounds over ") + list;
+    return pipeline;
+}
+
+/* set before compiling and only read after, so shared by every thread */
+Pipeline g_pipeline = make_pipeline(kO2);
+
+/* run one pass, timed when --time-passes is on */
+int run_pass(const char *name, int iter, int (*pass)(void))
+{
+    optprof_begin(name, iter);
+    int changes = pass();
+    optprof_end(changes);
+    return changes;
+}
+
+/* a jump back to a label above it; passes only ever remove such jumps */
+bool has_loop(void)
+{
+    std::unordered_set<SYM*> seen;
+    for(TAC *cur = tac_first; cur != nullptr; cur = cur->next)
+    {
+        if(cur->op == TAC_LABEL) seen.insert(cur->a);
+        else if((cur->op == TAC_GOTO || cur->op == TAC_IFZ) && seen.count(cur->a)) return true;
+    }
+    return false;
+}
+
+/*
+    Every pass leaves nothing for a second run of itself to do, so a pass
+    only has to run again once another pass has changed the function in
+    a way it depends on since its last run. Each round runs the passes
+    that are due in pipeline order, and a change makes the passes that
+    depend on it due, later ones in the same round; the function is done
+    when none is due. Loop passes are never due in a function without a
+    loop. The passes that are skipped would have changed nothing, so the
+    code is the same as running the whole pipeline until a round changes
+    nothing, in fewer pass runs.
+*/
+void run_worklist(void)
+{
+    const std::vector<const Pass*> &passes = g_pipeline.passes;
+    size_t count = passes.size();
+    bool loops = has_loop();
+    std::vector<char> due(count);
+    for(size_t i = 0; i < count; ++i) due[i] = loops || !passes[i]->loops;
+    for(int round = 1; round <= 32; ++round)
+    {
+        bool ran = false;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(!due[i]) continue;
+            due[i] = 0;
+            ran = true;
+            if(run_pass(passes[i]->name, round, passes[i]->run) == 0) continue;
+            for(size_t j = 0; j < count; ++j)
+            {
+                if(j != i && (loops || !passes[j]->loops) && (!passes[j]->local || passes[i]->rewrites)) due[j] = 1;
+            }
+        }
+        if(!ran) return;
+    }
+
+    /* out of rounds: leave no dead code behind */
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(due[i] && passes[i]->run == deadcode_run) run_pass("deadcode", 0, deadcode_run);
+    }
+}
+
+void optimize_function(Piece &piece)
+{
+    CACHE_KEY *key = cache_enabled() ? cache_key(piece.first, g_pipeline.config.c_str()) : nullptr;
+    if(key != nullptr && cache_load(key, &piece.first, &piece.last, &piece.log, &piece.dead))
+    {
+        cache_free(key);
+        return;
+    }
+
+    tac_first = piece.first;
+    tac_last = piece.last;
+    analysis_invalidate(ANALYSIS_ALL);
+    constfold_reset();
+    sccp_reset();
+    copyprop_reset();
+    cse_reset();
+    licm_reset();
+    loopreduce_reset();
+    loopunroll_reset();
+
+    run_worklist();
+
+    piece.first = tac_first;
+    piece.last = tac_last;
+    piece.log = optlog_take();
+    piece.dead = deadcode_take();
+
+    if(key != nullptr)
+    {
+        cache_store(key, piece.first, piece.log, piece.dead);
+        cache_free(key);
+    }
+}
+
+/* error_catch takes a C callback */
+void optimize_piece(void *piece)
+{
+    optimize_function(*static_cast<Piece*>(piece));
+}
+
+/*
+    Optimise the functions among pieces on jobs threads. error() on a
+    worker would find no trap and end the process, so each worker traps
+    its own and stops taking functions; the first message comes back for
+    the caller to report, and the pieces left undone keep no log.
+*/
+char *optimize_pieces(std::vector<Piece> &pieces, int jobs)
+{
+    /* biggest functions first, so a long one does not start last */
+    std::vector<Piece*> work;
+    for(Piece &piece : pieces)
+    {
+        if(piece.function) work.push_back(&piece);
+    }
+    std::stable_sort(work.begin(), work.end(), [](const Piece *a, const Piece *b) {
+        return a->size > b->size;
+    });
+
+    if(jobs <= 0) jobs = static_cast<int>(std::thread::hardware_concurrency());
+    if(jobs <= 0) jobs = 1;
+    jobs = std::min(jobs, static_cast<int>(work.size()));
+
+    std::atomic<size_t> next(0);
+    std::vector<char*> failures(jobs, nullptr);
+    std::vector<std::thread> threads;
+    IR_STORE *store = ir_current();
+    for(int j = 0; j < jobs; ++j)
+    {
+        threads.emplace_back([&, j]() {
+            ir_adopt(store);
+            for(size_t i = next++; i < work.size(); i = next++)
+            {
+                if(error_catch(optimize_piece, work[i], &failures[j]) != 0)
+                {
+                    next = work.size();
+                    break;
+                }
+            }
+        });
+    }
+    for(std::thread &thread : threads) thread.join();
+
+    char *failure = nullptr;
+    for(char *message : failures)
+    {
+        if(failure == nullptr) failure = message;
+        else free(message);
+    }
+    return failure;
+}
+
+} // namespace
+
+extern "C" int pipeline_passes(const char *spec)
+{
+    const char *list = spec;
+    if(!strcmp(spec, "O0")) list = "";
+    else if(!strcmp(spec, "O1")) list = kO1;
+    else if(!strcmp(spec, "O2")) list = kO2;
+
+    Pipeline pipeline = make_pipeline(list);
+    for(const Pass *pass : pipeline.passes)
+    {
+        if(pass == nullptr) return -1;
+    }
+    g_pipeline = pipeline;
+    return 0;
+}
+
+extern "C" void pipeline_run(int jobs)
+{
+    std::vector<Piece> pieces = split_program();
+    char *failure = optimize_pieces(pieces, jobs);
+
+    {
+        std::vector<OPTLOG_CAPTURE*> logs;
+        std::vector<DEADCODE_REPORT*> reports;
+        for(Piece &piece : pieces)
+        {
+            if(!piece.function || piece.log == nullptr) continue;
+            logs.push_back(piece.log);
+            reports.push_back(piece.dead);
+        }
+        optlog_merge(logs.data(), static_cast<int>(logs.size()));
+        deadcode_merge(reports.data(), static_cast<int>(reports.size()));
+    }
+
+    if(failure != nullptr)
+    {
+        /* error_raise jumps out of here, past the destructors */
+        std::vector<Piece>().swap(pieces);
+        error_raise(failure);
+    }
+
+    join_program(pieces);
+    analysis_invalidate(ANALYSIS_ALL);
+}
@@ -0,0 +1,40 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "tac.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Optimise every function to a fixpoint of the chosen passes. No pass looks across
+    functions, so the list is cut into functions (label, BEGINFUNC ..
+    ENDFUNC) and the code between them, and the functions are shared out
+    over jobs threads, 0 meaning one per core. tac_first and tac_last and
+    the passes' own state are per thread, so each thread sees just the
+    function it is working on, while the TACs and constants they make
+    come from the calling thread's IR store. Pass logs, the dead code report and
+    profile samples are merged back in program order and the list is
+    joined up again, so the result does not depend on jobs. An error()
+    on a worker thread is reported from the calling thread, as if the
+    function had been optimised there.
+*/
+void pipeline_run(int jobs);
+
+/*
+    Choose the passes pipeline_run uses, in the order they run: "O0" for
+    none, "O1" for constfold,copyprop,sccp,deadcode, "O2" (the default)
+    for those with cse, licm and loopreduce, or a comma separated list of
+    constfold, copyprop, sccp, cse, licm, loopreduce, loopunroll and
+    deadcode.
+    Returns -1, changing nothing, if the list names something else. Call
+    it before compiling; the choice is shared by every thread.
+*/
+int pipeline_passes(const char *spec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PIPELINE_H */
@@ -33,4 +33,22 @@ for testcase in "$TEST_DIR"/*.m; do
 
 done
 
+# 缓存：在前面的函数里加一个if以后，后面的函数应当命中，生成的代码和不用缓存时一样
+echo -e "\n===== 运行测试: 函数缓存 ====="
+work="$(mktemp -d)"
+sed 's/^\t# 编辑处$/\tif(a > 0) { a = a - 1; }/' "$TEST_DIR/cache-later-functions.m" > "$work/edited.m"
+cp "$TEST_DIR/cache-later-functions.m" "$work/original.m"
+mkdir "$work/plain"
+cp "$work/edited.m" "$work/plain/edited.m"
+"$SCRIPT_DIR/mini" --cache="$work/cache" "$work/original.m" 2>/dev/null
+hits="$("$SCRIPT_DIR/mini" --cache="$work/cache" "$work/edited.m" 2>&1 >/dev/null | sed -n 's/^function cache: \([0-9]*\) hits.*/\1/p')"
+"$SCRIPT_DIR/mini" "$work/plain/edited.m" >/dev/null 2>&1
+if ! cmp -s "$work/original.m" "$work/edited.m" && [ "$hits" = "2" ] && cmp -s "$work/edited.s" "$work/plain/edited.s"; then
+    echo "===== 测试 函数缓存 成功 ====="
+else
+    echo "===== 测试 函数缓存 失败: 命中 ${hits:-?} 次，应为 2 =====" >&2
+    status=1
+fi
+rm -rf "$work"
+
 exit $status
@@ -0,0 +1,542 @@
+#include <vector>
+#include <string>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <climits>
+#include "sccp.h"
+#include "ssa.h"
+#include "optlog.h"
+#include "analysis.h"
+
+namespace {
+
+thread_local std::vector<std::string> *g_log = nullptr;
+
+void log_append(const std::string &line)
+{
+    if(g_log)
+    {
+        g_log->push_back(line);
+    }
+}
+
+bool is_renamed(const SYM *sym)
+{
+    return sym != nullptr && sym->type == SYM_VAR && sym->kind != SYM_KIND_GLOBAL;
+}
+
+SYM **def_slot(TAC *t)
+{
+    switch(t->op)
+    {
+        case TAC_ADD:
+        case TAC_SUB:
+        case TAC_MUL:
+        case TAC_DIV:
+        case TAC_EQ:
+        case TAC_NE:
+        case TAC_LT:
+        case TAC_LE:
+        case TAC_GT:
+        case TAC_GE:
+        case TAC_NEG:
+        case TAC_COPY:
+        case TAC_INPUT:
+        case TAC_CALL:
+            return t->a != nullptr ? &t->a : nullptr;
+        default:
+            return nullptr;
+    }
+}
+
+int use_slots(TAC *t, SYM **slots[2])
+{
+    switch(t->op)
+    {
+        case TAC_ADD:
+        case TAC_SUB:
+        case TAC_MUL:
+        case TAC_DIV:
+        case TAC_EQ:
+        case TAC_NE:
+        case TAC_LT:
+        case TAC_LE:
+        case TAC_GT:
+        case TAC_GE:
+            slots[0] = &t->b;
+            slots[1] = &t->c;
+            return 2;
+        case TAC_NEG:
+        case TAC_COPY:
+        case TAC_IFZ:
+            slots[0] = &t->b;
+            return 1;
+        case TAC_ACTUAL:
+        case TAC_RETURN:
+        case TAC_OUTPUT:
+            slots[0] = &t->a;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+template<typename F>
+void for_each_tac(BASIC_BLOCK *bb, F f)
+{
+    for(TAC *t = bb->first; t; t = t->next)
+    {
+        f(t);
+        if(t == bb->last) break;
+    }
+}
+
+void detach_tac(TAC *node)
+{
+    TAC *prev = node->prev;
+    TAC *next = node->next;
+    if(prev) prev->next = next; else tac_first = next;
+    if(next) next->prev = prev; else tac_last = prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+}
+
+const char *var_name(SsaForm &ssa, SYM *sym)
+{
+    auto it = ssa.values.find(sym);
+    SYM *var = it != ssa.values.end() ? it->second.var : sym;
+    return var->name != nullptr ? var->name : "<temp>";
+}
+
+const char *block_name(const BASIC_BLOCK *bb)
+{
+    return bb->label != nullptr ? bb->label->name : "<block>";
+}
+
+/* not yet known, one constant, or more than one value */
+enum class Level { Top, Constant, Bottom };
+
+struct Cell {
+    Level level = Level::Top;
+    int value = 0;
+
+    bool operator==(const Cell &other) const
+    {
+        return level == other.level && (level != Level::Constant || value == other.value);
+    }
+};
+
+Cell constant(int value)
+{
+    Cell cell;
+    cell.level = Level::Constant;
+    cell.value = value;
+    return cell;
+}
+
+Cell bottom()
+{
+    Cell cell;
+    cell.level = Level::Bottom;
+    return cell;
+}
+
+Cell meet(const Cell &a, const Cell &b)
+{
+    if(a.level == Level::Top) return b;
+    if(b.level == Level::Top) return a;
+    if(a.level == Level::Bottom || b.level == Level::Bottom) return bottom();
+    return a.value == b.value ? a : bottom();
+}
+
+/* what the machine would compute, wrapping; false where it would trap */
+bool fold(int op, int lhs, int rhs, int &value)
+{
+    unsigned l = static_cast<unsigned>(lhs), r = static_cast<unsigned>(rhs);
+    switch(op)
+    {
+        case TAC_ADD: value = static_cast<int>(l + r); return true;
+        case TAC_SUB: value = static_cast<int>(l - r); return true;
+        case TAC_MUL: value = static_cast<int>(l * r); return true;
+        case TAC_DIV:
+            if(rhs == 0 || (lhs == INT_MIN && rhs == -1)) return false;
+            value = lhs / rhs;
+            return true;
+        case TAC_EQ: value = lhs == rhs; return true;
+        case TAC_NE: value = lhs != rhs; return true;
+        case TAC_LT: value = lhs < rhs; return true;
+        case TAC_LE: value = lhs <= rhs; return true;
+        case TAC_GT: value = lhs > rhs; return true;
+        case TAC_GE: value = lhs >= rhs; return true;
+        default: return false;
+    }
+}
+
+struct Solver {
+    SsaForm &ssa;
+    std::unordered_map<SYM*, Cell> cells;
+    std::unordered_set<BASIC_BLOCK*> reached;
+    std::set<std::pair<BASIC_BLOCK*, BASIC_BLOCK*>> followed;
+    std::vector<std::pair<BASIC_BLOCK*, BASIC_BLOCK*>> flow;   /* edges followed but not yet visited */
+    std::vector<SYM*> changed;                                  /* values whose cell went down */
+
+    explicit Solver(SsaForm &form) : ssa(form) {}
+
+    /* a variable's value on entry, a global or anything but a variable is unknown */
+    Cell cell(SYM *sym) const
+    {
+        if(sym == nullptr) return bottom();
+        if(sym->type == SYM_INT) return constant(sym->value);
+        auto it = cells.find(sym);
+        if(it != cells.end()) return it->second;
+        auto value = ssa.values.find(sym);
+        if(value != ssa.values.end() && (value->second.def != nullptr || value->second.phi != nullptr)) return Cell();
+        return bottom();
+    }
+
+    void lower(SYM *sym, const Cell &to)
+    {
+        Cell old = cell(sym);
+        Cell now = meet(old, to);
+        if(now == old) return;
+        cells[sym] = now;
+        changed.push_back(sym);
+    }
+
+    void follow(BASIC_BLOCK *from, BASIC_BLOCK *to)
+    {
+        if(to == nullptr) return;
+        if(followed.insert(std::make_pair(from, to)).second) flow.push_back(std::make_pair(from, to));
+    }
+
+    Cell evaluate(TAC *t) const
+    {
+        switch(t->op)
+        {
+            case TAC_COPY:
+                return cell(t->b);
+            case TAC_NEG:
+            {
+                Cell x = cell(t->b);
+                if(x.level != Level::Constant) return x;
+                return constant(static_cast<int>(0u - static_cast<unsigned>(x.value)));
+            }
+            case TAC_INPUT:
+            case TAC_CALL:
+                return bottom();
+            default:
+            {
+                Cell x = cell(t->b), y = cell(t->c);
+                if(x.level == Level::Bottom || y.level == Level::Bottom) return bottom();
+                if(x.level == Level::Top || y.level == Level::Top) return Cell();
+                int value;
+                return fold(t->op, x.value, y.value, value) ? constant(value) : bottom();
+            }
+        }
+    }
+
+    /* the successors a block's last instruction can go to, as far as is known */
+    void visit_branch(BASIC_BLOCK *bb)
+    {
+        TAC *last = bb->last;
+        if(last->op == TAC_IFZ)
+        {
+            Cell cond = cell(last->b);
+            if(cond.level == Level::Top) return;
+            if(cond.level == Level::Constant)
+            {
+                BASIC_BLOCK *to = bb->next;
+                if(cond.value == 0)
+                {
+                    to = nullptr;
+                    for(BB_LIST *s = bb->succ; s; s = s->next)
+                    {
+                        if(s->bb->label == last->a) to = s->bb;
+                    }
+                }
+                follow(bb, to);
+                return;
+            }
+        }
+        for(BB_LIST *s = bb->succ; s; s = s->next) follow(bb, s->bb);
+    }
+
+    void visit_tac(TAC *t)
+    {
+        auto it = ssa.block_of.find(t);
+        if(it == ssa.block_of.end() || !reached.count(it->second)) return;
+        SYM **def = def_slot(t);
+        if(def != nullptr && is_renamed(*def)) lower(*def, evaluate(t));
+        if(t == it->second->last) visit_branch(it->second);
+    }
+
+    /* the values arriving over followed edges; on entry the variable's own value comes in too */
+    void visit_phi(SsaPhi *phi)
+    {
+        BASIC_BLOCK *bb = phi->block;
+        if(!reached.count(bb)) return;
+        if(bb->rpo == 0)
+        {
+            lower(phi->dst, bottom());
+            return;
+        }
+        Cell value;
+        int j = 0;
+        for(BB_LIST *p = bb->pred; p; p = p->next, ++j)
+        {
+            if(phi->args[j] == nullptr || !followed.count(std::make_pair(p->bb, bb))) continue;
+            value = meet(value, cell(phi->args[j]));
+        }
+        lower(phi->dst, value);
+    }
+
+    void visit_phis(BASIC_BLOCK *bb)
+    {
+        auto phis = ssa.phis.find(bb);
+        if(phis == ssa.phis.end()) return;
+        for(std::unique_ptr<SsaPhi> &phi : phis->second) visit_phi(phi.get());
+    }
+
+    void run()
+    {
+        for(SsaFunction &fn : ssa.functions)
+        {
+            BASIC_BLOCK *entry = fn.cfg->rpo[0];
+            reached.insert(entry);
+            visit_phis(entry);
+            for_each_tac(entry, [&](TAC *t) { visit_tac(t); });
+        }
+
+        while(!flow.empty() || !changed.empty())
+        {
+            if(!flow.empty())
+            {
+                BASIC_BLOCK *to = flow.back().second;
+                flow.pop_back();
+                if(reached.insert(to).second)
+                {
+                    visit_phis(to);
+                    for_each_tac(to, [&](TAC *t) { visit_tac(t); });
+                }
+                else
+                {
+                    visit_phis(to);
+                }
+                continue;
+            }
+
+            SYM *sym = changed.back();
+            changed.pop_back();
+            for(SsaUse &use : ssa.values[sym].uses)
+            {
+                if(use.tac != nullptr) visit_tac(use.tac); else visit_phi(use.phi);
+            }
+        }
+    }
+};
+
+struct Branch {
+    TAC *ifz;
+    int value;
+};
+
+/* literals for constant values while in SSA form; what to fold and delete afterwards */
+int rewrite(Solver &solver, std::vector<Branch> &branches, std::vector<TAC*> &dead)
+{
+    SsaForm &ssa = solver.ssa;
+    int changes = 0;
+    for(SsaFunction &fn : ssa.functions)
+    {
+        for(BASIC_BLOCK *bb : fn.blocks)
+        {
+            bool live = solver.reached.count(bb) != 0;
+
+            /* nothing comes over an edge never followed */
+            auto phis = ssa.phis.find(bb);
+            if(phis != ssa.phis.end())
+            {
+                for(std::unique_ptr<SsaPhi> &phi : phis->second)
+                {
+                    int j = 0;
+                    for(BB_LIST *p = bb->pred; p; p = p->next, ++j)
+                    {
+                        if(!live || !solver.followed.count(std::make_pair(p->bb, bb))) phi->args[j] = nullptr;
+                    }
+                }
+            }
+
+            if(!live)
+            {
+                size_t before = dead.size();
+                for_each_tac(bb, [&](TAC *t) {
+                    if(t->op != TAC_BEGINFUNC && t->op != TAC_ENDFUNC && t->op != TAC_VAR && t->op != TAC_FORMAL) dead.push_back(t);
+                });
+                if(dead.size() > before)
+                {
+                    std::ostringstream msg;
+                    msg << "removed unreachable block " << block_name(bb) << " (" << dead.size() - before << " instructions)";
+                    log_append(msg.str());
+                    ++changes;
+                }
+                continue;
+            }
+
+            for_each_tac(bb, [&](TAC *t) {
+                SYM **def = def_slot(t);
+                if(def != nullptr && is_renamed(*def))
+                {
+                    Cell value = solver.cell(*def);
+                    if(value.level == Level::Constant && !(t->op == TAC_COPY && t->b->type == SYM_INT))
+                    {
+                        t->op = TAC_COPY;
+                        t->b = mk_const(value.value);
+                        t->c = nullptr;
+                        ++changes;
+                        std::ostringstream msg;
+                        msg << var_name(ssa, *def) << " = " << value.value;
+                        log_append(msg.str());
+                        return;
+                    }
+                }
+
+                SYM **slots[2];
+                int n = use_slots(t, slots);
+                for(int k = 0; k < n; ++k)
+                {
+                    if(!is_renamed(*slots[k])) continue;
+                    Cell value = solver.cell(*slots[k]);
+                    if(value.level != Level::Constant) continue;
+                    std::ostringstream msg;
+                    msg << "replaced use of " << var_name(ssa, *slots[k]) << " with " << value.value;
+                    log_append(msg.str());
+                    *slots[k] = mk_const(value.value);
+                    ++changes;
+                }
+            });
+
+            TAC *last = bb->last;
+            if(last->op == TAC_IFZ)
+            {
+                Cell cond = solver.cell(last->b);
+                if(cond.level == Level::Constant) branches.push_back({ last, cond.value });
+            }
+        }
+    }
+    return changes;
+}
+
+} // namespace
+
+extern "C" void sccp_reset(void)
+{
+    g_log = nullptr;
+}
+
+extern "C" int sccp_run(void)
+{
+    std::vector<std::string> run_log;
+    g_log = &run_log;
+
+    SsaForm *ssa = ssa_build();
+    Solver solver(*ssa);
+    solver.run();
+    std::vector<Branch> branches;
+    std::vector<TAC*> dead;
+    int changes = rewrite(solver, branches, dead);
+    ssa_destroy(ssa);
+
+    for(const Branch &branch : branches)
+    {
+        TAC *t = branch.ifz;
+        std::ostringstream msg;
+        if(branch.value == 0)
+        {
+            t->op = TAC_GOTO;
+            t->b = nullptr;
+            msg << "constant ifz -> " << t->a->name << " (condition 0)";
+        }
+        else
+        {
+            detach_tac(t);
+            msg << "removed constant ifz -> " << t->a->name << " (condition " << branch.value << ")";
+        }
+        log_append(msg.str());
+        ++changes;
+    }
+    for(TAC *t : dead) detach_tac(t);
+    if(!branches.empty() || !dead.empty()) analysis_invalidate(ANALYSIS_ALL);
+
+    g_log = nullptr;
+
+    std::vector<const char*> raw;
+    raw.reserve(run_log.size());
+    for(const std::string &line : run_log)
+    {
+        raw.push_back(line.c_str());
+    }
+    optlog_record(OPT_PASS_SCCP,
+                  raw.empty() ? nullptr : raw.data(),
+                  static_cast<int>(raw.size()),
+                  changes);
+
+    return changes;
+}
+
+SccpLoopEntry sccp_loop_entry(void)
+{
+    SccpLoopEntry entry;
+    SsaForm *ssa = ssa_build();
+    Solver solver(*ssa);
+    solver.run();
+
+    for(SsaFunction &fn : ssa->functions)
+    {
+        for(CFG_LOOP *loop = fn.cfg->loop_list; loop; loop = loop->next)
+        {
+            BASIC_BLOCK *header = loop->header;
+            if(!solver.reached.count(header)) continue;
+            auto record = [&](SYM *var, const Cell &value) {
+                if(value.level == Level::Constant) entry.values[std::make_pair(header->first, var)] = value.value;
+            };
+
+            /* set in the loop: what the header's phi takes from outside */
+            auto phis = ssa->phis.find(header);
+            if(phis != ssa->phis.end())
+            {
+                for(std::unique_ptr<SsaPhi> &phi : phis->second)
+                {
+                    Cell value;
+                    int j = 0;
+                    for(BB_LIST *p = header->pred; p; p = p->next, ++j)
+                    {
+                        if(phi->args[j] == nullptr || cfg_loop_contains(loop, p->bb)) continue;
+                        if(!solver.followed.count(std::make_pair(p->bb, header))) continue;
+                        value = meet(value, solver.cell(phi->args[j]));
+                    }
+                    record(phi->var, value);
+                }
+            }
+
+            /* only read in the loop: the value defined before it */
+            for(BB_LIST *b = loop->blocks; b; b = b->next)
+            {
+                if(!solver.reached.count(b->bb)) continue;
+                for_each_tac(b->bb, [&](TAC *t) {
+                    SYM **slots[2];
+                    int n = use_slots(t, slots);
+                    for(int k = 0; k < n; ++k)
+                    {
+                        auto it = ssa->values.find(*slots[k]);
+                        if(it == ssa->values.end() || cfg_loop_contains(loop, it->second.block)) continue;
+                        record(it->second.var, solver.cell(*slots[k]));
+                    }
+                });
+            }
+        }
+    }
+
+    ssa_destroy(ssa);
+    return entry;
+}
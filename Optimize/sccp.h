@@ -0,0 +1,54 @@
+#ifndef SCCP_H
+#define SCCP_H
+
+#include <stdio.h>
+#include "tac.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Sparse conditional constant propagation (Wegman and Zadeck) over the
+    SSA form of ssa.h. Constants and reachability are found together: an
+    edge is only followed once its branch can go that way, and a phi only
+    meets the values arriving over followed edges, so a constant that
+    decides a branch also keeps the code behind the other side from
+    spoiling what it joins. Reads of constant values become literals and
+    definitions of them become copies of the literal; then, back out of
+    SSA form, ifz on a constant becomes a goto or goes, and blocks no
+    followed edge reaches are deleted.
+*/
+void sccp_reset(void);
+int sccp_run(void);
+
+#ifdef __cplusplus
+}
+
+#include <map>
+#include <utility>
+
+/*
+    Constants the variables hold whenever a loop is entered from outside,
+    keyed by the loop's header label and the variable, for the loop
+    passes' trip counts. Only variables the loop reads before setting, or
+    reads without setting at all, are there.
+*/
+struct SccpLoopEntry {
+    std::map<std::pair<TAC*, SYM*>, int> values;
+
+    bool find(TAC *header, SYM *var, int &value) const
+    {
+        auto it = values.find(std::make_pair(header, var));
+        if(it == values.end()) return false;
+        value = it->second;
+        return true;
+    }
+};
+
+/* solved on the code as it is now, which comes back unchanged */
+SccpLoopEntry sccp_loop_entry(void);
+
+#endif
+
+#endif /* SCCP_H */
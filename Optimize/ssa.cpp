@@ -0,0 +1,738 @@
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include "ssa.h"
+#include "analysis.h"
+#include "dataflow.h"
+
+namespace {
+
+bool is_renamed(const SYM *sym)
+{
+    return sym != nullptr && sym->type == SYM_VAR && sym->kind != SYM_KIND_GLOBAL;
+}
+
+/* the operand an instruction writes, NULL if none */
+SYM **def_slot(TAC *t)
+{
+    switch(t->op)
+    {
+        case TAC_ADD:
+        case TAC_SUB:
+        case TAC_MUL:
+        case TAC_DIV:
+        case TAC_EQ:
+        case TAC_NE:
+        case TAC_LT:
+        case TAC_LE:
+        case TAC_GT:
+        case TAC_GE:
+        case TAC_NEG:
+        case TAC_COPY:
+        case TAC_INPUT:
+        case TAC_CALL:
+            return t->a != nullptr ? &t->a : nullptr;
+        default:
+            return nullptr;
+    }
+}
+
+/* the operands an instruction reads, at most two */
+int use_slots(TAC *t, SYM **slots[2])
+{
+    switch(t->op)
+    {
+        case TAC_ADD:
+        case TAC_SUB:
+        case TAC_MUL:
+        case TAC_DIV:
+        case TAC_EQ:
+        case TAC_NE:
+        case TAC_LT:
+        case TAC_LE:
+        case TAC_GT:
+        case TAC_GE:
+            slots[0] = &t->b;
+            slots[1] = &t->c;
+            return 2;
+        case TAC_NEG:
+        case TAC_COPY:
+        case TAC_IFZ:
+            slots[0] = &t->b;
+            return 1;
+        case TAC_ACTUAL:
+        case TAC_RETURN:
+        case TAC_OUTPUT:
+            slots[0] = &t->a;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+template<typename F>
+void for_each_tac(BASIC_BLOCK *bb, F f)
+{
+    for(TAC *t = bb->first; t; t = t->next)
+    {
+        f(t);
+        if(t == bb->last) break;
+    }
+}
+
+int pred_count(const BASIC_BLOCK *bb)
+{
+    int n = 0;
+    for(BB_LIST *p = bb->pred; p; p = p->next) ++n;
+    return n;
+}
+
+void insert_before(TAC *pos, TAC *node)
+{
+    TAC *prev = pos->prev;
+    node->next = pos;
+    node->prev = prev;
+    pos->prev = node;
+    if(prev) prev->next = node; else tac_first = node;
+}
+
+void detach_tac(TAC *node)
+{
+    TAC *prev = node->prev;
+    TAC *next = node->next;
+    if(prev) prev->next = next; else tac_first = next;
+    if(next) next->prev = prev; else tac_last = prev;
+    node->prev = nullptr;
+    node->next = nullptr;
+}
+
+SYM *new_version(SsaForm &ssa, SsaFunction &fn, SYM *var)
+{
+    SYM *sym = mk_version(var, fn.next_id++, ++fn.versions[var]);
+    SsaValue &value = ssa.values[sym];
+    value.var = var;
+    value.def = nullptr;
+    value.phi = nullptr;
+    value.block = nullptr;
+    return sym;
+}
+
+/*
+    Construction
+*/
+
+void build_function(SsaForm &ssa, CFG_FUNCTION *func)
+{
+    if(func->blocks == nullptr || func->rpo_count == 0) return;
+
+    ssa.functions.emplace_back();
+    SsaFunction &fn = ssa.functions.back();
+    fn.cfg = func;
+    fn.begin = func->blocks->first->prev;
+    fn.blocks.resize(func->block_count);
+    for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next) fn.blocks[bb->id] = bb;
+    BASIC_BLOCK *entry = func->rpo[0];
+
+    /* every local the function mentions, reached or not, and the highest number in use */
+    std::unordered_map<SYM*, int> index;
+    int max_id = -1;
+    auto note = [&](SYM *sym) {
+        if(!is_renamed(sym)) return;
+        max_id = std::max(max_id, sym->id);
+        if(!index.emplace(sym, static_cast<int>(fn.vars.size())).second) return;
+        fn.vars.push_back(sym);
+        SsaValue &value = ssa.values[sym];
+        value.var = sym;
+        value.def = nullptr;
+        value.phi = nullptr;
+        value.block = entry;
+    };
+    for(BASIC_BLOCK *bb : fn.blocks)
+    {
+        for_each_tac(bb, [&](TAC *t) {
+            if(t->op == TAC_VAR || t->op == TAC_FORMAL) note(t->a);
+            SYM **def = def_slot(t);
+            if(def != nullptr) note(*def);
+            SYM **slots[2];
+            int n = use_slots(t, slots);
+            for(int k = 0; k < n; ++k) note(*slots[k]);
+            if(t->op == TAC_COPY && t->a == t->b) ssa.self_copies.insert(t);
+        });
+    }
+    fn.next_id = max_id + 1;
+    size_t var_count = fn.vars.size();
+    size_t block_count = fn.blocks.size();
+
+    /* blocks defining each variable, and the variables read before being set in some block */
+    std::vector<std::vector<int>> def_blocks(var_count);
+    std::vector<char> crosses(var_count, 0);
+    std::vector<int> set_in(var_count, -1);
+    for(int i = 0; i < func->rpo_count; ++i)
+    {
+        BASIC_BLOCK *bb = func->rpo[i];
+        for_each_tac(bb, [&](TAC *t) {
+            ssa.block_of[t] = bb;
+            SYM **slots[2];
+            int n = use_slots(t, slots);
+            for(int k = 0; k < n; ++k)
+            {
+                auto it = index.find(*slots[k]);
+                if(it != index.end() && set_in[it->second] != bb->id) crosses[it->second] = 1;
+            }
+            SYM **def = def_slot(t);
+            if(def == nullptr) return;
+            auto it = index.find(*def);
+            if(it == index.end() || set_in[it->second] == bb->id) return;
+            set_in[it->second] = bb->id;
+            def_blocks[it->second].push_back(bb->id);
+        });
+    }
+
+    /* dominance frontiers, after Cooper, Harvey and Kennedy */
+    std::vector<std::vector<int>> frontier(block_count);
+    for(int i = 0; i < func->rpo_count; ++i)
+    {
+        BASIC_BLOCK *bb = func->rpo[i];
+        if(pred_count(bb) < 2 && bb != entry) continue;
+        for(BB_LIST *p = bb->pred; p; p = p->next)
+        {
+            for(BASIC_BLOCK *runner = p->bb; runner != nullptr && runner->rpo >= 0 && runner != bb->idom; runner = runner->idom)
+            {
+                std::vector<int> &df = frontier[runner->id];
+                if(df.empty() || df.back() != bb->id) df.push_back(bb->id);
+            }
+        }
+    }
+
+    /* phis on the iterated frontiers */
+    std::vector<size_t> has_phi(block_count, 0), queued(block_count, 0);
+    for(size_t v = 0; v < var_count; ++v)
+    {
+        if(!crosses[v] || def_blocks[v].empty()) continue;
+        std::vector<int> work(def_blocks[v]);
+        for(int b : work) queued[b] = v + 1;
+        while(!work.empty())
+        {
+            int d = work.back();
+            work.pop_back();
+            for(int y : frontier[d])
+            {
+                if(has_phi[y] == v + 1) continue;
+                has_phi[y] = v + 1;
+                BASIC_BLOCK *bb = fn.blocks[y];
+                std::unique_ptr<SsaPhi> phi(new SsaPhi);
+                phi->dst = fn.vars[v];
+                phi->var = fn.vars[v];
+                phi->block = bb;
+                phi->args.assign(pred_count(bb), nullptr);
+                ssa.phis[bb].push_back(std::move(phi));
+                if(queued[y] != v + 1)
+                {
+                    queued[y] = v + 1;
+                    work.push_back(y);
+                }
+            }
+        }
+    }
+
+    /* rename down the dominator tree */
+    std::vector<std::vector<SYM*>> stack(var_count);
+    std::vector<int> pushed;
+    auto top = [&](int v) { return stack[v].empty() ? fn.vars[v] : stack[v].back(); };
+    auto define = [&](int v, BASIC_BLOCK *bb) {
+        SYM *sym = new_version(ssa, fn, fn.vars[v]);
+        ssa.values[sym].block = bb;
+        stack[v].push_back(sym);
+        pushed.push_back(v);
+        return sym;
+    };
+
+    struct Frame {
+        BASIC_BLOCK *bb;
+        BB_LIST *child;
+        size_t mark;
+    };
+    std::vector<Frame> frames;
+    auto enter = [&](BASIC_BLOCK *bb) {
+        frames.push_back({ bb, bb->dom_children, pushed.size() });
+
+        auto phis = ssa.phis.find(bb);
+        if(phis != ssa.phis.end())
+        {
+            for(std::unique_ptr<SsaPhi> &phi : phis->second)
+            {
+                phi->dst = define(index[phi->var], bb);
+                ssa.values[phi->dst].phi = phi.get();
+            }
+        }
+
+        for_each_tac(bb, [&](TAC *t) {
+            SYM **slots[2];
+            int n = use_slots(t, slots);
+            for(int k = 0; k < n; ++k)
+            {
+                auto it = index.find(*slots[k]);
+                if(it == index.end()) continue;
+                *slots[k] = top(it->second);
+                ssa.values[*slots[k]].uses.push_back({ t, nullptr, slots[k] });
+            }
+            SYM **def = def_slot(t);
+            if(def == nullptr) return;
+            auto it = index.find(*def);
+            if(it == index.end()) return;
+            *def = define(it->second, bb);
+            ssa.values[*def].def = t;
+        });
+
+        std::vector<BASIC_BLOCK*> done;
+        for(BB_LIST *s = bb->succ; s; s = s->next)
+        {
+            if(std::find(done.begin(), done.end(), s->bb) != done.end()) continue;
+            done.push_back(s->bb);
+            auto phis = ssa.phis.find(s->bb);
+            if(phis == ssa.phis.end()) continue;
+            int j = 0;
+            for(BB_LIST *p = s->bb->pred; p; p = p->next, ++j)
+            {
+                if(p->bb != bb) continue;
+                for(std::unique_ptr<SsaPhi> &phi : phis->second)
+                {
+                    phi->args[j] = top(index[phi->var]);
+                    ssa.values[phi->args[j]].uses.push_back({ nullptr, phi.get(), &phi->args[j] });
+                }
+            }
+        }
+    };
+
+    enter(entry);
+    while(!frames.empty())
+    {
+        Frame &frame = frames.back();
+        if(frame.child != nullptr)
+        {
+            BASIC_BLOCK *child = frame.child->bb;
+            frame.child = frame.child->next;
+            enter(child);
+            continue;
+        }
+        while(pushed.size() > frame.mark)
+        {
+            stack[pushed.back()].pop_back();
+            pushed.pop_back();
+        }
+        frames.pop_back();
+    }
+}
+
+/*
+    Destruction
+*/
+
+/* a split critical edge: ifz now goes to label, which falls into target */
+struct Split {
+    TAC *ifz;
+    SYM *target;
+    TAC *label;
+    TAC *skip;                      /* goto target over the new block, NULL if nothing fell into it */
+    TAC *target_label;
+};
+
+struct Destroyer {
+    SsaForm &ssa;
+    std::vector<Split> splits;
+    std::unordered_map<TAC*, std::vector<SYM*>> undefined;    /* phis given nothing over an edge, by the edge's last instruction */
+
+    explicit Destroyer(SsaForm &form) : ssa(form) {}
+
+    /* copies that all read before any writes, in an order that keeps that true */
+    void emit_parallel(SsaFunction &fn, std::vector<std::pair<SYM*, SYM*>> copies, TAC *pos)
+    {
+        /* a branch reading what the copies write reads a saved value instead */
+        if(pos->op == TAC_IFZ && is_renamed(pos->b))
+        {
+            for(const std::pair<SYM*, SYM*> &copy : copies)
+            {
+                if(copy.first != pos->b) continue;
+                SYM *saved = new_version(ssa, fn, ssa.values[pos->b].var);
+                emit(saved, pos->b, pos);
+                pos->b = saved;
+                break;
+            }
+        }
+
+        copies.erase(std::remove_if(copies.begin(), copies.end(),
+                                    [](const std::pair<SYM*, SYM*> &c) { return c.first == c.second; }),
+                     copies.end());
+        while(!copies.empty())
+        {
+            bool emitted = false;
+            for(size_t i = 0; i < copies.size(); ++i)
+            {
+                SYM *dst = copies[i].first;
+                bool read = false;
+                for(size_t k = 0; k < copies.size() && !read; ++k) read = k != i && copies[k].second == dst;
+                if(read) continue;
+                emit(dst, copies[i].second, pos);
+                copies.erase(copies.begin() + i);
+                emitted = true;
+                break;
+            }
+            if(emitted) continue;
+
+            /* only cycles are left: save one destination and read the saved value */
+            SYM *dst = copies[0].first;
+            SYM *saved = new_version(ssa, fn, ssa.values[dst].var);
+            emit(saved, dst, pos);
+            for(std::pair<SYM*, SYM*> &copy : copies)
+            {
+                if(copy.second == dst) copy.second = saved;
+            }
+        }
+    }
+
+    void emit(SYM *dst, SYM *src, TAC *pos)
+    {
+        TAC *copy = mk_tac(TAC_COPY, dst, src, nullptr);
+        insert_before(pos, copy);
+    }
+
+    void place_copies(SsaFunction &fn)
+    {
+        struct Edge {
+            BASIC_BLOCK *from;
+            BASIC_BLOCK *to;
+            std::vector<std::pair<SYM*, SYM*>> copies;
+        };
+        std::vector<Edge> critical;
+
+        for(BASIC_BLOCK *bb : fn.blocks)
+        {
+            auto phis = ssa.phis.find(bb);
+            if(phis == ssa.phis.end() || phis->second.empty()) continue;
+
+            /* on entry, the variables' own symbols */
+            if(bb == fn.cfg->rpo[0])
+            {
+                std::vector<std::pair<SYM*, SYM*>> copies;
+                for(std::unique_ptr<SsaPhi> &phi : phis->second) copies.emplace_back(phi->dst, phi->var);
+                emit_parallel(fn, copies, bb->first);
+            }
+
+            std::vector<BASIC_BLOCK*> done;
+            int j = 0;
+            for(BB_LIST *p = bb->pred; p; p = p->next, ++j)
+            {
+                BASIC_BLOCK *from = p->bb;
+                if(std::find(done.begin(), done.end(), from) != done.end()) continue;
+                done.push_back(from);
+
+                std::vector<std::pair<SYM*, SYM*>> copies;
+                for(std::unique_ptr<SsaPhi> &phi : phis->second)
+                {
+                    if(phi->args[j] != nullptr) copies.emplace_back(phi->dst, phi->args[j]);
+                    else undefined[from->last].push_back(phi->dst);
+                }
+                if(copies.empty()) continue;
+
+                bool one_way = true;
+                for(BB_LIST *s = from->succ; s; s = s->next) one_way = one_way && s->bb == bb;
+                TAC *last = from->last;
+                if(one_way)
+                {
+                    /* at the end of the block, before its jump */
+                    emit_parallel(fn, copies, (last->op == TAC_GOTO || last->op == TAC_IFZ) ? last : last->next);
+                }
+                else if(last->next == bb->first)
+                {
+                    /* falling through from an ifz: between the two, which only that path runs */
+                    emit_parallel(fn, copies, bb->first);
+                }
+                else
+                {
+                    critical.push_back({ from, bb, copies });
+                }
+            }
+        }
+
+        /* a block of its own just above the target for each branch into it */
+        for(Edge &edge : critical)
+        {
+            TAC *ifz = edge.from->last;
+            TAC *target = edge.to->first;
+            Split split;
+            split.ifz = ifz;
+            split.target = ifz->a;
+            split.target_label = target;
+            split.skip = nullptr;
+            int prev = target->prev != nullptr ? target->prev->op : TAC_UNDEF;
+            if(prev != TAC_GOTO && prev != TAC_RETURN)
+            {
+                split.skip = mk_tac(TAC_GOTO, ifz->a, nullptr, nullptr);
+                insert_before(target, split.skip);
+            }
+            split.label = mk_tac(TAC_LABEL, mk_pass_label(), nullptr, nullptr);
+            insert_before(target, split.label);
+            ifz->a = split.label->a;
+            emit_parallel(fn, edge.copies, target);
+            splits.push_back(split);
+        }
+    }
+
+    void coalesce(SsaFunction &fn, CFG_FUNCTION *func)
+    {
+        std::vector<BASIC_BLOCK*> blocks(func->block_count);
+        for(BASIC_BLOCK *bb = func->blocks; bb; bb = bb->next) blocks[bb->id] = bb;
+
+        /* every renamed symbol in the function, numbered */
+        std::unordered_map<SYM*, int> number;
+        std::vector<SYM*> syms;
+        auto note = [&](SYM *sym) {
+            if(!is_renamed(sym) || ssa.values.find(sym) == ssa.values.end()) return;
+            if(number.emplace(sym, static_cast<int>(syms.size())).second) syms.push_back(sym);
+        };
+        auto id_of = [&](SYM *sym) {
+            auto it = number.find(sym);
+            return it == number.end() ? -1 : it->second;
+        };
+        for(SYM *var : fn.vars) note(var);
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            for_each_tac(bb, [&](TAC *t) {
+                SYM **def = def_slot(t);
+                if(def != nullptr) note(*def);
+                SYM **slots[2];
+                int n = use_slots(t, slots);
+                for(int k = 0; k < n; ++k) note(*slots[k]);
+            });
+        }
+        size_t count = syms.size();
+        if(count == 0) return;
+
+        /* liveness over the blocks */
+        std::vector<std::vector<int>> succ(blocks.size()), pred(blocks.size());
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            for(BB_LIST *s = bb->succ; s; s = s->next)
+            {
+                succ[bb->id].push_back(s->bb->id);
+                pred[s->bb->id].push_back(bb->id);
+            }
+        }
+        auto def_of = [&](TAC *t) {
+            if(t->op == TAC_FORMAL) return id_of(t->a);
+            SYM **def = def_slot(t);
+            return def != nullptr ? id_of(*def) : -1;
+        };
+        DataflowProblem liveness;
+        liveness.direction = DataflowDirection::Backward;
+        liveness.meet = DataflowMeet::Union;
+        liveness.bits = count;
+        liveness.gen.resize(blocks.size());
+        liveness.kill.resize(blocks.size());
+
+        /* a phi given nothing over an edge has no value to keep alive before it */
+        std::vector<std::vector<int>> cut(blocks.size());
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            for_each_tac(bb, [&](TAC *t) {
+                auto it = undefined.find(t);
+                if(it == undefined.end()) return;
+                for(SYM *sym : it->second)
+                {
+                    int i = id_of(sym);
+                    if(i >= 0) cut[bb->id].push_back(i);
+                }
+            });
+        }
+
+        BitSet exposed(count), defined(count);
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            exposed.clear();
+            defined.clear();
+            for(int i : cut[bb->id]) defined.set(i);
+            for(TAC *t = bb->last; t; t = t->prev)
+            {
+                int d = def_of(t);
+                if(d >= 0)
+                {
+                    exposed.reset(d);
+                    defined.set(d);
+                }
+                SYM **slots[2];
+                int n = use_slots(t, slots);
+                for(int k = 0; k < n; ++k)
+                {
+                    int u = id_of(*slots[k]);
+                    if(u >= 0) exposed.set(u);
+                }
+                if(t == bb->first) break;
+            }
+            exposed.for_each([&](size_t i) { liveness.gen[bb->id].push_back(static_cast<int>(i)); });
+            defined.for_each([&](size_t i) { liveness.kill[bb->id].push_back(static_cast<int>(i)); });
+        }
+        DataflowResult live = dataflow_solve(liveness, succ, pred);
+
+        /* a definition interferes with whatever is live past it, but the source of a copy */
+        std::vector<std::unordered_set<int>> neighbours(count);
+        BitSet live_now(count);
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            live_now = live.out[bb->id];
+            for(int i : cut[bb->id]) live_now.reset(i);
+            for(TAC *t = bb->last; t; t = t->prev)
+            {
+                int d = def_of(t);
+                if(d >= 0)
+                {
+                    int src = t->op == TAC_COPY ? id_of(t->b) : -1;
+                    live_now.for_each([&](size_t i) {
+                        int n = static_cast<int>(i);
+                        if(n == d || n == src) return;
+                        neighbours[d].insert(n);
+                        neighbours[n].insert(d);
+                    });
+                    live_now.reset(d);
+                }
+                SYM **slots[2];
+                int n = use_slots(t, slots);
+                for(int k = 0; k < n; ++k)
+                {
+                    int u = id_of(*slots[k]);
+                    if(u >= 0) live_now.set(u);
+                }
+                if(t == bb->first) break;
+            }
+        }
+
+        /* classes of one variable's versions that never overlap */
+        std::vector<int> parent(count);
+        std::vector<std::vector<int>> members(count);
+        for(size_t i = 0; i < count; ++i)
+        {
+            parent[i] = static_cast<int>(i);
+            members[i].push_back(static_cast<int>(i));
+        }
+        std::function<int(int)> find = [&](int i) { return parent[i] == i ? i : parent[i] = find(parent[i]); };
+        auto family = [&](int i) { return ssa.values[syms[i]].var; };
+        auto try_merge = [&](int a, int b) {
+            a = find(a);
+            b = find(b);
+            if(a == b || family(a) != family(b)) return;
+            if(members[a].size() < members[b].size()) std::swap(a, b);
+            for(int m : members[b])
+            {
+                if(neighbours[a].count(m)) return;
+            }
+            parent[b] = a;
+            members[a].insert(members[a].end(), members[b].begin(), members[b].end());
+            members[b].clear();
+            neighbours[a].insert(neighbours[b].begin(), neighbours[b].end());
+            neighbours[b].clear();
+        };
+
+        /* copies first, so the ones that go away are the ones that can */
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            for_each_tac(bb, [&](TAC *t) {
+                if(t->op != TAC_COPY) return;
+                int a = id_of(t->a), b = id_of(t->b);
+                if(a >= 0 && b >= 0) try_merge(a, b);
+            });
+        }
+        std::unordered_map<SYM*, std::vector<int>> by_family;
+        for(size_t i = 0; i < count; ++i) by_family[family(static_cast<int>(i))].push_back(static_cast<int>(i));
+        for(auto &entry : by_family)
+        {
+            std::vector<int> &list = entry.second;
+            for(size_t i = 0; i < list.size(); ++i)
+            {
+                for(size_t k = i + 1; k < list.size(); ++k) try_merge(list[i], list[k]);
+            }
+        }
+
+        /* each class becomes its variable if the variable is in it, else its first member */
+        std::vector<SYM*> name(count, nullptr);
+        for(size_t i = 0; i < count; ++i)
+        {
+            int root = find(static_cast<int>(i));
+            if(name[root] == nullptr || syms[i] == family(root)) name[root] = syms[i];
+        }
+        std::vector<SYM*> declare;
+        for(size_t i = 0; i < count; ++i)
+        {
+            if(find(static_cast<int>(i)) == static_cast<int>(i) && name[i] != family(static_cast<int>(i))) declare.push_back(name[i]);
+        }
+        auto rename = [&](SYM **slot) {
+            int i = id_of(*slot);
+            if(i >= 0) *slot = name[find(i)];
+        };
+
+        std::vector<TAC*> dropped;
+        for(BASIC_BLOCK *bb : blocks)
+        {
+            for_each_tac(bb, [&](TAC *t) {
+                SYM **def = def_slot(t);
+                if(def != nullptr) rename(def);
+                SYM **slots[2];
+                int n = use_slots(t, slots);
+                for(int k = 0; k < n; ++k) rename(slots[k]);
+                if(t->op == TAC_COPY && t->a == t->b && !ssa.self_copies.count(t)) dropped.push_back(t);
+            });
+        }
+        for(TAC *t : dropped) detach_tac(t);
+
+        /* after the formals, like the parser's declarations */
+        TAC *pos = fn.begin->next;
+        while(pos->op == TAC_FORMAL) pos = pos->next;
+        for(SYM *sym : declare) insert_before(pos, mk_tac(TAC_VAR, sym, nullptr, nullptr));
+    }
+
+    /* take out split blocks left empty, nearest the target first */
+    void undo_empty_splits()
+    {
+        for(auto it = splits.rbegin(); it != splits.rend(); ++it)
+        {
+            if(it->label->next != it->target_label) continue;
+            it->ifz->a = it->target;
+            detach_tac(it->label);
+            if(it->skip != nullptr) detach_tac(it->skip);
+        }
+    }
+};
+
+} // namespace
+
+SsaForm *ssa_build(void)
+{
+    SsaForm *ssa = new SsaForm;
+    ssa->cfg = cfg_build_all();
+    for(CFG_FUNCTION *func = ssa->cfg->funcs; func; func = func->next) build_function(*ssa, func);
+    return ssa;
+}
+
+void ssa_destroy(SsaForm *ssa)
+{
+    Destroyer destroyer(*ssa);
+    for(SsaFunction &fn : ssa->functions) destroyer.place_copies(fn);
+
+    /* the functions in the same order, with the new edges */
+    CFG_ALL *all = cfg_build_all();
+    CFG_FUNCTION *func = all->funcs;
+    for(SsaFunction &fn : ssa->functions)
+    {
+        while(func != nullptr && func->blocks->first->prev != fn.begin) func = func->next;
+        if(func == nullptr) break;
+        destroyer.coalesce(fn, func);
+    }
+    cfg_free_all(all);
+    destroyer.undo_empty_splits();
+
+    analysis_invalidate(ANALYSIS_ALL);
+    cfg_free_all(ssa->cfg);
+    delete ssa;
+}
@@ -0,0 +1,79 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include "tac.h"
+#include "cfg.h"
+
+/*
+    SSA form of the functions in the TAC list, for passes that want
+    sparse, use-def driven algorithms. ssa_build gives every definition
+    of a local, formal or temporary a new version of the variable
+    (mk_version); globals keep their names, as any call may change them.
+    A variable's own symbol stands for its value on entry, so formals
+    and reads of unset locals need no definition. Phis go on the
+    iterated dominance frontiers of the blocks defining each variable
+    that is read in some block before being set there (semi-pruned
+    SSA). They are kept beside the code, a list per block, with one
+    argument per predecessor in the order of block->pred; an argument
+    from a block no path reaches is NULL. A phi in the entry block also
+    takes the variable's own symbol when the function is entered.
+
+    While the code is in SSA form a pass may rewrite operands, in TACs
+    and in phi arguments, and change what an instruction computes, but
+    must leave labels, jumps and the instructions themselves where they
+    are; use lists are not kept up to date. ssa_destroy turns the phis
+    into copies on the incoming edges, splitting critical edges where it
+    has to, then coalesces the versions of each variable whose live
+    ranges do not overlap back into one symbol, the variable's own
+    where it can. Code no pass changed comes back exactly as it was;
+    versions that have to stay apart get declarations of their own.
+*/
+
+struct SsaPhi {
+    SYM *dst;
+    SYM *var;                       /* the variable whose versions meet here */
+    BASIC_BLOCK *block;
+    std::vector<SYM*> args;
+};
+
+/* a read of a value: an operand of a TAC or an argument of a phi */
+struct SsaUse {
+    TAC *tac;                       /* NULL for a phi argument */
+    SsaPhi *phi;                    /* NULL for a TAC operand */
+    SYM **slot;
+};
+
+struct SsaValue {
+    SYM *var;                       /* the variable this is a version of, itself for the value on entry */
+    TAC *def;                       /* defining instruction, NULL for a phi or the value on entry */
+    SsaPhi *phi;
+    BASIC_BLOCK *block;             /* where it is defined, the entry block for the value on entry */
+    std::vector<SsaUse> uses;       /* in reached code, as ssa_build found them */
+};
+
+struct SsaFunction {
+    CFG_FUNCTION *cfg;
+    TAC *begin;                     /* its BEGINFUNC */
+    std::vector<BASIC_BLOCK*> blocks;   /* by id */
+    std::vector<SYM*> vars;         /* the variables renamed, in order of first mention */
+    int next_id;                    /* for the next version */
+    std::unordered_map<SYM*, int> versions;     /* versions made so far, by variable */
+};
+
+struct SsaForm {
+    CFG_ALL *cfg;
+    std::vector<SsaFunction> functions;
+    std::unordered_map<BASIC_BLOCK*, std::vector<std::unique_ptr<SsaPhi>>> phis;
+    std::unordered_map<SYM*, SsaValue> values;  /* every version, and every variable for its value on entry */
+    std::unordered_map<TAC*, BASIC_BLOCK*> block_of;    /* instructions of reached blocks */
+    std::unordered_set<TAC*> self_copies;       /* copies that read what they write before renaming */
+};
+
+SsaForm *ssa_build(void);
+void ssa_destroy(SsaForm *ssa);
+
+#endif /* SSA_H */
@@ -3,66 +3,327 @@
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "tac.h"
 
 /* global var */
-int scope, next_tmp, next_label;
-SYM *sym_tab_global, *sym_tab_local;
-TAC *tac_first, *tac_last;
+__thread int scope, next_tmp, next_label, next_global, next_local;
+__thread SYM *sym_tab_global, *sym_tab_local;
+__thread TAC *tac_first, *tac_last;
+__thread void (*tac_streamer)(TAC *first, TAC *last);
+
+/*
+	While parsing, code is passed around as fragments named by their last
+	TAC. Inside a fragment prev and next are the real links, except that
+	the last TAC's next points back at the first one (NULL when the
+	fragment is a single TAC), so join_tac never walks a fragment.
+*/
+#define FRAG_HEAD(t) ((t)->next!=NULL ? (t)->next : (t))
+
+/*
+	A symbol table is the scope's list (sym_tab_global or sym_tab_local,
+	newest first, the order asm_static walks) plus a hash index over the
+	names, chained through SYM.chain. Names are interned, so they are
+	hashed and compared by address. Buckets come from the IR arena and
+	double when the table is as full as it is wide.
+*/
+typedef struct sym_table
+{
+	SYM **list;
+	SYM **bucket;
+	unsigned size; /* power of two */
+	unsigned count;
+} SYM_TABLE;
+
+#define SYM_TABLE_MIN 64
+
+static __thread SYM_TABLE table_global, table_local;
+
+/*
+	Integer constants are interned by value in an open addressing pool
+	instead of the global table, so a repeated mk_const is one probe with
+	no name formatting or comparison.
+*/
+typedef struct const_pool
+{
+	SYM **slot;
+	unsigned size; /* power of two, at most half full */
+	unsigned count;
+} CONST_POOL;
+
+#define CONST_POOL_MIN 64
+#define CONST_NAME_MAX 12 /* "-2147483648" */
+
+struct ir_store
+{
+	ARENA arena; /* global SYMs and names */
+	ARENA locals; /* a function's own SYMs, labels and EXPs, see tac_stream */
+	ARENA tacs; /* TAC only, see tac_compact */
+	CONST_POOL consts;
+	int *labels; /* the owner's next_label, so labels made by passes follow the parser's */
+	pthread_mutex_t lock; /* passes running in parallel share the store */
+};
+
+static __thread IR_STORE own_store={ ARENA_INIT, ARENA_INIT, ARENA_INIT, { NULL, 0, 0 }, NULL, PTHREAD_MUTEX_INITIALIZER };
+static __thread IR_STORE *ir; /* own_store once tac_init has run, unless adopted */
+
+/*
+	Spellings from the lexer and temporary names are interned in an open
+	addressing pool, one copy of each in the IR arena.
+*/
+typedef struct str_pool
+{
+	char **slot;
+	unsigned size; /* power of two, at most half full */
+	unsigned count;
+} STR_POOL;
+
+#define STR_POOL_MIN 256
+
+static __thread STR_POOL pool_str;
 
 void tac_init()
 {
+	ir=&own_store;
 	scope=0;
 	sym_tab_global=NULL;
 	sym_tab_local=NULL;	
+	table_global.list=&sym_tab_global;
+	table_local.list=&sym_tab_local;
+	table_global.bucket=table_local.bucket=NULL;
+	table_global.size=table_local.size=0;
+	table_global.count=table_local.count=0;
+	ir->consts.slot=NULL;
+	ir->consts.size=ir->consts.count=0;
+	ir->labels=&next_label;
+	pool_str.slot=NULL;
+	pool_str.size=pool_str.count=0;
 	next_tmp=0;
 	next_label=1;
+	next_global=0;
+	next_local=0;
 }
 
 void tac_complete()
 {
-	TAC *cur=NULL; 		/* Current TAC */
-	TAC *prev=tac_last; 	/* Previous TAC */
+	if(tac_last==NULL)
+	{
+		tac_first=NULL;
+		return;
+	}
 
-	while(prev !=NULL)
+	/* the program is one fragment, its next links are already in place */
+	tac_first=FRAG_HEAD(tac_last);
+	tac_last->next=NULL;
+}
+
+/*
+	Lay the list out again as one array in program order, so walking
+	next steps through consecutive memory. Every TAC pointer taken before
+	the call is stale afterwards.
+*/
+void tac_compact()
+{
+	ARENA fresh=ARENA_INIT;
+	TAC *block, *t, *prev=NULL;
+	int n=0;
+
+	for(t=tac_first; t!=NULL; t=t->next) n++;
+	block=n ? (TAC *)arena_alloc(&fresh, n*sizeof(TAC)) : NULL;
+
+	n=0;
+	for(t=tac_first; t!=NULL; t=t->next)
 	{
-		prev->next=cur;
-		cur=prev;
-		prev=prev->prev;
+		block[n]=*t;
+		block[n].prev=prev;
+		block[n].next=NULL;
+		if(prev!=NULL) prev->next=&block[n];
+		prev=&block[n++];
 	}
 
-	tac_first = cur;
+	arena_release(&ir->tacs);
+	ir->tacs=fresh;
+	tac_first=block;
+	tac_last=prev;
 }
 
-SYM *lookup_sym(SYM *symtab, char *name)
+/* all IR of the compilation goes at once */
+void tac_release()
 {
-	SYM *t=symtab;
+	arena_release(&ir->tacs);
+	arena_release(&ir->locals);
+	arena_release(&ir->arena);
+	tac_init();
+	tac_first=NULL;
+	tac_last=NULL;
+}
 
+IR_STORE *ir_current()
+{
+	return ir;
+}
+
+/* make IR on this thread out of another thread's store */
+void ir_adopt(IR_STORE *store)
+{
+	ir=store;
+}
+
+static unsigned hash_bytes(const char *s, int len)
+{
+	unsigned h=5381;
+
+	while(len-- > 0) h=h*33+(unsigned char)*s++;
+	return h;
+}
+
+static unsigned hash_name(const char *name)
+{
+	unsigned long h=(unsigned long)name >> 3;
+
+	h*=2654435761u;
+	return (unsigned)(h ^ (h>>16));
+}
+
+static char **str_find(STR_POOL *pool, const char *s, int len)
+{
+	unsigned i=hash_bytes(s, len) & (pool->size-1);
+
+	while(pool->slot[i]!=NULL
+		&& (strncmp(pool->slot[i], s, len)!=0 || pool->slot[i][len]!='\0'))
+		i=(i+1) & (pool->size-1);
+	return &pool->slot[i];
+}
+
+static void str_grow(STR_POOL *pool)
+{
+	char **old=pool->slot;
+	unsigned old_size=pool->size, i;
+
+	pool->size=old_size ? old_size*2 : STR_POOL_MIN;
+	pool->slot=(char **)arena_alloc(&ir->arena, pool->size*sizeof(char *));
+	for(i=0; i<old_size; i++)
+	{
+		if(old[i]!=NULL) *str_find(pool, old[i], strlen(old[i]))=old[i];
+	}
+}
+
+/* the one copy of s[0..len), which need not be NUL terminated */
+char *intern(const char *s, int len)
+{
+	char **slot;
+	char *copy;
+
+	if(pool_str.slot==NULL) str_grow(&pool_str);
+
+	slot=str_find(&pool_str, s, len);
+	if(*slot!=NULL) return *slot;
+
+	copy=(char *)arena_alloc(&ir->arena, len+1);
+	memcpy(copy, s, len);
+	copy[len]='\0';
+	*slot=copy;
+
+	if(++pool_str.count*2 > pool_str.size) str_grow(&pool_str);
+	return copy;
+}
+
+static void table_grow(SYM_TABLE *table)
+{
+	unsigned size=table->size ? table->size*2 : SYM_TABLE_MIN;
+	SYM *s;
+
+	table->bucket=(SYM **)arena_alloc(&ir->arena, size*sizeof(SYM *));
+	table->size=size;
+
+	/* rechain oldest first so each bucket keeps newest at its head */
+	SYM *rev=NULL, *next;
+	for(s=*table->list; s!=NULL; s=next)
+	{
+		next=s->next;
+		s->chain=rev;
+		rev=s;
+	}
+	for(s=rev; s!=NULL; s=next)
+	{
+		unsigned h=hash_name(s->name) & (size-1);
+		next=s->chain;
+		s->chain=table->bucket[h];
+		table->bucket[h]=s;
+	}
+}
+
+static void table_clear(SYM_TABLE *table)
+{
+	SYM *s;
+
+	if(table->bucket!=NULL)
+	{
+		for(s=*table->list; s!=NULL; s=s->next)
+			table->bucket[hash_name(s->name) & (table->size-1)]=NULL;
+	}
+	*table->list=NULL;
+	table->count=0;
+}
+
+SYM *lookup_sym(SYM_TABLE *table, char *name)
+{
+	SYM *t;
+
+	if(table->bucket==NULL) return NULL;
+
+	t=table->bucket[hash_name(name) & (table->size-1)];
 	while(t !=NULL)
 	{
-		if(strcmp(t->name, name)==0) break; 
-		else t=t->next;
+		if(t->name==name) break; 
+		else t=t->chain;
 	}
 	
 	return t; /* NULL if not found */
 }
 
-void insert_sym(SYM **symtab, SYM *sym)
+void insert_sym(SYM_TABLE *table, SYM *sym)
+{
+	unsigned h;
+
+	sym->next=*table->list; /* Insert at head */
+	*table->list=sym;
+
+	if(++table->count > table->size)
+	{
+		table_grow(table); /* chains the new symbol too */
+		return;
+	}
+	h=hash_name(sym->name) & (table->size-1);
+	sym->chain=table->bucket[h];
+	table->bucket[h]=sym;
+}
+
+/* enter and leave a function's local scope */
+void scope_push()
 {
-	sym->next=*symtab; /* Insert at head */
-	*symtab=sym;
+	table_clear(&table_local);
+	scope=1;
+	next_local=0;
+}
+
+void scope_pop()
+{
+	table_clear(&table_local);
+	scope=0;
+}
+
+static SYM *sym_in(ARENA *a)
+{
+	SYM *sym=(SYM *)arena_alloc(a, sizeof(SYM));
+
+	sym->id=-1;
+	return sym;
 }
 
 SYM *mk_sym(void)
 {
-	SYM *t;
-	t=(SYM *)malloc(sizeof(SYM));
-	if(t==NULL)
-	{
-		error("out of memory allocating symbol\n");
-	}
-	memset(t, 0, sizeof(SYM));
-	return t;
+	return sym_in(&ir->arena);
 }
 
 SYM *mk_var(char *name)
@@ -70,9 +331,9 @@ SYM *mk_var(char *name)
 	SYM *sym=NULL;
 
 	if(scope)  
-		sym=lookup_sym(sym_tab_local,name);
+		sym=lookup_sym(&table_local,name);
 	else
-		sym=lookup_sym(sym_tab_global,name);
+		sym=lookup_sym(&table_global,name);
 
 	/* var already declared */
 	if(sym!=NULL)
@@ -82,35 +343,59 @@ SYM *mk_var(char *name)
 	}
 
 	/* var unseen before, set up a new symbol table node, insert_sym it into the symbol table. */
-	sym=mk_sym();
+	sym=sym_in(scope ? &ir->locals : &ir->arena);
 	sym->type=SYM_VAR;
 	sym->name=name;
 	sym->offset=-1; /* Unset address */
+	sym->kind=scope ? SYM_KIND_LOCAL : SYM_KIND_GLOBAL;
+	sym->id=scope ? next_local++ : next_global++; /* passes index flat arrays by it */
 
 	if(scope)  
-		insert_sym(&sym_tab_local,sym);
+		insert_sym(&table_local,sym);
 	else
-		insert_sym(&sym_tab_global,sym);
+		insert_sym(&table_global,sym);
 
 	return sym;
 }
 
 TAC *join_tac(TAC *c1, TAC *c2)
 {
-	TAC *t;
+	TAC *head1, *head2;
 
 	if(c1==NULL) return c2;
 	if(c2==NULL) return c1;
 
-	/* Run down c2, until we get to the beginning and then add c1 */
-	t=c2;
-	while(t->prev !=NULL) 
-		t=t->prev;
-
-	t->prev=c1;
+	head1=FRAG_HEAD(c1);
+	head2=FRAG_HEAD(c2);
+	c1->next=head2;
+	head2->prev=c1;
+	c2->next=head1;
 	return c2;
 }
 
+/*
+	Give a complete top-level declaration or function to tac_streamer, if
+	there is one, then drop its TACs and local symbols. The parser holds
+	no other code at that point, so nothing else lives in the TAC store
+	or the locals arena, and memory stays as small as the biggest
+	function.
+*/
+TAC *tac_stream(TAC *code)
+{
+	TAC *first;
+
+	if(tac_streamer==NULL || code==NULL) return code;
+
+	first=FRAG_HEAD(code);
+	first->prev=NULL;
+	code->next=NULL;
+	tac_streamer(first, code);
+
+	arena_release(&ir->tacs);
+	arena_release(&ir->locals);
+	return NULL;
+}
+
 TAC *declare_var(char *name)
 {
 	return mk_tac(TAC_VAR,mk_var(name),NULL,NULL);
@@ -118,7 +403,11 @@ TAC *declare_var(char *name)
 
 TAC *mk_tac(int op, SYM *a, SYM *b, SYM *c)
 {
-	TAC *t=(TAC *)malloc(sizeof(TAC));
+	TAC *t;
+
+	pthread_mutex_lock(&ir->lock);
+	t=(TAC *)arena_alloc(&ir->tacs, sizeof(TAC));
+	pthread_mutex_unlock(&ir->lock);
 
 	t->next=NULL; /* Set these for safety */
 	t->prev=NULL;
@@ -132,10 +421,10 @@ TAC *mk_tac(int op, SYM *a, SYM *b, SYM *c)
 
 SYM *mk_label(char *name)
 {
-	SYM *t=mk_sym();
+	SYM *t=sym_in(&ir->locals);
 
 	t->type=SYM_LABEL;
-	t->name=strdup(name);
+	t->name=arena_strdup(&ir->locals, name);
 
 	return t;
 }  
@@ -152,33 +441,70 @@ TAC *do_func(SYM *func, TAC *args, TAC *code)
 	tbegin=mk_tac(TAC_BEGINFUNC, NULL, NULL, NULL);
 	tend=mk_tac(TAC_ENDFUNC,   NULL, NULL, NULL);
 
-	tbegin->prev=tlab;
+	tbegin=join_tac(tlab, tbegin);
 	code=join_tac(args, code);
-	tend->prev=join_tac(tbegin, code);
+	tend=join_tac(join_tac(tbegin, code), tend);
 
 	return tend;
 }
 
-SYM *mk_tmp(void)
+/* a label with a new number, for a pass */
+SYM *mk_pass_label(void)
+{
+	SYM *sym;
+
+	pthread_mutex_lock(&ir->lock);
+	sym=mk_label(mk_lstr((*ir->labels)++));
+	pthread_mutex_unlock(&ir->lock);
+	return sym;
+}
+
+/* version n of the local var, numbered id among its function's variables, for a pass */
+SYM *mk_version(SYM *var, int id, int n)
 {
 	SYM *sym;
 	char *name;
 
-	name=malloc(12);
-	sprintf(name, "t%d", next_tmp++); /* Set up text */
-	return mk_var(name);
+	pthread_mutex_lock(&ir->lock);
+	sym=sym_in(&ir->locals);
+	name=(char *)arena_alloc(&ir->locals, strlen(var->name)+12);
+	pthread_mutex_unlock(&ir->lock);
+
+	sprintf(name, "%s.%d", var->name, n);
+	sym->type=SYM_VAR;
+	sym->kind=var->kind==SYM_KIND_TEMP ? SYM_KIND_TEMP : SYM_KIND_LOCAL;
+	sym->id=id;
+	sym->scope=1;
+	sym->name=name;
+	sym->offset=-1;
+	return sym;
+}
+
+SYM *mk_tmp(void)
+{
+	char name[12];
+	int len;
+	SYM *sym;
+
+	len=sprintf(name, "t%d", next_tmp++); /* Set up text */
+	sym=mk_var(intern(name, len));
+	sym->kind=SYM_KIND_TEMP;
+	return sym;
 }
 
 TAC *declare_para(char *name)
 {
-	return mk_tac(TAC_FORMAL,mk_var(name),NULL,NULL);
+	SYM *sym=mk_var(name);
+
+	sym->kind=SYM_KIND_FORMAL;
+	return mk_tac(TAC_FORMAL,sym,NULL,NULL);
 }
 
 SYM *declare_func(char *name)
 {
 	SYM *sym=NULL;
 
-	sym=lookup_sym(sym_tab_global,name);
+	sym=lookup_sym(&table_global,name);
 
 	/* name used before declared */
 	if(sym!=NULL)
@@ -204,7 +530,7 @@ SYM *declare_func(char *name)
 	sym->name=name;
 	sym->address=NULL;
 
-	insert_sym(&sym_tab_global,sym);
+	insert_sym(&table_global,sym);
 	return sym;
 }
 
@@ -215,7 +541,7 @@ TAC *do_assign(SYM *var, EXP *exp)
 	if(var->type !=SYM_VAR) error("assignment to non-variable");
 
 	code=mk_tac(TAC_COPY, var, exp->ret, NULL);
-	code->prev=exp->tac;
+	code=join_tac(exp->tac, code);
 
 	return code;
 }
@@ -276,9 +602,9 @@ EXP *do_bin( int binop, EXP *exp1, EXP *exp2)
 	*/
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=join_tac(exp1->tac, exp2->tac);
+	temp=join_tac(join_tac(exp1->tac, exp2->tac), temp);
 	ret=mk_tac(binop, temp->a, exp1->ret, exp2->ret);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp1->ret=temp->a;
 	exp1->tac=ret;
@@ -292,9 +618,9 @@ EXP *do_cmp( int binop, EXP *exp1, EXP *exp2)
 	TAC *ret; /* TAC code for result */
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=join_tac(exp1->tac, exp2->tac);
+	temp=join_tac(join_tac(exp1->tac, exp2->tac), temp);
 	ret=mk_tac(binop, temp->a, exp1->ret, exp2->ret);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp1->ret=temp->a;
 	exp1->tac=ret;
@@ -308,9 +634,9 @@ EXP *do_un( int unop, EXP *exp)
 	TAC *ret; /* TAC code for result */
 
 	temp=mk_tac(TAC_VAR, mk_tmp(), NULL, NULL);
-	temp->prev=exp->tac;
+	temp=join_tac(exp->tac, temp);
 	ret=mk_tac(unop, temp->a, exp->ret, NULL);
-	ret->prev=temp;
+	ret=join_tac(temp, ret);
 
 	exp->ret=temp->a;
 	exp->tac=ret;
@@ -330,15 +656,15 @@ TAC *do_call(char *name, EXP *arglist)
 	while(arglist !=NULL) /* Generate ARG instructions */
 	{
 		temp=mk_tac(TAC_ACTUAL, arglist->ret, NULL, NULL);
-		temp->prev=code;
+		temp=join_tac(code, temp);
 		code=temp;
 
 		alt=arglist->next;
 		arglist=alt;
 	};
 
-	temp=mk_tac(TAC_CALL, NULL, (SYM *)strdup(name), NULL);
-	temp->prev=code;
+	temp=mk_tac(TAC_CALL, NULL, (SYM *)name, NULL);
+	temp=join_tac(code, temp);
 	code=temp;
 
 	return code;
@@ -359,15 +685,15 @@ EXP *do_call_ret(char *name, EXP *arglist)
 	while(arglist !=NULL) /* Generate ARG instructions */
 	{
 		temp=mk_tac(TAC_ACTUAL, arglist->ret, NULL, NULL);
-		temp->prev=code;
+		temp=join_tac(code, temp);
 		code=temp;
 
 		alt=arglist->next;
 		arglist=alt;
 	};
 
-	temp=mk_tac(TAC_CALL, ret, (SYM *)strdup(name), NULL);
-	temp->prev=code;
+	temp=mk_tac(TAC_CALL, ret, (SYM *)name, NULL);
+	temp=join_tac(code, temp);
 	code=temp;
 
 	return mk_exp(NULL, ret, code);
@@ -377,7 +703,7 @@ char *mk_lstr(int i)
 {
 	char lstr[10]="L";
 	sprintf(lstr,"L%d",i);
-	return(strdup(lstr));	
+	return(arena_strdup(&ir->locals, lstr));	
 }
 
 TAC *do_if(EXP *exp, TAC *stmt)
@@ -385,9 +711,9 @@ TAC *do_if(EXP *exp, TAC *stmt)
 	TAC *label=mk_tac(TAC_LABEL, mk_label(mk_lstr(next_label++)), NULL, NULL);
 	TAC *code=mk_tac(TAC_IFZ, label->a, exp->ret, NULL);
 
-	code->prev=exp->tac;
+	code=join_tac(exp->tac, code);
 	code=join_tac(code, stmt);
-	label->prev=code;
+	label=join_tac(code, label);
 
 	return label;
 }
@@ -399,12 +725,12 @@ TAC *do_test(EXP *exp, TAC *stmt1, TAC *stmt2)
 	TAC *code1=mk_tac(TAC_IFZ, label1->a, exp->ret, NULL);
 	TAC *code2=mk_tac(TAC_GOTO, label2->a, NULL, NULL);
 
-	code1->prev=exp->tac; /* Join the code */
+	code1=join_tac(exp->tac, code1); /* Join the code */
 	code1=join_tac(code1, stmt1);
-	code2->prev=code1;
-	label1->prev=code2;
+	code2=join_tac(code1, code2);
+	label1=join_tac(code2, label1);
 	label1=join_tac(label1, stmt2);
-	label2->prev=label1;
+	label2=join_tac(label1, label2);
 	
 	return label2;
 }
@@ -414,7 +740,7 @@ TAC *do_while(EXP *exp, TAC *stmt)
 	TAC *label=mk_tac(TAC_LABEL, mk_label(mk_lstr(next_label++)), NULL, NULL);
 	TAC *code=mk_tac(TAC_GOTO, label->a, NULL, NULL);
 
-	code->prev=stmt; /* Bolt on the goto */
+	code=join_tac(stmt, code); /* Bolt on the goto */
 
 	return join_tac(label, do_if(exp, code));
 }
@@ -423,9 +749,9 @@ SYM *get_var(char *name)
 {
 	SYM *sym=NULL; /* Pointer to looked up symbol */
 
-	if(scope) sym=lookup_sym(sym_tab_local,name);
+	if(scope) sym=lookup_sym(&table_local,name);
 
-	if(sym==NULL) sym=lookup_sym(sym_tab_global,name);
+	if(sym==NULL) sym=lookup_sym(&table_global,name);
 
 	if(sym==NULL)
 	{
@@ -444,7 +770,7 @@ SYM *get_var(char *name)
 
 EXP *mk_exp(EXP *next, SYM *ret, TAC *code)
 {
-	EXP *exp=(EXP *)malloc(sizeof(EXP));
+	EXP *exp=(EXP *)arena_alloc(&ir->locals, sizeof(EXP));
 
 	exp->next=next;
 	exp->ret=ret;
@@ -457,7 +783,7 @@ SYM *mk_text(char *text)
 {
 	SYM *sym=NULL; /* Pointer to looked up symbol */
 
-	sym=lookup_sym(sym_tab_global,text);
+	sym=lookup_sym(&table_global,text);
 
 	/* text already used */
 	if(sym!=NULL)
@@ -471,28 +797,64 @@ SYM *mk_text(char *text)
 	sym->name=text;
 	sym->label=next_label++;
 
-	insert_sym(&sym_tab_global,sym);
+	insert_sym(&table_global,sym);
 	return sym;
 }
 
-SYM *mk_const(int n)
+static SYM **pool_find(CONST_POOL *pool, int n)
 {
-	SYM *sym=NULL;
+	unsigned h=(unsigned)n*2654435761u;
+	unsigned i=(h ^ (h>>16)) & (pool->size-1);
 
-	char name[10];
-	sprintf(name, "%d", n);
+	while(pool->slot[i]!=NULL && pool->slot[i]->value!=n)
+		i=(i+1) & (pool->size-1);
+	return &pool->slot[i];
+}
 
-	sym=lookup_sym(sym_tab_global, name);
-	if(sym!=NULL)
+static void pool_grow(CONST_POOL *pool)
+{
+	SYM **old=pool->slot;
+	unsigned old_size=pool->size, i;
+
+	pool->size=old_size ? old_size*2 : CONST_POOL_MIN;
+	pool->slot=(SYM **)arena_alloc(&ir->arena, pool->size*sizeof(SYM *));
+	for(i=0; i<old_size; i++)
 	{
-		return sym;
+		if(old[i]!=NULL) *pool_find(pool, old[i]->value)=old[i];
 	}
+}
 
-	sym=mk_sym();
-	sym->type=SYM_INT;
-	sym->value=n;
-	sym->name=strdup(name);
-	insert_sym(&sym_tab_global,sym);
+/* the pooled symbol for n, or a free slot to put it in */
+static SYM **pool_slot(CONST_POOL *pool, int n)
+{
+	if(pool->slot==NULL) pool_grow(pool);
+	return pool_find(pool, n);
+}
+
+static void pool_add(CONST_POOL *pool, SYM **slot, SYM *sym)
+{
+	*slot=sym;
+	if(++pool->count*2 > pool->size) pool_grow(pool);
+}
+
+SYM *mk_const(int n)
+{
+	SYM **slot;
+	SYM *sym;
+
+	pthread_mutex_lock(&ir->lock);
+	slot=pool_slot(&ir->consts, n);
+	sym=*slot;
+	if(sym==NULL)
+	{
+		sym=mk_sym();
+		sym->type=SYM_INT;
+		sym->value=n;
+		sym->name=(char *)arena_alloc(&ir->arena, CONST_NAME_MAX);
+		sprintf(sym->name, "%d", n);
+		pool_add(&ir->consts, slot, sym);
+	}
+	pthread_mutex_unlock(&ir->lock);
 
 	return sym;
 }     
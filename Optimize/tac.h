@@ -3,6 +3,7 @@
 #define TAC_H
 
 #include <stdio.h>
+#include "arena.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,6 +17,16 @@ extern "C" {
 #define SYM_INT 4
 #define SYM_LABEL 5
 
+/* kind of SYM_VAR */
+#define SYM_KIND_NONE 0 /* not a variable */
+#define SYM_KIND_GLOBAL 1
+#define SYM_KIND_LOCAL 2
+#define SYM_KIND_FORMAL 3
+#define SYM_KIND_TEMP 4
+
+/* globals and one function's variables number from 0 apart, so interleave them */
+#define SYM_INDEX(s) (((s)->id<<1) | ((s)->kind==SYM_KIND_GLOBAL))
+
 /* type of tac */ 
 #define TAC_UNDEF 0 /* undefine */
 #define TAC_ADD 1 /* a=b+c */
@@ -54,6 +65,8 @@ typedef struct sym
 		type:SYM_TEXT name:"hello" label:10
 	*/
 	int type;
+	int kind; /* SYM_KIND_* */
+	int id; /* SYM_VAR: index among the globals or among its function's variables, else -1 */
 	int scope; /* 0:global, 1:local */
 	char *name;
 	int offset;
@@ -61,6 +74,7 @@ typedef struct sym
 	int label;
 	struct tac *address; /* SYM_FUNC */	
 	struct sym *next;
+	struct sym *chain; /* next in symbol table hash bucket */
 	void *etc;
 } SYM;
 
@@ -83,20 +97,47 @@ typedef struct exp
 	void *etc;
 } EXP;
 
-/* global var */
-extern FILE *file_x, *file_s;
-extern int yylineno, scope, next_tmp, next_label;
-extern SYM *sym_tab_global, *sym_tab_local;
-extern TAC *tac_first, *tac_last;
+/*
+	The arenas and constant pool a compilation's IR comes from. Each
+	compiling thread has its own; pipeline workers adopt the store of the
+	thread that started them, so what they make goes with the rest.
+*/
+typedef struct ir_store IR_STORE;
+
+/* global var, one set per compiling thread, see compile.h */
+extern __thread FILE *file_x, *file_s;
+extern __thread int scope, next_tmp, next_label, next_global, next_local;
+extern __thread SYM *sym_tab_global, *sym_tab_local;
+extern __thread TAC *tac_first, *tac_last; /* per thread, see pipeline.h */
+
+/*
+	When set, each top-level declaration or function is handed over as a
+	list of its own as soon as it is parsed instead of joining the
+	program, see tac_stream.
+*/
+extern __thread void (*tac_streamer)(TAC *first, TAC *last);
 
 /* function */
 void tac_init();
 void tac_complete();
+void tac_compact();
+void tac_release();
+IR_STORE *ir_current();
+void ir_adopt(IR_STORE *store);
+char *intern(const char *s, int len);
+void *lex_open(char *path);
+void *lex_open_text(const char *text, size_t len);
+void lex_close(void *scanner);
+void scope_push();
+void scope_pop();
 TAC *join_tac(TAC *c1, TAC *c2);
+TAC *tac_stream(TAC *code);
 void out_str(FILE *f, const char *format, ...);
 void out_sym(FILE *f, SYM *s);
 void out_tac(FILE *f, TAC *i);
 SYM *mk_label(char *name);
+SYM *mk_pass_label(void);
+SYM *mk_version(SYM *var, int id, int n);
 SYM *mk_tmp(void);
 SYM *mk_const(int n);
 SYM *mk_text(char *text);
@@ -120,6 +161,10 @@ EXP *do_cmp( int binop, EXP *exp1, EXP *exp2);
 EXP *do_un( int unop, EXP *exp);
 EXP *do_call_ret(char *name, EXP *arglist);
 void error(const char *format, ...);
+/* run body(arg) with error() trapped on this thread; 0, or -1 with the message in *message */
+int error_catch(void (*body)(void *), void *arg, char **message);
+/* report a message error_catch got on another thread as error() would on this one, freeing it */
+void error_raise(char *message);
 
 #ifdef __cplusplus
 }
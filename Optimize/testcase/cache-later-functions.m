@@ -0,0 +1,36 @@
+# 缓存：前面的函数多了临时变量和标号后，后面的函数仍应命中缓存，期望输出 10 16
+main()
+{
+	int a;
+	a = 4;
+	# 编辑处
+	a = twice(a + 1);
+	output a;
+	output " ";
+	a = sum(a - 4);
+	output a;
+	output "\n";
+}
+
+twice(n)
+{
+	int r;
+	r = n + n;
+	if(r > 100)
+	{
+		r = 100;
+	}
+	return r;
+}
+
+sum(n)
+{
+	int s;
+	s = 0;
+	while(n > 0)
+	{
+		s = s + n;
+		n = n - 1;
+	}
+	return s - 5;
+}
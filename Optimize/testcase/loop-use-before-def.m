@@ -0,0 +1,15 @@
+# licm 不能把循环里先读后写的赋值提到循环前，期望输出 3 9
+main()
+{
+	int c0, p0;
+	c0 = 2;
+	p0 = 3;
+	while(c0 > 0)
+	{
+		output p0;
+		output " ";
+		p0 = 9;
+		c0 = c0 - 1;
+	}
+	output "\n";
+}